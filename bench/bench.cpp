@@ -0,0 +1,418 @@
+/// Micro-benchmarks for the parsers, generators and ruleset conversion.
+///
+/// Run from the base directory so the bundled configs, snippets and templates are found:
+///     cd base && ../build/subconverter_bench [--benchmark_filter=...]
+/// Subscriptions are built from the nodes in bench/fixtures/nodes.txt, so every run sees the same
+/// input. Rulesets are read from rules/ when they have been fetched with scripts/update_rules.py,
+/// otherwise bench/fixtures/rules.list is used in place of each missing file.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <future>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include "config/binding.h"
+#include "generator/config/nodemanip.h"
+#include "generator/config/ruleconvert.h"
+#include "generator/config/subexport.h"
+#include "generator/template/templates.h"
+#include "handler/settings.h"
+#include "parser/subparser.h"
+#include "server/webserver.h"
+#include "utils/base64/base64.h"
+#include "utils/file_extra.h"
+#include "utils/ini_reader/ini_reader.h"
+#include "utils/string.h"
+
+/// the settings and handlers reach the server through this global, src/main.cpp defines it for the real binary
+WebServer webServer;
+
+static const char *bench_external_config = "config/ACL4SSR_Online_Full.ini";
+static const char *bench_template = "base/all_base.tpl";
+/// inputs shared with scripts/loadtest.py
+static const char *bench_fixture_nodes = "../bench/fixtures/nodes.txt";
+static const char *bench_fixture_rules = "../bench/fixtures/rules.list";
+/// remote ACL4SSR lists are read from where scripts/update_rules.py puts them
+static const char *acl4ssr_remote_prefix = "https://raw.githubusercontent.com/ACL4SSR/ACL4SSR/master/";
+
+static string_array readLines(const std::string &path)
+{
+    string_array lines;
+    for(std::string &x : split(fileGet(path), "\n"))
+    {
+        x = trimWhitespace(x, true, true);
+        if(x.empty() || x[0] == ';' || x[0] == '#')
+            continue;
+        lines.emplace_back(std::move(x));
+    }
+    return lines;
+}
+
+/// a mixed-protocol base64 subscription of the first count fixture nodes, repeated when more are asked for
+static const std::string &subscriptionFixture(size_t count)
+{
+    static std::map<size_t, std::string> cache;
+    auto iter = cache.find(count);
+    if(iter != cache.end())
+        return iter->second;
+
+    static const string_array nodes = readLines(bench_fixture_nodes);
+    std::string links;
+    for(size_t i = 0; i < count && !nodes.empty(); i++)
+    {
+        links += nodes[i % nodes.size()];
+        links += "\n";
+    }
+    return cache.emplace(count, base64Encode(links)).first->second;
+}
+
+static std::vector<Proxy> nodesFixture(size_t count)
+{
+    std::vector<Proxy> nodes;
+    explodeSub(subscriptionFixture(count), nodes);
+    return nodes;
+}
+
+/// the surge rule list behind a ruleset path, the fixture rules when the file has not been fetched
+static std::string rulesFixture(const std::string &path)
+{
+    if(fileExist(path))
+        return fileGet(path);
+    static const std::string rules = fileGet(bench_fixture_rules);
+    return rules;
+}
+
+struct ConfigFixture
+{
+    ProxyGroupConfigs groups;
+    std::vector<RulesetContent> rulesets;
+};
+
+/// proxy groups and rulesets of the bundled ACL4SSR external config
+static const ConfigFixture &configFixture()
+{
+    static ConfigFixture fixture = []()
+    {
+        ConfigFixture fixture;
+        INIReader ini;
+        ini.allow_dup_section_titles = true;
+        ini.parse(fileGet(bench_external_config));
+        string_array groups, rulesets;
+        ini.get_all("custom", "custom_proxy_group", groups);
+        ini.get_all("custom", "ruleset", rulesets);
+        fixture.groups = INIBinding::from<ProxyGroupConfig>::from_ini(groups);
+        for(RulesetConfig &x : INIBinding::from<RulesetConfig>::from_ini(rulesets))
+        {
+            RulesetContent content;
+            content.rule_group = x.Group;
+            content.rule_path = startsWith(x.Url, acl4ssr_remote_prefix) ? "rules/ACL4SSR/" + x.Url.substr(strlen(acl4ssr_remote_prefix)) : x.Url;
+            std::promise<std::string> rules;
+            rules.set_value(startsWith(x.Url, "[]") ? x.Url : rulesFixture(content.rule_path));
+            content.rule_content = rules.get_future().share();
+            fixture.rulesets.emplace_back(std::move(content));
+        }
+        return fixture;
+    }();
+    return fixture;
+}
+
+static void setupExt(extra_settings &ext)
+{
+    static const RegexMatchConfigs renames = INIBinding::from<RegexMatchConfig>::from_ini(readLines("snippets/rename_node.txt"), "@");
+    static const RegexMatchConfigs emojis = INIBinding::from<RegexMatchConfig>::from_ini(readLines("snippets/emoji.txt"), ",");
+    ext.rename_array = &renames;
+    ext.emoji_array = &emojis;
+    ext.add_emoji = ext.remove_emoji = ext.sort_flag = true;
+    ext.filter_deprecated = true;
+    ext.clash_new_field_name = true;
+    ext.managed_config_prefix = "http://127.0.0.1:25500";
+}
+
+static std::string renderBase(const std::string &target)
+{
+    template_args vars;
+    vars.request_params["target"] = target;
+    vars.local_vars["clash.new_field_name"] = "true";
+    std::string output;
+    render_template(fileGet(bench_template), vars, output, global->templatePath);
+    return output;
+}
+
+static void BM_ExplodeSub(benchmark::State &state)
+{
+    const std::string &sub = subscriptionFixture(state.range(0));
+    for(auto _ : state)
+    {
+        std::vector<Proxy> nodes;
+        explodeSub(sub, nodes);
+        benchmark::DoNotOptimize(nodes.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * sub.size()));
+}
+BENCHMARK(BM_ExplodeSub)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+static void BM_ExplodeClash(benchmark::State &state)
+{
+    std::vector<Proxy> source = nodesFixture(state.range(0));
+    extra_settings ext;
+    ext.nodelist = true;
+    std::vector<RulesetContent> rulesets;
+    YAML::Node yamlnode = YAML::Load(proxyToClash(source, "", rulesets, {}, false, ext));
+    for(auto _ : state)
+    {
+        std::vector<Proxy> nodes;
+        explodeClash(yamlnode, nodes);
+        benchmark::DoNotOptimize(nodes.data());
+    }
+}
+BENCHMARK(BM_ExplodeClash)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+static void BM_ExplodeSurge(benchmark::State &state)
+{
+    std::vector<Proxy> source = nodesFixture(state.range(0));
+    extra_settings ext;
+    ext.nodelist = true;
+    std::vector<RulesetContent> rulesets;
+    std::string surge = proxyToSurge(source, "", rulesets, {}, 4, ext);
+    for(auto _ : state)
+    {
+        std::vector<Proxy> nodes;
+        explodeSurge(surge, nodes);
+        benchmark::DoNotOptimize(nodes.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * surge.size()));
+}
+BENCHMARK(BM_ExplodeSurge)->Arg(100)->Arg(1000)->Arg(5000)->Unit(benchmark::kMillisecond);
+
+static void BM_PreprocessNodes(benchmark::State &state)
+{
+    std::vector<Proxy> source = nodesFixture(state.range(0));
+    extra_settings ext;
+    setupExt(ext);
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<Proxy> nodes = source;
+        state.ResumeTiming();
+        preprocessNodes(nodes, ext);
+        benchmark::DoNotOptimize(nodes.data());
+    }
+}
+BENCHMARK(BM_PreprocessNodes)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+/// each generator gets a preprocessed node list and the base rendered for its target, like a /sub request
+template <typename Generator>
+static void runGenerator(benchmark::State &state, const std::string &target, Generator generate)
+{
+    std::vector<Proxy> source = nodesFixture(state.range(0));
+    extra_settings ext;
+    setupExt(ext);
+    preprocessNodes(source, ext);
+    std::string base = target.empty() ? "" : renderBase(target);
+    std::vector<RulesetContent> rulesets = configFixture().rulesets;
+    const ProxyGroupConfigs &groups = configFixture().groups;
+    size_t output_size = 0;
+    for(auto _ : state)
+    {
+        state.PauseTiming();
+        std::vector<Proxy> nodes = source;
+        state.ResumeTiming();
+        std::string output = generate(nodes, base, rulesets, groups, ext);
+        output_size = output.size();
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.counters["output_bytes"] = static_cast<double>(output_size);
+}
+
+using RulesetContents = std::vector<RulesetContent>;
+
+static void BM_ProxyToClash(benchmark::State &state)
+{
+    runGenerator(state, "clash", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToClash(nodes, base, rulesets, groups, false, ext);
+    });
+}
+BENCHMARK(BM_ProxyToClash)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToSurge(benchmark::State &state)
+{
+    runGenerator(state, "surge", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToSurge(nodes, base, rulesets, groups, 4, ext);
+    });
+}
+BENCHMARK(BM_ProxyToSurge)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToMellow(benchmark::State &state)
+{
+    runGenerator(state, "mellow", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToMellow(nodes, base, rulesets, groups, ext);
+    });
+}
+BENCHMARK(BM_ProxyToMellow)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToLoon(benchmark::State &state)
+{
+    runGenerator(state, "loon", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToLoon(nodes, base, rulesets, groups, ext);
+    });
+}
+BENCHMARK(BM_ProxyToLoon)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToQuanX(benchmark::State &state)
+{
+    runGenerator(state, "quanx", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToQuanX(nodes, base, rulesets, groups, ext);
+    });
+}
+BENCHMARK(BM_ProxyToQuanX)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToQuan(benchmark::State &state)
+{
+    runGenerator(state, "quan", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToQuan(nodes, base, rulesets, groups, ext);
+    });
+}
+BENCHMARK(BM_ProxyToQuan)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToSingBox(benchmark::State &state)
+{
+    runGenerator(state, "singbox", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &rulesets, const ProxyGroupConfigs &groups, extra_settings &ext)
+    {
+        return proxyToSingBox(nodes, base, rulesets, groups, ext);
+    });
+}
+BENCHMARK(BM_ProxyToSingBox)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToSSSub(benchmark::State &state)
+{
+    runGenerator(state, "sssub", [](std::vector<Proxy> &nodes, const std::string &base, RulesetContents &, const ProxyGroupConfigs &, extra_settings &ext)
+    {
+        return proxyToSSSub(base, nodes, ext);
+    });
+}
+BENCHMARK(BM_ProxyToSSSub)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToSSD(benchmark::State &state)
+{
+    runGenerator(state, "", [](std::vector<Proxy> &nodes, const std::string &, RulesetContents &, const ProxyGroupConfigs &, extra_settings &ext)
+    {
+        std::string group = "bench", userinfo;
+        return proxyToSSD(nodes, group, userinfo, ext);
+    });
+}
+BENCHMARK(BM_ProxyToSSD)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void BM_ProxyToSingle(benchmark::State &state)
+{
+    runGenerator(state, "", [](std::vector<Proxy> &nodes, const std::string &, RulesetContents &, const ProxyGroupConfigs &, extra_settings &ext)
+    {
+        return proxyToSingle(nodes, 15, ext);
+    });
+}
+BENCHMARK(BM_ProxyToSingle)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+/// the ruleset fixture converted to the source format of each ruleset type first
+static std::string rulesetInFormat(const std::string &surge, int type)
+{
+    if(type == RULESET_SURGE)
+        return surge;
+    std::string output = type == RULESET_QUANX ? "" : "payload:\n";
+    for(const std::string &x : split(surge, "\n"))
+    {
+        string_array parts = split(x, ",");
+        if(parts.size() < 2 || x[0] == '#')
+            continue;
+        switch(type)
+        {
+        case RULESET_QUANX:
+            output += (parts[0] == "DOMAIN-SUFFIX" ? "HOST-SUFFIX" : parts[0] == "DOMAIN" ? "HOST" : parts[0] == "DOMAIN-KEYWORD" ? "HOST-KEYWORD" : parts[0]) + "," + parts[1] + ",Proxy\n";
+            break;
+        case RULESET_CLASH_DOMAIN:
+            if(parts[0] == "DOMAIN-SUFFIX" || parts[0] == "DOMAIN")
+                output += "  - '" + std::string(parts[0] == "DOMAIN" ? "" : "+.") + parts[1] + "'\n";
+            break;
+        case RULESET_CLASH_IPCIDR:
+            if(parts[0] == "IP-CIDR" || parts[0] == "IP-CIDR6")
+                output += "  - '" + parts[1] + "'\n";
+            break;
+        default:
+            output += "  - " + x + "\n";
+            break;
+        }
+    }
+    return output;
+}
+
+static void BM_ConvertRuleset(benchmark::State &state)
+{
+    int type = static_cast<int>(state.range(0));
+    std::string surge;
+    for(const RulesetContent &x : configFixture().rulesets)
+        if(!startsWith(x.rule_path, "[]"))
+            surge += x.rule_content.get() + "\n";
+    std::string content = rulesetInFormat(surge, type);
+    for(auto _ : state)
+    {
+        std::string output = convertRuleset(content, type);
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.SetBytesProcessed(static_cast<int64_t>(state.iterations() * content.size()));
+}
+BENCHMARK(BM_ConvertRuleset)->DenseRange(RULESET_SURGE, RULESET_CLASH_CLASSICAL)->Unit(benchmark::kMillisecond);
+
+static void BM_RulesetToClashStr(benchmark::State &state)
+{
+    std::vector<RulesetContent> rulesets = configFixture().rulesets;
+    size_t output_size = 0;
+    for(auto _ : state)
+    {
+        YAML::Node base_rule;
+        std::string output = rulesetToClashStr(base_rule, rulesets, true, true);
+        output_size = output.size();
+        benchmark::DoNotOptimize(output.data());
+    }
+    state.counters["output_bytes"] = static_cast<double>(output_size);
+}
+BENCHMARK(BM_RulesetToClashStr)->Unit(benchmark::kMillisecond);
+
+static void BM_RenderTemplate(benchmark::State &state)
+{
+    static const char *targets[] = {"clash", "surge", "quanx", "loon", "singbox"};
+    std::string content = fileGet(bench_template);
+    template_args vars;
+    vars.request_params["target"] = targets[state.range(0)];
+    vars.local_vars["clash.new_field_name"] = "true";
+    state.SetLabel(targets[state.range(0)]);
+    for(auto _ : state)
+    {
+        std::string output;
+        render_template(content, vars, output, global->templatePath);
+        benchmark::DoNotOptimize(output.data());
+    }
+}
+BENCHMARK(BM_RenderTemplate)->DenseRange(0, 4)->Unit(benchmark::kMicrosecond);
+
+int main(int argc, char *argv[])
+{
+    /// keep the logs quiet and let the whole ruleset through
+    global.update([](Settings &conf)
+    {
+        conf.logLevel = LOG_LEVEL_ERROR;
+        conf.maxAllowedRules = 0;
+    });
+    benchmark::Initialize(&argc, argv);
+    if(benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
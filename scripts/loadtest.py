@@ -0,0 +1,355 @@
+import argparse
+import base64
+import http.client
+import http.server
+import json
+import logging
+import os
+import random
+import re
+import shutil
+import socket
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+import urllib.parse
+import zlib
+
+ACL4SSR_REMOTE_PREFIX = "https://raw.githubusercontent.com/ACL4SSR/ACL4SSR/master/"
+# nodes and rules shared with bench/bench.cpp
+FIXTURE_PATH = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "bench", "fixtures")
+# extra arguments some targets need to produce their usual output
+TARGET_ARGS = {"surge": "&ver=4"}
+
+
+def b64(data: str, urlsafe: bool = False) -> str:
+    encoded = base64.b64encode(data.encode()).decode()
+    if urlsafe:
+        encoded = encoded.replace("+", "-").replace("/", "_").rstrip("=")
+    return encoded
+
+
+def read_fixture(name: str) -> str:
+    with open(os.path.join(FIXTURE_PATH, name), encoding="utf-8") as f:
+        return f.read()
+
+
+def make_subscription(nodes: list, seed: str, count: int) -> bytes:
+    """a base64 subscription of count fixture nodes, starting at an offset picked by the seed so each upstream path differs"""
+    offset = zlib.crc32(seed.encode()) % len(nodes)
+    links = [nodes[(offset + i) % len(nodes)] for i in range(count)]
+    return b64("\n".join(links) + "\n").encode()
+
+
+class Upstream(http.server.ThreadingHTTPServer):
+    """stands in for subscription providers and rule hosts, answering after a configurable delay"""
+    daemon_threads = True
+
+    def __init__(self, base_path: str, nodes: int, latency: float, jitter: float):
+        super().__init__(("127.0.0.1", 0), UpstreamHandler)
+        self.base_path = base_path
+        self.nodes = nodes
+        self.latency = latency
+        self.jitter = jitter
+        self.lock = threading.Lock()
+        self.hits = 0
+        self.contents = {}
+        self.fixture_nodes = [x for x in read_fixture("nodes.txt").splitlines() if x and not x.startswith("#")]
+        self.fixture_rules = read_fixture("rules.list").encode()
+        config_path = os.path.join(base_path, "config", "ACL4SSR_Online_Full.ini")
+        with open(config_path, encoding="utf-8") as f:
+            config = f.read()
+        self.contents["/config.ini"] = config.replace(ACL4SSR_REMOTE_PREFIX, f"{self.url}/rules/ACL4SSR/").encode()
+
+    @property
+    def url(self) -> str:
+        return f"http://127.0.0.1:{self.server_address[1]}"
+
+    def content(self, path: str):
+        with self.lock:
+            self.hits += 1
+            if path in self.contents:
+                return self.contents[path]
+        if path.startswith("/sub/"):
+            data = make_subscription(self.fixture_nodes, path, self.nodes)
+        elif path.startswith("/rules/"):
+            local = os.path.join(self.base_path, path.lstrip("/"))
+            if os.path.isfile(local):
+                with open(local, "rb") as f:
+                    data = f.read()
+            else:
+                data = self.fixture_rules
+        else:
+            return None
+        with self.lock:
+            self.contents[path] = data
+        return data
+
+
+class UpstreamHandler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def do_GET(self):
+        server: Upstream = self.server
+        data = server.content(urllib.parse.urlsplit(self.path).path)
+        delay = server.latency + random.uniform(0, server.jitter)
+        if delay > 0:
+            time.sleep(delay)
+        if data is None:
+            self.send_response(404)
+            self.send_header("Content-Length", "0")
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "text/plain; charset=utf-8")
+        self.send_header("Content-Length", str(len(data)))
+        self.end_headers()
+        self.wfile.write(data)
+
+    def log_message(self, format, *args):
+        pass
+
+
+def write_pref(work_path: str, port: int, token: str, overrides: list[str]):
+    with open(os.path.join(work_path, "pref.example.ini"), encoding="utf-8") as f:
+        pref = f.read()
+    settings = {"listen": "127.0.0.1", "port": str(port), "api_access_token": token, "log_level": "warn"}
+    for x in overrides:
+        key, sep, value = x.partition("=")
+        if not sep:
+            raise SystemExit(f"invalid setting {x}, expected key=value")
+        settings[key.strip()] = value.strip()
+    for key, value in settings.items():
+        pref, count = re.subn(rf"^{re.escape(key)}=.*$", lambda _: f"{key}={value}", pref, count=1, flags=re.M)
+        if count == 0:
+            raise SystemExit(f"unknown setting {key} in pref.example.ini")
+    with open(os.path.join(work_path, "pref.ini"), "w", encoding="utf-8") as f:
+        f.write(pref)
+
+
+def free_port() -> int:
+    with socket.socket() as s:
+        s.bind(("127.0.0.1", 0))
+        return s.getsockname()[1]
+
+
+def wait_ready(port: int, process: subprocess.Popen, timeout: float):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if process.poll() is not None:
+            raise SystemExit(f"subconverter exited with code {process.returncode}")
+        try:
+            conn = http.client.HTTPConnection("127.0.0.1", port, timeout=1)
+            conn.request("GET", "/version")
+            if conn.getresponse().status == 200:
+                return
+        except OSError:
+            pass
+        time.sleep(0.1)
+    raise SystemExit("subconverter did not start in time")
+
+
+class RssSampler(threading.Thread):
+    """tracks the peak resident set size of a process from /proc"""
+
+    def __init__(self, pid: int):
+        super().__init__(daemon=True)
+        self.pid = pid
+        self.peak = 0
+        self.stopped = threading.Event()
+
+    def read(self, field: str) -> int:
+        try:
+            with open(f"/proc/{self.pid}/status") as f:
+                for line in f:
+                    if line.startswith(field + ":"):
+                        return int(line.split()[1]) * 1024
+        except OSError:
+            pass
+        return 0
+
+    def run(self):
+        while not self.stopped.wait(0.2):
+            self.peak = max(self.peak, self.read("VmRSS"))
+
+    def stop(self) -> int:
+        self.stopped.set()
+        self.join()
+        return max(self.peak, self.read("VmHWM"))
+
+
+def parse_mix(mix: str) -> tuple[list[str], list[int]]:
+    targets, weights = [], []
+    for x in mix.split(","):
+        name, _, weight = x.partition("=")
+        targets.append(name.strip())
+        weights.append(int(weight) if weight else 1)
+    return targets, weights
+
+
+def run_load(port: int, upstream: Upstream, args) -> list[tuple[float, int, int, str]]:
+    targets, weights = parse_mix(args.mix)
+    config = urllib.parse.quote(f"{upstream.url}/config.ini", safe="")
+    results = []
+    lock = threading.Lock()
+    deadline = time.time() + args.duration
+    issued = iter(range(args.requests)) if args.requests else None
+
+    def worker(index: int):
+        rng = random.Random(f"{args.seed}-{index}")
+        conn = http.client.HTTPConnection("127.0.0.1", port, timeout=args.timeout)
+        while True:
+            if issued is not None:
+                with lock:
+                    if next(issued, None) is None:
+                        return
+            elif time.time() >= deadline:
+                return
+            target = rng.choices(targets, weights)[0]
+            variant = rng.randrange(args.variants)
+            urls = "|".join(f"{upstream.url}/sub/{variant}/{i}" for i in range(args.subs))
+            path = f"/sub?target={target}{TARGET_ARGS.get(target, '')}&url={urllib.parse.quote(urls, safe='')}&config={config}"
+            start = time.perf_counter()
+            try:
+                conn.request("GET", path, headers={"Accept-Encoding": args.accept_encoding})
+                response = conn.getresponse()
+                size = len(response.read())
+                status = response.status
+            except (OSError, http.client.HTTPException):
+                conn.close()
+                conn = http.client.HTTPConnection("127.0.0.1", port, timeout=args.timeout)
+                size, status = 0, 0
+            elapsed = time.perf_counter() - start
+            with lock:
+                results.append((elapsed, status, size, target))
+
+    threads = [threading.Thread(target=worker, args=(i,)) for i in range(args.concurrency)]
+    for t in threads:
+        t.start()
+    for t in threads:
+        t.join()
+    return results
+
+
+def percentile(values: list[float], p: float) -> float:
+    if not values:
+        return 0.0
+    index = min(len(values) - 1, max(0, round(p / 100 * len(values)) - 1))
+    return values[index]
+
+
+def fetch_metrics(port: int, token: str) -> dict[str, float]:
+    metrics = {}
+    try:
+        conn = http.client.HTTPConnection("127.0.0.1", port, timeout=5)
+        conn.request("GET", f"/metrics?token={token}")
+        response = conn.getresponse()
+        if response.status != 200:
+            return metrics
+        for line in response.read().decode().splitlines():
+            if line.startswith("subconverter_fetch_cache") or line.startswith("subconverter_upstream_transfers_total"):
+                name, _, value = line.rpartition(" ")
+                metrics[name] = float(value)
+    except OSError:
+        pass
+    return metrics
+
+
+def main():
+    parser = argparse.ArgumentParser(description="drive /sub of a local subconverter against a fake upstream and report throughput, latency and peak RSS")
+    parser.add_argument("-b", "--binary", required=True, help="subconverter executable to test")
+    parser.add_argument("--base", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "base"), help="base directory copied as the working directory")
+    parser.add_argument("-s", "--set", action="append", default=[], metavar="KEY=VALUE", help="override a setting of pref.example.ini, e.g. max_concurrent_threads=8")
+    parser.add_argument("-c", "--concurrency", type=int, default=16, help="clients sending requests at the same time")
+    parser.add_argument("-d", "--duration", type=float, default=30, help="seconds to run for")
+    parser.add_argument("-n", "--requests", type=int, default=0, help="stop after this many requests instead of after --duration")
+    parser.add_argument("--mix", default="clash=6,surge=2,quanx=1,loon=1,singbox=2,ss=1", help="targets to request, with their relative weights")
+    parser.add_argument("--nodes", type=int, default=200, help="nodes in each upstream subscription")
+    parser.add_argument("--subs", type=int, default=2, help="upstream subscriptions merged by each request")
+    parser.add_argument("--variants", type=int, default=4, help="distinct subscription sets requests pick from")
+    parser.add_argument("--latency", type=float, default=50, help="upstream response delay in ms")
+    parser.add_argument("--jitter", type=float, default=20, help="extra random upstream delay in ms")
+    parser.add_argument("--accept-encoding", default="identity", help="Accept-Encoding sent with each request")
+    parser.add_argument("--timeout", type=float, default=60, help="request timeout in seconds")
+    parser.add_argument("--seed", default="subconverter", help="seed for the request sequence")
+    parser.add_argument("--json", action="store_true", help="print the report as JSON")
+    parser.add_argument("--keep", action="store_true", help="keep the working directory and subconverter log")
+    args = parser.parse_args()
+    logging.basicConfig(format="%(asctime)s %(message)s", level=logging.INFO)
+
+    work_path = tempfile.mkdtemp(prefix="subconverter-loadtest-")
+    shutil.copytree(os.path.abspath(args.base), work_path, dirs_exist_ok=True)
+    upstream = Upstream(work_path, args.nodes, args.latency / 1000, args.jitter / 1000)
+    threading.Thread(target=upstream.serve_forever, daemon=True).start()
+
+    port, token = free_port(), "loadtest"
+    write_pref(work_path, port, token, args.set)
+    log_path = os.path.join(work_path, "subconverter.log")
+    logging.info(f"starting {args.binary} on port {port}, upstream at {upstream.url}, working directory {work_path}")
+    with open(log_path, "w") as log:
+        process = subprocess.Popen([os.path.abspath(args.binary), "-f", os.path.join(work_path, "pref.ini")], stdout=log, stderr=log, cwd=work_path)
+    try:
+        wait_ready(port, process, 30)
+        sampler = RssSampler(process.pid)
+        sampler.start()
+        logging.info(f"running {args.concurrency} clients for {f'{args.requests} requests' if args.requests else f'{args.duration}s'}")
+        start = time.perf_counter()
+        results = run_load(port, upstream, args)
+        wall = time.perf_counter() - start
+        peak_rss = sampler.stop()
+        metrics = fetch_metrics(port, token)
+    finally:
+        process.terminate()
+        try:
+            process.wait(10)
+        except subprocess.TimeoutExpired:
+            process.kill()
+        upstream.shutdown()
+
+    latencies = sorted(x[0] for x in results if x[1] == 200)
+    per_target = {}
+    for elapsed, status, size, target in results:
+        entry = per_target.setdefault(target, {"requests": 0, "errors": 0, "bytes": 0})
+        entry["requests"] += 1
+        entry["errors"] += status != 200
+        entry["bytes"] += size
+    report = {
+        "settings": args.set,
+        "requests": len(results),
+        "errors": sum(1 for x in results if x[1] != 200),
+        "seconds": round(wall, 3),
+        "throughput": round(len(results) / wall, 2) if wall > 0 else 0,
+        "latency_ms": {name: round(percentile(latencies, p) * 1000, 2) for name, p in (("p50", 50), ("p90", 90), ("p99", 99), ("max", 100))},
+        "response_bytes": sum(x[2] for x in results),
+        "peak_rss_bytes": peak_rss,
+        "upstream_requests": upstream.hits,
+        "targets": per_target,
+        "metrics": metrics,
+    }
+
+    if args.json:
+        print(json.dumps(report, indent=2, ensure_ascii=False))
+    else:
+        print(f"settings:    {' '.join(args.set) or '(defaults)'}")
+        print(f"requests:    {report['requests']} in {report['seconds']}s, {report['errors']} failed")
+        print(f"throughput:  {report['throughput']} req/s")
+        print("latency:     " + ", ".join(f"{k} {v} ms" for k, v in report["latency_ms"].items()))
+        print(f"peak rss:    {peak_rss / 1048576:.1f} MiB")
+        print(f"upstream:    {upstream.hits} requests")
+        for target, entry in sorted(per_target.items()):
+            print(f"  {target:<10} {entry['requests']:>6} requests {entry['errors']:>4} failed {entry['bytes'] / max(entry['requests'], 1) / 1024:>9.1f} KiB avg")
+        for name, value in metrics.items():
+            print(f"  {name} {value:g}")
+
+    if args.keep:
+        logging.info(f"kept working directory {work_path}")
+    else:
+        shutil.rmtree(work_path, ignore_errors=True)
+    if report["errors"]:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -156,6 +156,7 @@ namespace toml
                 conf.Replace = find<String>(v, "emoji");
             else
                 conf.Replace = find<String>(v, "replace");
+            conf.Matcher = compileMatcher(conf.Match);
             return conf;
         }
     };
@@ -348,6 +349,7 @@ namespace INIBinding
                 conf.Match = x.substr(0, pos);
                 if(pos != String::npos && pos < x.size() - 1)
                     conf.Replace = x.substr(pos + 1);
+                conf.Matcher = compileMatcher(conf.Match);
                 confs.emplace_back(std::move(conf));
             }
             return confs;
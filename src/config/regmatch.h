@@ -2,12 +2,58 @@
 #define REGMATCH_H_INCLUDED
 
 #include "def.h"
+#include "utils/regexp.h"
+
+enum class MatcherType
+{
+    Remark,
+    Group,
+    GroupId,
+    Insert,
+    Type,
+    Port,
+    Server
+};
+
+enum class MatchRangeType
+{
+    Equal,
+    Within,
+    NotEqual,
+    NotWithin,
+    UpTo,
+    From
+};
+
+struct MatchRange
+{
+    MatchRangeType Type = MatchRangeType::Equal;
+    int Begin = 0;
+    int End = 0;
+};
+
+/// a "!!TYPE=...!!rule" style matcher, parsed once so it can be applied to every node directly
+struct NodeMatcher
+{
+    MatcherType Type = MatcherType::Remark;
+    std::vector<MatchRange> Range;
+    RegexPattern Target;
+    uint32_t TypeMask = 0;
+    String Rule;
+    RegexPattern RuleRegex;
+};
+
+using NodeMatchers = std::vector<NodeMatcher>;
+
+NodeMatcher compileMatcher(const std::string &rule);
+NodeMatchers compileMatchers(const string_array &rules);
 
 struct RegexMatchConfig
 {
     String Match;
     String Replace;
     String Script;
+    NodeMatcher Matcher;
 };
 
 using RegexMatchConfigs = std::vector<RegexMatchConfig>;
@@ -3,25 +3,24 @@
 #include <iostream>
 #include <algorithm>
 
+#include "handler/multithread.h"
 #include "handler/settings.h"
 #include "handler/webget.h"
 #include "parser/config/proxy.h"
 #include "parser/infoparser.h"
 #include "parser/subparser.h"
 #include "script/script_quickjs.h"
+#include "utils/defer.h"
 #include "utils/file_extra.h"
 #include "utils/logger.h"
 #include "utils/map_extra.h"
+#include "utils/metrics.h"
 #include "utils/network.h"
 #include "utils/regexp.h"
 #include "utils/urlencode.h"
 #include "nodemanip.h"
 #include "subexport.h"
 
-extern Settings global;
-
-bool applyMatcher(const std::string &rule, std::string &real_rule, const Proxy &node);
-
 int explodeConf(const std::string &filepath, std::vector<Proxy> &nodes)
 {
     return explodeConfContent(fileGet(filepath), nodes);
@@ -34,11 +33,12 @@ void copyNodes(std::vector<Proxy> &source, std::vector<Proxy> &dest)
 
 int addNodes(std::string link, std::vector<Proxy> &allNodes, int groupID, parse_settings &parse_set)
 {
+    StageTimer timer(METRIC_STAGE_PARSE);
     std::string &proxy = *parse_set.proxy, &subInfo = *parse_set.sub_info;
     string_array &exclude_remarks = *parse_set.exclude_remarks;
     string_array &include_remarks = *parse_set.include_remarks;
-    RegexMatchConfigs &stream_rules = *parse_set.stream_rules;
-    RegexMatchConfigs &time_rules = *parse_set.time_rules;
+    const RegexMatchConfigs &stream_rules = *parse_set.stream_rules;
+    const RegexMatchConfigs &time_rules = *parse_set.time_rules;
     string_icase_map *request_headers = parse_set.request_header;
     bool &authorized = parse_set.authorized;
 
@@ -88,7 +88,7 @@ int addNodes(std::string link, std::vector<Proxy> &allNodes, int groupID, parse_
                 }
             }
         }
-    }, global.scriptCleanContext);
+    }, global->scriptCleanContext);
             /*
             duk_context *ctx = duktape_init();
             defer(duk_destroy_heap(ctx);)
@@ -142,7 +142,7 @@ int addNodes(std::string link, std::vector<Proxy> &allNodes, int groupID, parse_
         writeLog(LOG_TYPE_INFO, "Downloading subscription data...");
         if(startsWith(link, "surge:///install-config")) //surge config link
             link = urlDecode(getUrlArg(link, "url"));
-        strSub = webGet(link, proxy, global.cacheSubscription, &extra_headers, request_headers);
+        strSub = webGet(link, proxy, global->cacheSubscription, &extra_headers, request_headers);
         /*
         if(strSub.size() == 0)
         {
@@ -230,32 +230,81 @@ int addNodes(std::string link, std::vector<Proxy> &allNodes, int groupID, parse_
     return 0;
 }
 
-bool chkIgnore(const Proxy &node, string_array &exclude_remarks, string_array &include_remarks)
+/// fetch and parse all links concurrently, link i gets groupID + i * groupStep and the results are merged in link order
+int addNodesParallel(string_array &links, std::vector<Proxy> &allNodes, int groupID, int groupStep, parse_settings &parse_set, std::string &failed_link)
+{
+    struct LinkResult
+    {
+        std::vector<Proxy> nodes;
+        std::string sub_info;
+        int ret = 0;
+    };
+    std::vector<LinkResult> results(links.size());
+    std::vector<size_t> pending, script_links;
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        links[i] = regTrim(links[i]);
+        writeLog(0, "Fetching node data from url '" + links[i] + "'.", LOG_LEVEL_INFO);
+        /// script links may share one JS context, so they stay on this thread
+        if(links[i].find("script:") != std::string::npos)
+            script_links.emplace_back(i);
+        else
+            pending.emplace_back(i);
+    }
+
+    auto run = [&](size_t index)
+    {
+        parse_settings link_set = parse_set;
+        link_set.sub_info = &results[index].sub_info;
+        results[index].ret = addNodes(links[index], results[index].nodes, groupID + static_cast<int>(index) * groupStep, link_set);
+    };
+    sharedExecutor().parallelFor(pending.size(), global->maxParallelFetches, [&](size_t index){ run(pending[index]); });
+    for(size_t index : script_links)
+        run(index);
+
+    for(size_t i = 0; i < links.size(); i++)
+    {
+        if(results[i].ret == -1)
+        {
+            if(global->skipFailedLinks)
+            {
+                writeLog(0, "The following link doesn't contain any valid node info: " + links[i], LOG_LEVEL_WARNING);
+                continue;
+            }
+            failed_link = links[i];
+            return -1;
+        }
+        if(!results[i].sub_info.empty())
+            *parse_set.sub_info = results[i].sub_info;
+        std::move(results[i].nodes.begin(), results[i].nodes.end(), std::back_inserter(allNodes));
+    }
+    return 0;
+}
+
+bool chkIgnore(const Proxy &node, const NodeMatchers &exclude_remarks, const NodeMatchers &include_remarks)
 {
     bool included;
     //std::string remarks = UTF8ToACP(node.remarks);
     //std::string remarks = node.remarks;
     //writeLog(LOG_TYPE_INFO, "Comparing exclude remarks...");
-    bool excluded = std::any_of(exclude_remarks.cbegin(), exclude_remarks.cend(), [&node](const auto &x)
+    bool excluded = std::any_of(exclude_remarks.cbegin(), exclude_remarks.cend(), [&node](const NodeMatcher &x)
     {
-        std::string real_rule;
-        if (applyMatcher(x, real_rule, node))
+        if (applyMatcher(x, node))
         {
-            if (real_rule.empty()) return true;
-            return regFind(node.Remark, real_rule);
+            if (x.Rule.empty()) return true;
+            return regFind(node.Remark, x.RuleRegex);
         }
         return false;
     });
     if(!include_remarks.empty())
     {
         //writeLog(LOG_TYPE_INFO, "Comparing include remarks...");
-        included = std::any_of(include_remarks.cbegin(), include_remarks.cend(), [&node](const auto &x)
+        included = std::any_of(include_remarks.cbegin(), include_remarks.cend(), [&node](const NodeMatcher &x)
         {
-            std::string real_rule;
-            if(applyMatcher(x, real_rule, node))
+            if(applyMatcher(x, node))
             {
-                if(real_rule.empty()) return true;
-                return regFind(node.Remark, real_rule);
+                if(x.Rule.empty()) return true;
+                return regFind(node.Remark, x.RuleRegex);
             }
             return false;
         });
@@ -270,11 +319,14 @@ bool chkIgnore(const Proxy &node, string_array &exclude_remarks, string_array &i
 
 void filterNodes(std::vector<Proxy> &nodes, string_array &exclude_remarks, string_array &include_remarks, int groupID)
 {
+    StageTimer timer(METRIC_STAGE_FILTER);
+    size_t node_count = nodes.size();
     int node_index = 0;
+    NodeMatchers exclude_matchers = compileMatchers(exclude_remarks), include_matchers = compileMatchers(include_remarks);
     auto iter = nodes.begin();
     while(iter != nodes.end())
     {
-        if(chkIgnore(*iter, exclude_remarks, include_remarks))
+        if(chkIgnore(*iter, exclude_matchers, include_matchers))
         {
             writeLog(LOG_TYPE_INFO, "Node  " + iter->Group + " - " + iter->Remark + "  has been ignored and will not be added.");
             nodes.erase(iter);
@@ -369,15 +421,21 @@ void filterNodes(std::vector<Proxy> &nodes, string_array &exclude_remarks, strin
         }
     }
     */
+    if(RequestTracePtr trace = traceCurrent())
+        trace->addFilter(groupID, node_count, nodes.size());
     writeLog(LOG_TYPE_INFO, "Filter done.");
 }
 
 void nodeRename(Proxy &node, const RegexMatchConfigs &rename_array, extra_settings &ext)
 {
-    std::string &remark = node.Remark, original_remark = node.Remark, returned_remark, real_rule;
+    std::string &remark = node.Remark, original_remark = node.Remark, returned_remark;
+    RequestTracePtr trace = traceCurrent();
 
-    for(const RegexMatchConfig &x : rename_array)
+    for(size_t i = 0; i < rename_array.size(); i++)
     {
+        const RegexMatchConfig &x = rename_array[i];
+        auto start = trace ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        defer(if(trace) trace->addRule(trace->rename_rules, i, x.Script.empty() ? x.Match : "script", std::chrono::steady_clock::now() - start);)
         if(!x.Script.empty() && ext.authorized)
         {
             script_safe_runner(ext.js_runtime, ext.js_context, [&](qjs::Context &ctx)
@@ -397,11 +455,11 @@ void nodeRename(Proxy &node, const RegexMatchConfigs &rename_array, extra_settin
                 {
                     script_print_stack(ctx);
                 }
-            }, global.scriptCleanContext);
+            }, global->scriptCleanContext);
             continue;
         }
-        if(applyMatcher(x.Match, real_rule, node) && real_rule.size())
-            remark = regReplace(remark, real_rule, x.Replace);
+        if(applyMatcher(x.Matcher, node) && !x.Matcher.Rule.empty())
+            remark = regReplace(remark, x.Matcher.RuleRegex, x.Replace);
     }
     if(remark.empty())
         remark = original_remark;
@@ -426,10 +484,14 @@ std::string removeEmoji(const std::string &orig_remark)
 
 std::string addEmoji(const Proxy &node, const RegexMatchConfigs &emoji_array, extra_settings &ext)
 {
-    std::string real_rule, ret;
+    std::string ret;
+    RequestTracePtr trace = traceCurrent();
 
-    for(const RegexMatchConfig &x : emoji_array)
+    for(size_t i = 0; i < emoji_array.size(); i++)
     {
+        const RegexMatchConfig &x = emoji_array[i];
+        auto start = trace ? std::chrono::steady_clock::now() : std::chrono::steady_clock::time_point();
+        defer(if(trace) trace->addRule(trace->emoji_rules, i, x.Script.empty() ? x.Match : "script", std::chrono::steady_clock::now() - start);)
         if(!x.Script.empty() && ext.authorized)
         {
             std::string result;
@@ -450,14 +512,14 @@ std::string addEmoji(const Proxy &node, const RegexMatchConfigs &emoji_array, ex
                 {
                     script_print_stack(ctx);
                 }
-            }, global.scriptCleanContext);
+            }, global->scriptCleanContext);
             if(!result.empty())
                 return result;
             continue;
         }
         if(x.Replace.empty())
             continue;
-        if(applyMatcher(x.Match, real_rule, node) && real_rule.size() && regFind(node.Remark, real_rule))
+        if(applyMatcher(x.Matcher, node) && !x.Matcher.Rule.empty() && regFind(node.Remark, x.Matcher.RuleRegex))
             return x.Replace + " " + node.Remark;
     }
     return node.Remark;
@@ -465,15 +527,19 @@ std::string addEmoji(const Proxy &node, const RegexMatchConfigs &emoji_array, ex
 
 void preprocessNodes(std::vector<Proxy> &nodes, extra_settings &ext)
 {
-    std::for_each(nodes.begin(), nodes.end(), [&ext](Proxy &x)
+    StageTimer timer(METRIC_STAGE_PREPROCESS);
+    static const RegexMatchConfigs no_rules;
+    const RegexMatchConfigs &rename_array = ext.rename_array ? *ext.rename_array : no_rules;
+    const RegexMatchConfigs &emoji_array = ext.emoji_array ? *ext.emoji_array : no_rules;
+    std::for_each(nodes.begin(), nodes.end(), [&](Proxy &x)
     {
         if(ext.remove_emoji)
             x.Remark = trim(removeEmoji(x.Remark));
 
-        nodeRename(x, ext.rename_array, ext);
+        nodeRename(x, rename_array, ext);
 
         if(ext.add_emoji)
-            x.Remark = addEmoji(x, ext.emoji_array, ext);
+            x.Remark = addEmoji(x, emoji_array, ext);
     });
 
     if(ext.sort_flag)
@@ -505,7 +571,7 @@ void preprocessNodes(std::vector<Proxy> &nodes, extra_settings &ext)
                 {
                     script_print_stack(ctx);
                 }
-            }, global.scriptCleanContext);
+            }, global->scriptCleanContext);
         }
         if(failed) std::stable_sort(nodes.begin(), nodes.end(), [](const Proxy &a, const Proxy &b)
         {
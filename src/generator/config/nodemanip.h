@@ -19,8 +19,8 @@ struct parse_settings
     std::string *proxy = nullptr;
     string_array *exclude_remarks = nullptr;
     string_array *include_remarks = nullptr;
-    RegexMatchConfigs *stream_rules = nullptr;
-    RegexMatchConfigs *time_rules = nullptr;
+    const RegexMatchConfigs *stream_rules = nullptr;
+    const RegexMatchConfigs *time_rules = nullptr;
     std::string *sub_info = nullptr;
     bool authorized = false;
     string_icase_map *request_header = nullptr;
@@ -31,8 +31,9 @@ struct parse_settings
 };
 
 int addNodes(std::string link, std::vector<Proxy> &allNodes, int groupID, parse_settings &parse_set);
+int addNodesParallel(string_array &links, std::vector<Proxy> &allNodes, int groupID, int groupStep, parse_settings &parse_set, std::string &failed_link);
 void filterNodes(std::vector<Proxy> &nodes, string_array &exclude_remarks, string_array &include_remarks, int groupID);
-bool applyMatcher(const std::string &rule, std::string &real_rule, const Proxy &node);
+bool applyMatcher(const NodeMatcher &matcher, const Proxy &node);
 void preprocessNodes(std::vector<Proxy> &nodes, extra_settings &ext);
 
 #endif // NODEMANIP_H_INCLUDED
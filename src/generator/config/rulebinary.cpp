@@ -0,0 +1,362 @@
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif // HAVE_ZLIB
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif // HAVE_ZSTD
+
+#include "server/socket.h"
+#include "utils/string.h"
+#include "rulebinary.h"
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+/// a trie stored as bitmaps, the layout both mihomo's DomainSet and sing-box's domain matcher read
+struct SuccinctSet
+{
+    std::vector<uint64_t> leaves, label_bitmap;
+    std::string labels;
+};
+
+static void setBit(std::vector<uint64_t> &bitmap, size_t index)
+{
+    if(bitmap.size() <= index >> 6)
+        bitmap.resize((index >> 6) + 1);
+    bitmap[index >> 6] |= uint64_t(1) << (index & 63);
+}
+
+/// keys must be sorted and unique, nodes are numbered breadth first
+static SuccinctSet buildSuccinctSet(const string_array &keys)
+{
+    struct Range
+    {
+        size_t begin, end, column;
+    };
+    SuccinctSet set;
+    std::vector<Range> queue {{0, keys.size(), 0}};
+    size_t label_index = 0;
+    for(size_t i = 0; i < queue.size(); i++)
+    {
+        Range range = queue[i];
+        if(range.column == keys[range.begin].size())
+        {
+            range.begin++;
+            setBit(set.leaves, i);
+        }
+        for(size_t j = range.begin; j < range.end;)
+        {
+            size_t from = j;
+            char label = keys[from][range.column];
+            while(j < range.end && keys[j][range.column] == label)
+                j++;
+            queue.push_back({from, j, range.column + 1});
+            set.labels += label;
+            label_index++;
+        }
+        setBit(set.label_bitmap, label_index++);
+    }
+    return set;
+}
+
+/// reversed by code point so multi-byte characters stay intact, lower-cased like the clients do before matching
+static std::string reverseDomain(const std::string &domain)
+{
+    std::string result(domain.size(), '\0');
+    size_t pos = 0;
+    while(pos < domain.size())
+    {
+        size_t length = 1;
+        while(pos + length < domain.size() && (static_cast<unsigned char>(domain[pos + length]) & 0xC0) == 0x80)
+            length++;
+        std::copy_n(domain.begin() + pos, length, result.end() - pos - length);
+        pos += length;
+    }
+    std::transform(result.begin(), result.end(), result.begin(), [](char c){ return c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c; });
+    return result;
+}
+
+static void sortUnique(string_array &keys)
+{
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+}
+
+static void writeBigEndian(std::string &output, uint64_t value)
+{
+    for(int shift = 56; shift >= 0; shift -= 8)
+        output += static_cast<char>(value >> shift);
+}
+
+static void writeUvarint(std::string &output, uint64_t value)
+{
+    while(value >= 0x80)
+    {
+        output += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    output += static_cast<char>(value);
+}
+
+/// an inclusive address range, IPv4 ranges only use the first 4 bytes
+struct IPRange
+{
+    size_t length = 0;
+    std::array<uint8_t, 16> from {}, to {};
+};
+
+static bool parseCIDR(const std::string &cidr, IPRange &range)
+{
+    string_size slash = cidr.find('/');
+    std::string address = cidr.substr(0, slash);
+    if(inet_pton(AF_INET, address.data(), range.from.data()) == 1)
+        range.length = 4;
+    else if(inet_pton(AF_INET6, address.data(), range.from.data()) == 1)
+        range.length = 16;
+    else
+        return false;
+    int prefix = static_cast<int>(range.length * 8);
+    if(slash != std::string::npos)
+    {
+        prefix = to_int(cidr.substr(slash + 1), -1);
+        if(prefix < 0 || prefix > static_cast<int>(range.length * 8))
+            return false;
+    }
+    range.to = range.from;
+    for(size_t i = 0; i < range.length; i++)
+    {
+        int bits = std::clamp(prefix - static_cast<int>(i * 8), 0, 8);
+        uint8_t mask = bits ? static_cast<uint8_t>(0xFF << (8 - bits)) : 0;
+        range.from[i] &= mask;
+        range.to[i] |= static_cast<uint8_t>(~mask);
+    }
+    return true;
+}
+
+static bool rangeLess(const IPRange &a, const IPRange &b)
+{
+    if(a.length != b.length)
+        return a.length < b.length;
+    return std::lexicographical_compare(a.from.begin(), a.from.begin() + a.length, b.from.begin(), b.from.begin() + b.length);
+}
+
+/// whether b starts at or before the address following the end of a
+static bool rangeReaches(const IPRange &a, const IPRange &b)
+{
+    std::array<uint8_t, 16> next = a.to;
+    size_t i = a.length;
+    while(i > 0 && ++next[i - 1] == 0)
+        i--;
+    if(!i) /// a ends at the last address
+        return true;
+    return !std::lexicographical_compare(next.begin(), next.begin() + a.length, b.from.begin(), b.from.begin() + a.length);
+}
+
+/// sorted with IPv4 first, overlapping and adjacent ranges merged, the normal form of an IP set in both clients
+static std::vector<IPRange> buildIPRanges(const string_array &cidrs)
+{
+    std::vector<IPRange> ranges, result;
+    IPRange range;
+    for(const std::string &x : cidrs)
+        if(parseCIDR(x, range))
+            ranges.push_back(range);
+    std::sort(ranges.begin(), ranges.end(), rangeLess);
+    for(IPRange &x : ranges)
+    {
+        if(!result.empty() && result.back().length == x.length && rangeReaches(result.back(), x))
+        {
+            IPRange &last = result.back();
+            if(std::lexicographical_compare(last.to.begin(), last.to.begin() + x.length, x.to.begin(), x.to.begin() + x.length))
+                last.to = x.to;
+            continue;
+        }
+        result.push_back(x);
+    }
+    return result;
+}
+#endif // HAVE_ZLIB || HAVE_ZSTD
+
+#ifdef HAVE_ZSTD
+static void writeMrsDomainSet(std::string &output, const BinaryRuleItems &items, size_t &count)
+{
+    string_array keys;
+    for(const std::string &x : items.domain)
+        keys.emplace_back(reverseDomain(x));
+    for(const std::string &x : items.domain_suffix)
+    {
+        keys.emplace_back(reverseDomain(x));
+        keys.emplace_back(reverseDomain("+." + x));
+    }
+    count = items.domain.size() + items.domain_suffix.size();
+    sortUnique(keys);
+    SuccinctSet set = buildSuccinctSet(keys);
+    output += '\x01';
+    writeBigEndian(output, set.leaves.size());
+    for(uint64_t x : set.leaves)
+        writeBigEndian(output, x);
+    writeBigEndian(output, set.label_bitmap.size());
+    for(uint64_t x : set.label_bitmap)
+        writeBigEndian(output, x);
+    writeBigEndian(output, set.labels.size());
+    output += set.labels;
+}
+
+static void writeMrsIPCIDRSet(std::string &output, const std::vector<IPRange> &ranges)
+{
+    output += '\x01';
+    writeBigEndian(output, ranges.size());
+    for(const IPRange &x : ranges)
+    {
+        /// IPv4 goes in as IPv4-mapped IPv6
+        for(const std::array<uint8_t, 16> *address : {&x.from, &x.to})
+        {
+            if(x.length == 4)
+                output.append("\0\0\0\0\0\0\0\0\0\0\xFF\xFF", 12);
+            output.append(reinterpret_cast<const char*>(address->data()), x.length);
+        }
+    }
+}
+#endif // HAVE_ZSTD
+
+#ifdef HAVE_ZLIB
+/// sing-box rule-set version 1, readable by every sing-box release with rule-set support
+static void writeSrsRules(std::string &output, const BinaryRuleItems &items, const std::vector<IPRange> &ranges)
+{
+    bool has_domain = !items.domain.empty() || !items.domain_suffix.empty(), has_keyword = !items.domain_keyword.empty();
+    writeUvarint(output, 1);
+    output += '\x00'; /// default rule, its domain and address items match when any of them does
+    if(has_domain)
+    {
+        /// suffixes in the legacy form: the domain itself, and "." + domain followed by the prefix label '\r'
+        string_array keys;
+        for(const std::string &x : items.domain)
+            keys.emplace_back(reverseDomain(x));
+        for(const std::string &x : items.domain_suffix)
+        {
+            keys.emplace_back(reverseDomain(x));
+            keys.emplace_back(reverseDomain("." + x) + '\r');
+        }
+        sortUnique(keys);
+        SuccinctSet set = buildSuccinctSet(keys);
+        output += '\x02';
+        output += '\x01';
+        writeUvarint(output, set.leaves.size());
+        for(uint64_t x : set.leaves)
+            writeBigEndian(output, x);
+        writeUvarint(output, set.label_bitmap.size());
+        for(uint64_t x : set.label_bitmap)
+            writeBigEndian(output, x);
+        writeUvarint(output, set.labels.size());
+        output += set.labels;
+    }
+    if(has_keyword)
+    {
+        output += '\x03';
+        writeUvarint(output, items.domain_keyword.size());
+        for(const std::string &x : items.domain_keyword)
+        {
+            writeUvarint(output, x.size());
+            output += x;
+        }
+    }
+    if(!ranges.empty())
+    {
+        output += '\x06';
+        output += '\x01';
+        writeBigEndian(output, ranges.size());
+        for(const IPRange &x : ranges)
+        {
+            for(const std::array<uint8_t, 16> *address : {&x.from, &x.to})
+            {
+                writeUvarint(output, x.length);
+                output.append(reinterpret_cast<const char*>(address->data()), x.length);
+            }
+        }
+    }
+    output += '\xFF';
+    output += '\x00'; /// not inverted
+}
+#endif // HAVE_ZLIB
+
+bool binaryRulesetAvailable(int format)
+{
+    switch(format)
+    {
+#ifdef HAVE_ZSTD
+    case RULESET_BINARY_MRS_DOMAIN: case RULESET_BINARY_MRS_IPCIDR:
+        return true;
+#endif // HAVE_ZSTD
+#ifdef HAVE_ZLIB
+    case RULESET_BINARY_SRS:
+        return true;
+#endif // HAVE_ZLIB
+    default:
+        return false;
+    }
+}
+
+bool buildBinaryRuleset([[maybe_unused]] const BinaryRuleItems &items, int format, [[maybe_unused]] std::string &output)
+{
+    std::string raw;
+    switch(format)
+    {
+#ifdef HAVE_ZSTD
+    case RULESET_BINARY_MRS_DOMAIN: case RULESET_BINARY_MRS_IPCIDR:
+    {
+        bool domain = format == RULESET_BINARY_MRS_DOMAIN;
+        std::string payload;
+        size_t count = 0;
+        if(domain)
+        {
+            if(items.domain.empty() && items.domain_suffix.empty())
+                return false;
+            writeMrsDomainSet(payload, items, count);
+        }
+        else
+        {
+            /// an empty IP set is rejected by the reader, so malformed CIDRs alone write nothing
+            std::vector<IPRange> ranges = buildIPRanges(items.ip_cidr);
+            if(ranges.empty())
+                return false;
+            writeMrsIPCIDRSet(payload, ranges);
+            count = ranges.size();
+        }
+        /// magic and version, behavior, rule count, then a length prefixed extra field kept empty
+        raw = "MRS\x01";
+        raw += domain ? '\x00' : '\x01';
+        writeBigEndian(raw, count);
+        writeBigEndian(raw, 0);
+        raw += payload;
+        output.resize(ZSTD_compressBound(raw.size()));
+        size_t size = ZSTD_compress(output.data(), output.size(), raw.data(), raw.size(), 19);
+        if(ZSTD_isError(size))
+            return false;
+        output.resize(size);
+        return true;
+    }
+#endif // HAVE_ZSTD
+#ifdef HAVE_ZLIB
+    case RULESET_BINARY_SRS:
+    {
+        std::vector<IPRange> ranges = buildIPRanges(items.ip_cidr);
+        if(items.domain.empty() && items.domain_suffix.empty() && items.domain_keyword.empty() && ranges.empty())
+            return false;
+        writeSrsRules(raw, items, ranges);
+        uLongf size = compressBound(raw.size());
+        output = "SRS\x01";
+        output.resize(4 + size);
+        if(compress2(reinterpret_cast<Bytef*>(output.data() + 4), &size, reinterpret_cast<const Bytef*>(raw.data()), raw.size(), Z_BEST_COMPRESSION) != Z_OK)
+            return false;
+        output.resize(4 + size);
+        return true;
+    }
+#endif // HAVE_ZLIB
+    default:
+        return false;
+    }
+}
@@ -0,0 +1,26 @@
+#ifndef RULEBINARY_H_INCLUDED
+#define RULEBINARY_H_INCLUDED
+
+#include <string>
+
+#include "utils/string.h"
+
+enum ruleset_binary
+{
+    RULESET_BINARY_MRS_DOMAIN,
+    RULESET_BINARY_MRS_IPCIDR,
+    RULESET_BINARY_SRS
+};
+
+/// the destination rules of a ruleset, the only rules the binary rule-set formats are used for
+struct BinaryRuleItems
+{
+    string_array domain, domain_suffix, domain_keyword, ip_cidr;
+};
+
+/// whether this build can write the format, .mrs needs zstd and .srs needs zlib
+bool binaryRulesetAvailable(int format);
+/// writes a mihomo .mrs or sing-box .srs rule-set, false when none of the items fit the format
+bool buildBinaryRuleset(const BinaryRuleItems &items, int format, std::string &output);
+
+#endif // RULEBINARY_H_INCLUDED
@@ -1,21 +1,143 @@
+#include <cstdint>
 #include <string>
+#include <list>
+#include <unordered_map>
 
 #include "handler/settings.h"
 #include "utils/logger.h"
+#include "utils/metrics.h"
 #include "utils/network.h"
 #include "utils/regexp.h"
 #include "utils/string.h"
 #include "utils/rapidjson_extra.h"
+#include "rulebinary.h"
 #include "subexport.h"
 
-/// rule type lists
-#define basic_types "DOMAIN", "DOMAIN-SUFFIX", "DOMAIN-KEYWORD", "IP-CIDR", "SRC-IP-CIDR", "GEOIP", "MATCH", "FINAL"
-string_array ClashRuleTypes = {basic_types, "IP-CIDR6", "SRC-PORT", "DST-PORT", "PROCESS-NAME"};
-string_array Surge2RuleTypes = {basic_types, "IP-CIDR6", "USER-AGENT", "URL-REGEX", "PROCESS-NAME", "IN-PORT", "DEST-PORT", "SRC-IP"};
-string_array SurgeRuleTypes = {basic_types, "IP-CIDR6", "USER-AGENT", "URL-REGEX", "AND", "OR", "NOT", "PROCESS-NAME", "IN-PORT", "DEST-PORT", "SRC-IP"};
-string_array QuanXRuleTypes = {basic_types, "USER-AGENT", "HOST", "HOST-SUFFIX", "HOST-KEYWORD"};
-string_array SurfRuleTypes = {basic_types, "IP-CIDR6", "PROCESS-NAME", "IN-PORT", "DEST-PORT", "SRC-IP"};
-string_array SingBoxRuleTypes = {basic_types, "IP-VERSION", "INBOUND", "PROTOCOL", "NETWORK", "GEOSITE", "SRC-GEOIP", "DOMAIN-REGEX", "PROCESS-NAME", "PROCESS-PATH", "PACKAGE-NAME", "PORT", "PORT-RANGE", "SRC-PORT", "SRC-PORT-RANGE", "USER", "USER-ID"};
+/// rule types and the generators taking them, a rule goes to a generator when it starts with any of its types
+#define RULE_TARGET_ALL (RULE_TARGET_CLASH | RULE_TARGET_SURGE | RULE_TARGET_SURGE2 | RULE_TARGET_QUANX | RULE_TARGET_SURFBOARD | RULE_TARGET_SINGBOX)
+#define RULE_TARGET_SURGE_LIKE (RULE_TARGET_SURGE | RULE_TARGET_SURGE2 | RULE_TARGET_SURFBOARD)
+
+struct RuleTypeInfo
+{
+    const char *name;
+    rule_type type;
+    int targets;
+};
+
+static constexpr RuleTypeInfo rule_type_list[] =
+{
+    {"DOMAIN", RULE_TYPE_DOMAIN, RULE_TARGET_ALL},
+    {"DOMAIN-SUFFIX", RULE_TYPE_DOMAIN_SUFFIX, RULE_TARGET_ALL},
+    {"DOMAIN-KEYWORD", RULE_TYPE_DOMAIN_KEYWORD, RULE_TARGET_ALL},
+    {"DOMAIN-REGEX", RULE_TYPE_DOMAIN_REGEX, RULE_TARGET_SINGBOX},
+    {"IP-CIDR", RULE_TYPE_IP_CIDR, RULE_TARGET_ALL},
+    {"IP-CIDR6", RULE_TYPE_IP_CIDR6, RULE_TARGET_CLASH | RULE_TARGET_SURGE_LIKE},
+    {"SRC-IP-CIDR", RULE_TYPE_SRC_IP_CIDR, RULE_TARGET_ALL},
+    {"SRC-IP", RULE_TYPE_SRC_IP, RULE_TARGET_SURGE_LIKE},
+    {"GEOIP", RULE_TYPE_GEOIP, RULE_TARGET_ALL},
+    {"SRC-GEOIP", RULE_TYPE_SRC_GEOIP, RULE_TARGET_SINGBOX},
+    {"GEOSITE", RULE_TYPE_GEOSITE, RULE_TARGET_SINGBOX},
+    {"MATCH", RULE_TYPE_MATCH, RULE_TARGET_ALL},
+    {"FINAL", RULE_TYPE_FINAL, RULE_TARGET_ALL},
+    {"SRC-PORT", RULE_TYPE_SRC_PORT, RULE_TARGET_CLASH | RULE_TARGET_SINGBOX},
+    {"SRC-PORT-RANGE", RULE_TYPE_SRC_PORT_RANGE, RULE_TARGET_SINGBOX},
+    {"DST-PORT", RULE_TYPE_DST_PORT, RULE_TARGET_CLASH},
+    {"DEST-PORT", RULE_TYPE_DEST_PORT, RULE_TARGET_SURGE_LIKE},
+    {"IN-PORT", RULE_TYPE_IN_PORT, RULE_TARGET_SURGE_LIKE},
+    {"PORT", RULE_TYPE_PORT, RULE_TARGET_SINGBOX},
+    {"PORT-RANGE", RULE_TYPE_PORT_RANGE, RULE_TARGET_SINGBOX},
+    {"PROCESS-NAME", RULE_TYPE_PROCESS_NAME, RULE_TARGET_CLASH | RULE_TARGET_SURGE_LIKE | RULE_TARGET_SINGBOX},
+    {"PROCESS-PATH", RULE_TYPE_PROCESS_PATH, RULE_TARGET_SINGBOX},
+    {"PACKAGE-NAME", RULE_TYPE_PACKAGE_NAME, RULE_TARGET_SINGBOX},
+    {"USER-AGENT", RULE_TYPE_USER_AGENT, RULE_TARGET_SURGE | RULE_TARGET_SURGE2 | RULE_TARGET_QUANX},
+    {"URL-REGEX", RULE_TYPE_URL_REGEX, RULE_TARGET_SURGE | RULE_TARGET_SURGE2},
+    {"HOST", RULE_TYPE_HOST, RULE_TARGET_QUANX},
+    {"HOST-SUFFIX", RULE_TYPE_HOST_SUFFIX, RULE_TARGET_QUANX},
+    {"HOST-KEYWORD", RULE_TYPE_HOST_KEYWORD, RULE_TARGET_QUANX},
+    {"IP-VERSION", RULE_TYPE_IP_VERSION, RULE_TARGET_SINGBOX},
+    {"INBOUND", RULE_TYPE_INBOUND, RULE_TARGET_SINGBOX},
+    {"PROTOCOL", RULE_TYPE_PROTOCOL, RULE_TARGET_SINGBOX},
+    {"NETWORK", RULE_TYPE_NETWORK, RULE_TARGET_SINGBOX},
+    {"USER", RULE_TYPE_USER, RULE_TARGET_SINGBOX},
+    {"USER-ID", RULE_TYPE_USER_ID, RULE_TARGET_SINGBOX},
+    {"AND", RULE_TYPE_AND, RULE_TARGET_SURGE},
+    {"OR", RULE_TYPE_OR, RULE_TARGET_SURGE},
+    {"NOT", RULE_TYPE_NOT, RULE_TARGET_SURGE}
+};
+
+/// rule type names only use A-Z, 0-9 and '-'
+constexpr int rule_type_charset = 37;
+
+static constexpr int ruleTypeCharIndex(char c)
+{
+    if(c >= 'A' && c <= 'Z')
+        return c - 'A';
+    if(c >= '0' && c <= '9')
+        return c - '0' + 26;
+    if(c == '-')
+        return 36;
+    return -1;
+}
+
+static constexpr size_t ruleTypeTrieSize()
+{
+    size_t size = 1;
+    for(const RuleTypeInfo &info : rule_type_list)
+        size += std::char_traits<char>::length(info.name);
+    return size;
+}
+
+/// a trie of rule_type_list built at compile time, node 0 is the root and a zero child means no such child
+struct RuleTypeTrie
+{
+    struct Node
+    {
+        uint16_t next[rule_type_charset] {};
+        rule_type type = RULE_TYPE_UNKNOWN;
+        int targets = 0;
+    };
+    Node nodes[ruleTypeTrieSize()] {};
+};
+
+static constexpr RuleTypeTrie rule_type_trie = []()
+{
+    RuleTypeTrie trie {};
+    uint16_t count = 1;
+    for(const RuleTypeInfo &info : rule_type_list)
+    {
+        uint16_t node = 0;
+        for(const char *p = info.name; *p; p++)
+        {
+            uint16_t &next = trie.nodes[node].next[ruleTypeCharIndex(*p)];
+            if(!next)
+                next = count++;
+            node = next;
+        }
+        trie.nodes[node].type = info.type;
+        trie.nodes[node].targets = info.targets;
+    }
+    return trie;
+}();
+
+RuleTypeMatch classifyRule(std::string_view line)
+{
+    RuleTypeMatch result;
+    uint16_t node = 0;
+    for(size_t i = 0; i < line.size(); i++)
+    {
+        int index = ruleTypeCharIndex(line[i]);
+        if(index < 0 || !(node = rule_type_trie.nodes[node].next[index]))
+            break;
+        const RuleTypeTrie::Node &current = rule_type_trie.nodes[node];
+        result.targets |= current.targets;
+        if(i + 1 == line.size() || line[i + 1] == ',')
+        {
+            result.type = current.type;
+            result.type_targets = current.targets;
+        }
+    }
+    return result;
+}
 
 std::string convertRuleset(const std::string &content, int type)
 {
@@ -30,20 +152,18 @@ std::string convertRuleset(const std::string &content, int type)
 
     if(regFind(content, "^payload:\\r?\\n")) /// Clash
     {
-        output = regReplace(regReplace(content, "payload:\\r?\\n", "", true), R"(\s?^\s*-\s+('|"?)(.*)\1$)", "\n$2", true);
+        std::string payload = regReplace(regReplace(content, "payload:\\r?\\n", "", true), R"(\s?^\s*-\s+('|"?)(.*)\1$)", "\n$2", true);
         if(type == RULESET_CLASH_CLASSICAL) /// classical type
-            return output;
-        std::stringstream ss;
-        ss << output;
-        char delimiter = getLineBreak(output);
-        output.clear();
+            return payload;
+        LineReader reader(payload);
+        std::string_view line;
         string_size pos, lineSize;
-        while(getline(ss, strLine, delimiter))
+        output.reserve(payload.size() * 2);
+        while(reader.next(line))
         {
-            strLine = trim(strLine);
+            strLine.assign(line);
+            trimSelfOf(strLine, ' ');
             lineSize = strLine.size();
-            if(lineSize && strLine[lineSize - 1] == '\r') //remove line break
-                strLine.erase(--lineSize);
 
             if(strFind(strLine, "//"))
             {
@@ -95,6 +215,70 @@ std::string convertRuleset(const std::string &content, int type)
     }
 }
 
+std::shared_ptr<const ParsedRuleset> parseRuleset(const std::string &content, int type)
+{
+    auto result = std::make_shared<ParsedRuleset>();
+    result->text = convertRuleset(content, type);
+    LineReader reader(result->text);
+    string_view_array fields;
+    std::string_view line;
+    while(reader.next(line))
+    {
+        line = trimWhitespaceView(line, true, true);
+        if(line.empty() || line[0] == ';' || line[0] == '#' || line.starts_with("//")) //empty lines and comments are ignored
+            continue;
+        string_size comment = line.find("//");
+        if(comment != std::string_view::npos)
+            line = trimWhitespaceView(line.substr(0, comment), false, true);
+
+        ParsedRule rule;
+        rule.line = line;
+        fields.clear();
+        split(fields, line, ',');
+        rule.field_count = fields.size();
+        rule.type = fields[0];
+        if(fields.size() > 1)
+            rule.pattern = fields[1];
+        if(fields.size() > 2)
+            rule.option = fields[2];
+        RuleTypeMatch match = classifyRule(line);
+        rule.kind = match.type;
+        rule.targets = match.targets & ~RULE_TARGET_SINGBOX;
+        if(fields.size() > 1 && (match.type_targets & RULE_TARGET_SINGBOX)) /// sing-box takes exact types only
+            rule.targets |= RULE_TARGET_SINGBOX;
+        result->rules.push_back(rule);
+    }
+    return result;
+}
+
+const ParsedRuleset &getParsedRuleset(const RulesetContent &ruleset)
+{
+    RulesetParseState &state = *ruleset.parse_state;
+    std::call_once(state.once, [&]()
+    {
+        state.parsed = parseRuleset(ruleset.rule_content.get(), ruleset.rule_type);
+    });
+    return *state.parsed;
+}
+
+/// type,pattern,group[,option] built from a parsed rule the same way transformRuleToCommon() does
+static void appendCommonRule(std::string &dest, std::string_view type, const ParsedRule &rule, const std::string &group, bool no_resolve_only = false)
+{
+    dest += type;
+    if(rule.field_count > 1)
+    {
+        dest += ',';
+        dest += rule.pattern;
+    }
+    dest += ',';
+    dest += group;
+    if(rule.field_count > 2 && (!no_resolve_only || rule.option == "no-resolve"))
+    {
+        dest += ',';
+        dest += rule.option;
+    }
+}
+
 static std::string transformRuleToCommon(string_view_array &temp, const std::string &input, const std::string &group, bool no_resolve_only = false)
 {
     temp.clear();
@@ -122,11 +306,117 @@ static std::string transformRuleToCommon(string_view_array &temp, const std::str
     return strLine;
 }
 
+/// the rules of one ruleset rendered for one group and output format
+struct RuleFragment
+{
+    std::string text; /// Clash rules section lines
+    string_array lines; /// Surge style rule items
+    size_t count = 0;
+};
+
+using RuleFragmentPtr = std::shared_ptr<const RuleFragment>;
+
+/// rendered rulesets keyed by content hash, group and format, bounded by global->ruleCacheSize bytes
+struct RuleCacheEntry
+{
+    std::string key;
+    RuleFragmentPtr fragment;
+};
+
+struct RuleCache
+{
+    std::mutex lock;
+    std::list<RuleCacheEntry> lru;
+    std::unordered_map<std::string_view, std::list<RuleCacheEntry>::iterator> index;
+    size_t size = 0;
+};
+
+static RuleCache rule_cache;
+
+static size_t ruleCacheEntrySize(const RuleCacheEntry &entry)
+{
+    size_t size = entry.key.size() + entry.fragment->text.size();
+    for(const std::string &x : entry.fragment->lines)
+        size += x.size() + sizeof(std::string);
+    return size;
+}
+
+static void ruleCacheEvict(size_t budget)
+{
+    while(rule_cache.size > budget && !rule_cache.lru.empty())
+    {
+        auto &entry = rule_cache.lru.back();
+        rule_cache.size -= ruleCacheEntrySize(entry);
+        rule_cache.index.erase(entry.key);
+        rule_cache.lru.pop_back();
+    }
+}
+
+void flushRuleCache()
+{
+    std::lock_guard<std::mutex> guard(rule_cache.lock);
+    rule_cache.index.clear();
+    rule_cache.lru.clear();
+    rule_cache.size = 0;
+}
+
+static size_t rulesetContentHash(const RulesetContent &ruleset)
+{
+    RulesetParseState &state = *ruleset.parse_state;
+    std::call_once(state.hash_once, [&]()
+    {
+        state.content_hash = std::hash<std::string>()(ruleset.rule_content.get());
+    });
+    return state.content_hash;
+}
+
+/// identifies the content of a ruleset without holding on to it
+static std::string rulesetCacheKey(const RulesetContent &ruleset)
+{
+    return std::to_string(rulesetContentHash(ruleset)) + "," + std::to_string(ruleset.rule_content.get().size()) + "," + std::to_string(ruleset.rule_type);
+}
+
+/// rendered rules from the cache, or rendered by render() and cached when missing, the key is only made when caching
+static RuleFragmentPtr getRuleFragment(const std::function<std::string()> &make_key, const std::function<void(RuleFragment&)> &render)
+{
+    size_t budget = global->ruleCacheSize;
+    std::string key;
+    if(budget)
+    {
+        key = make_key();
+        std::lock_guard<std::mutex> guard(rule_cache.lock);
+        auto iter = rule_cache.index.find(key);
+        if(iter != rule_cache.index.end())
+        {
+            rule_cache.lru.splice(rule_cache.lru.begin(), rule_cache.lru, iter->second);
+            metricAdd(METRIC_RULE_CACHE_HIT);
+            return iter->second->fragment;
+        }
+    }
+    metricAdd(METRIC_RULE_CACHE_MISS);
+
+    auto fragment = std::make_shared<RuleFragment>();
+    render(*fragment);
+    if(!budget)
+        return fragment;
+    RuleCacheEntry entry {std::move(key), fragment};
+    size_t entry_size = ruleCacheEntrySize(entry);
+    if(entry_size > budget)
+        return fragment;
+    std::lock_guard<std::mutex> guard(rule_cache.lock);
+    if(rule_cache.index.find(entry.key) != rule_cache.index.end()) /// rendered by another request in the meantime
+        return fragment;
+    ruleCacheEvict(budget - entry_size);
+    rule_cache.lru.emplace_front(std::move(entry));
+    rule_cache.index.emplace(rule_cache.lru.front().key, rule_cache.lru.begin());
+    rule_cache.size += entry_size;
+    return fragment;
+}
+
 void rulesetToClash(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules, bool new_field_name)
 {
     string_array allRules;
-    std::string rule_group, retrieved_rules, strLine;
-    std::stringstream strStrm;
+    std::string rule_group, strLine;
     const std::string field_name = new_field_name ? "rules" : "Rule";
     YAML::Node rules;
     size_t total_rules = 0;
@@ -137,10 +427,10 @@ void rulesetToClash(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_
     std::vector<std::string_view> temp(4);
     for(RulesetContent &x : ruleset_content_array)
     {
-        if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+        if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
             break;
         rule_group = x.rule_group;
-        retrieved_rules = x.rule_content.get();
+        const std::string &retrieved_rules = x.rule_content.get();
         if(retrieved_rules.empty())
         {
             writeLog(0, "Failed to fetch ruleset or ruleset is empty: '" + x.rule_path + "'!", LOG_LEVEL_WARNING);
@@ -156,28 +446,14 @@ void rulesetToClash(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_
             total_rules++;
             continue;
         }
-        retrieved_rules = convertRuleset(retrieved_rules, x.rule_type);
-        char delimiter = getLineBreak(retrieved_rules);
-
-        strStrm.clear();
-        strStrm<<retrieved_rules;
-        std::string::size_type lineSize;
-        while(getline(strStrm, strLine, delimiter))
+        for(const ParsedRule &rule : getParsedRuleset(x).rules)
         {
-            if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+            if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
                 break;
-            strLine = trimWhitespace(strLine, true, true); //remove whitespaces
-            lineSize = strLine.size();
-            if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
+            if(!(rule.targets & RULE_TARGET_CLASH))
                 continue;
-            if(std::none_of(ClashRuleTypes.begin(), ClashRuleTypes.end(), [strLine](const std::string& type){return startsWith(strLine, type);}))
-                continue;
-            if(strFind(strLine, "//"))
-            {
-                strLine.erase(strLine.find("//"));
-                strLine = trimWhitespace(strLine);
-            }
-            strLine = transformRuleToCommon(temp, strLine, rule_group);
+            strLine.clear();
+            appendCommonRule(strLine, rule.type, rule, rule_group);
             allRules.emplace_back(strLine);
         }
     }
@@ -192,11 +468,20 @@ void rulesetToClash(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_
 
 std::string rulesetToClashStr(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules, bool new_field_name)
 {
-    std::string rule_group, retrieved_rules, strLine;
-    std::stringstream strStrm;
+    std::string output_content = rulesetToClashHeader(base_rule, overwrite_original_rules, new_field_name);
+    rulesetToClashStream(ruleset_content_array, [&output_content](const std::string &chunk)
+    {
+        output_content += chunk;
+        return true;
+    });
+    return output_content;
+}
+
+/// moves the rules already in base_rule into the text opening the rules section
+std::string rulesetToClashHeader(YAML::Node &base_rule, bool overwrite_original_rules, bool new_field_name)
+{
     const std::string field_name = new_field_name ? "rules" : "Rule";
     std::string output_content = "\n" + field_name + ":\n";
-    size_t total_rules = 0;
 
     if(!overwrite_original_rules && base_rule[field_name].IsDefined())
     {
@@ -204,14 +489,24 @@ std::string rulesetToClashStr(YAML::Node &base_rule, std::vector<RulesetContent>
             output_content += "  - " + safe_as<std::string>(base_rule[field_name][i]) + "\n";
     }
     base_rule.remove(field_name);
+    return output_content;
+}
 
+bool rulesetToClashStream(std::vector<RulesetContent> &ruleset_content_array, const RuleWriter &writer)
+{
+    StageTimer timer(METRIC_STAGE_RULESET);
+    std::string rule_group, strLine;
+    std::string output_content;
+    size_t total_rules = 0;
+
+    output_content.reserve(rule_chunk_size + 1024);
     string_view_array temp(4);
     for(RulesetContent &x : ruleset_content_array)
     {
-        if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+        if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
             break;
         rule_group = x.rule_group;
-        retrieved_rules = x.rule_content.get();
+        const std::string &retrieved_rules = x.rule_content.get();
         if(retrieved_rules.empty())
         {
             writeLog(0, "Failed to fetch ruleset or ruleset is empty: '" + x.rule_path + "'!", LOG_LEVEL_WARNING);
@@ -227,40 +522,50 @@ std::string rulesetToClashStr(YAML::Node &base_rule, std::vector<RulesetContent>
             total_rules++;
             continue;
         }
-        retrieved_rules = convertRuleset(retrieved_rules, x.rule_type);
-        char delimiter = getLineBreak(retrieved_rules);
-
-        strStrm.clear();
-        strStrm<<retrieved_rules;
-        std::string::size_type lineSize;
-        while(getline(strStrm, strLine, delimiter))
+        RuleFragmentPtr fragment = getRuleFragment([&x](){ return rulesetCacheKey(x) + ",clash," + x.rule_group; }, [&x](RuleFragment &result)
         {
-            if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
-                break;
-            strLine = trimWhitespace(strLine, true, true); //remove whitespaces
-            lineSize = strLine.size();
-            if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
-                continue;
-            if(std::none_of(ClashRuleTypes.begin(), ClashRuleTypes.end(), [strLine](const std::string& type){ return startsWith(strLine, type); }))
-                continue;
-            if(strFind(strLine, "//"))
+            for(const ParsedRule &rule : getParsedRuleset(x).rules)
             {
-                strLine.erase(strLine.find("//"));
-                strLine = trimWhitespace(strLine);
+                if(!(rule.targets & RULE_TARGET_CLASH))
+                    continue;
+                result.text += "  - ";
+                appendCommonRule(result.text, rule.type, rule, x.rule_group);
+                result.text += '\n';
+                result.count++;
+            }
+        });
+        /// rules are written while the count is within the limit, so at most one more than it
+        size_t text_size = fragment->text.size();
+        if(global->maxAllowedRules && total_rules + fragment->count > global->maxAllowedRules + 1)
+        {
+            size_t count = global->maxAllowedRules + 1 - total_rules;
+            text_size = 0;
+            for(size_t i = 0; i < count; i++)
+                text_size = fragment->text.find('\n', text_size) + 1;
+            total_rules += count;
+        }
+        else
+            total_rules += fragment->count;
+        for(size_t pos = 0; pos < text_size;)
+        {
+            size_t length = std::min(text_size - pos, rule_chunk_size);
+            output_content.append(fragment->text, pos, length);
+            pos += length;
+            if(output_content.size() >= rule_chunk_size)
+            {
+                if(!writer(output_content))
+                    return false;
+                output_content.clear();
             }
-            strLine = transformRuleToCommon(temp, strLine, rule_group);
-            output_content += "  - " + strLine + "\n";
-            total_rules++;
         }
     }
-    return output_content;
+    return output_content.empty() || writer(output_content);
 }
 
 void rulesetToSurge(INIReader &base_rule, std::vector<RulesetContent> &ruleset_content_array, int surge_ver, bool overwrite_original_rules, const std::string &remote_path_prefix)
 {
     string_array allRules;
-    std::string rule_group, rule_path, rule_path_typed, retrieved_rules, strLine;
-    std::stringstream strStrm;
+    std::string rule_group, rule_path, rule_path_typed, strLine;
     size_t total_rules = 0;
 
     switch(surge_ver) //other version: -3 for Surfboard, -4 for Loon
@@ -299,7 +604,7 @@ void rulesetToSurge(INIReader &base_rule, std::vector<RulesetContent> &ruleset_c
     string_view_array temp(4);
     for(RulesetContent &x : ruleset_content_array)
     {
-        if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+        if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
             break;
         rule_group = x.rule_group;
         rule_path = x.rule_path;
@@ -391,76 +696,57 @@ void rulesetToSurge(INIReader &base_rule, std::vector<RulesetContent> &ruleset_c
             }
             else
                 continue;
-            retrieved_rules = x.rule_content.get();
-            if(retrieved_rules.empty())
+            if(x.rule_content.get().empty())
             {
                 writeLog(0, "Failed to fetch ruleset or ruleset is empty: '" + x.rule_path + "'!", LOG_LEVEL_WARNING);
                 continue;
             }
 
-            retrieved_rules = convertRuleset(retrieved_rules, x.rule_type);
-            char delimiter = getLineBreak(retrieved_rules);
-
-            strStrm.clear();
-            strStrm<<retrieved_rules;
-            std::string::size_type lineSize;
-            while(getline(strStrm, strLine, delimiter))
+            /// remove unsupported types
+            int target;
+            switch(surge_ver)
             {
-                if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
-                    break;
-                strLine = trimWhitespace(strLine, true, true);
-                lineSize = strLine.size();
-                if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
-                    continue;
-
-                /// remove unsupported types
-                switch(surge_ver)
+            case -2: case -1:
+                target = RULE_TARGET_QUANX;
+                break;
+            case -3:
+                target = RULE_TARGET_SURFBOARD;
+                break;
+            default:
+                target = surge_ver > 2 ? RULE_TARGET_SURGE : RULE_TARGET_SURGE2;
+            }
+            RuleFragmentPtr fragment = getRuleFragment([&x, surge_ver](){ return rulesetCacheKey(x) + ",surge" + std::to_string(surge_ver) + "," + x.rule_group; }, [&x, target, surge_ver](RuleFragment &result)
+            {
+                std::string strLine;
+                for(const ParsedRule &rule : getParsedRuleset(x).rules)
                 {
-                case -2:
-                    if(startsWith(strLine, "IP-CIDR6"))
-                        continue;
-                    [[fallthrough]];
-                case -1:
-                    if(!std::any_of(QuanXRuleTypes.begin(), QuanXRuleTypes.end(), [strLine](const std::string& type){return startsWith(strLine, type);}))
-                        continue;
-                    break;
-                case -3:
-                    if(!std::any_of(SurfRuleTypes.begin(), SurfRuleTypes.end(), [strLine](const std::string& type){return startsWith(strLine, type);}))
+                    if(!(rule.targets & target) || (surge_ver == -2 && rule.line.starts_with("IP-CIDR6")))
                         continue;
-                    break;
-                default:
-                    if(surge_ver > 2)
+
+                    strLine.clear();
+                    if(surge_ver == -1 || surge_ver == -2)
                     {
-                        if(!std::any_of(SurgeRuleTypes.begin(), SurgeRuleTypes.end(), [strLine](const std::string& type){return startsWith(strLine, type);}))
-                            continue;
+                        if(rule.line.starts_with("IP-CIDR6"))
+                            appendCommonRule(strLine, "IP6-CIDR" + std::string(rule.type.substr(8)), rule, x.rule_group, true);
+                        else
+                            appendCommonRule(strLine, rule.type, rule, x.rule_group, true);
                     }
                     else
                     {
-                        if(!std::any_of(Surge2RuleTypes.begin(), Surge2RuleTypes.end(), [strLine](const std::string& type){return startsWith(strLine, type);}))
-                            continue;
+                        if(!rule.line.starts_with("AND") && !rule.line.starts_with("OR") && !rule.line.starts_with("NOT"))
+                            appendCommonRule(strLine, rule.type, rule, x.rule_group);
+                        else
+                            strLine = rule.line;
                     }
+                    result.lines.emplace_back(strLine);
                 }
-
-                if(strFind(strLine, "//"))
-                {
-                    strLine.erase(strLine.find("//"));
-                    strLine = trimWhitespace(strLine);
-                }
-
-                if(surge_ver == -1 || surge_ver == -2)
-                {
-                    if(startsWith(strLine, "IP-CIDR6"))
-                        strLine.replace(0, 8, "IP6-CIDR");
-                    strLine = transformRuleToCommon(temp, strLine, rule_group, true);
-                }
-                else
-                {
-                    if(!startsWith(strLine, "AND") && !startsWith(strLine, "OR") && !startsWith(strLine, "NOT"))
-                        strLine = transformRuleToCommon(temp, strLine, rule_group);
-                }
-                allRules.emplace_back(strLine);
-                total_rules++;
-            }
+                result.count = result.lines.size();
+            });
+            size_t count = fragment->count;
+            if(global->maxAllowedRules && total_rules + count > global->maxAllowedRules + 1)
+                count = global->maxAllowedRules + 1 - total_rules;
+            allRules.insert(allRules.end(), fragment->lines.begin(), fragment->lines.begin() + count);
+            total_rules += count;
         }
     }
 
@@ -470,6 +756,54 @@ void rulesetToSurge(INIReader &base_rule, std::vector<RulesetContent> &ruleset_c
     }
 }
 
+bool rulesetToBinary(std::vector<RulesetContent> &ruleset_content_array, int format, std::string &output)
+{
+    StageTimer timer(METRIC_STAGE_RULESET);
+    RuleFragmentPtr fragment = getRuleFragment([&]()
+    {
+        std::string key = "binary" + std::to_string(format);
+        for(const RulesetContent &x : ruleset_content_array)
+            key += "|" + rulesetCacheKey(x);
+        return key;
+    }, [&](RuleFragment &result)
+    {
+        BinaryRuleItems items;
+        for(const RulesetContent &x : ruleset_content_array)
+        {
+            if(x.rule_content.get().empty())
+                continue;
+            for(const ParsedRule &rule : getParsedRuleset(x).rules)
+            {
+                if(rule.pattern.empty())
+                    continue;
+                switch(rule.kind)
+                {
+                case RULE_TYPE_DOMAIN:
+                    items.domain.emplace_back(rule.pattern);
+                    break;
+                case RULE_TYPE_DOMAIN_SUFFIX:
+                    items.domain_suffix.emplace_back(rule.pattern.substr(rule.pattern[0] == '.'));
+                    break;
+                case RULE_TYPE_DOMAIN_KEYWORD:
+                    items.domain_keyword.emplace_back(rule.pattern);
+                    break;
+                case RULE_TYPE_IP_CIDR: case RULE_TYPE_IP_CIDR6:
+                    items.ip_cidr.emplace_back(rule.pattern);
+                    break;
+                default:
+                    break;
+                }
+            }
+        }
+        if(buildBinaryRuleset(items, format, result.text))
+            result.count = 1;
+    });
+    if(!fragment->count)
+        return false;
+    output = fragment->text;
+    return true;
+}
+
 static rapidjson::Value transformRuleToSingBox(std::vector<std::string_view> &args, const std::string& rule, const std::string &group, rapidjson::MemoryPoolAllocator<>& allocator)
 {
     args.clear();
@@ -496,21 +830,14 @@ static rapidjson::Value transformRuleToSingBox(std::vector<std::string_view> &ar
     return rule_obj;
 }
 
-static void appendSingBoxRule(std::vector<std::string_view> &args, rapidjson::Value &rules, const std::string& rule, rapidjson::MemoryPoolAllocator<>& allocator)
+static void appendSingBoxRule(rapidjson::Value &rules, const ParsedRule &rule, rapidjson::MemoryPoolAllocator<>& allocator)
 {
     using namespace rapidjson_ext;
-    args.clear();
-    split(args, rule, ',');
-    if (args.size() < 2) return;
-    auto type = args[0];
-//    std::string_view option;
-//    if (args.size() >= 3) option = args[2];
-
-    if (none_of(SingBoxRuleTypes, [&](const std::string& t){ return type == t; }))
+    if (!(rule.targets & RULE_TARGET_SINGBOX))
         return;
 
-    auto realType = toLower(std::string(type));
-    auto value = toLower(std::string(args[1]));
+    auto realType = toLower(std::string(rule.type));
+    auto value = toLower(std::string(rule.pattern));
     realType = replaceAllDistinct(realType, "-", "_");
     realType = replaceAllDistinct(realType, "ip_cidr6", "ip_cidr");
 
@@ -520,8 +847,7 @@ static void appendSingBoxRule(std::vector<std::string_view> &args, rapidjson::Va
 void rulesetToSingBox(rapidjson::Document &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules)
 {
     using namespace rapidjson_ext;
-    std::string rule_group, retrieved_rules, strLine, final;
-    std::stringstream strStrm;
+    std::string rule_group, strLine, final;
     size_t total_rules = 0;
     auto &allocator = base_rule.GetAllocator();
 
@@ -535,7 +861,7 @@ void rulesetToSingBox(rapidjson::Document &base_rule, std::vector<RulesetContent
     auto dns_object = buildObject(allocator, "protocol", "dns", "outbound", "dns-out");
     rules.PushBack(dns_object, allocator);
 
-    if (global.singBoxAddClashModes)
+    if (global->singBoxAddClashModes)
     {
         auto global_object = buildObject(allocator, "clash_mode", "Global", "outbound", "GLOBAL");
         auto direct_object = buildObject(allocator, "clash_mode", "Direct", "outbound", "DIRECT");
@@ -546,10 +872,10 @@ void rulesetToSingBox(rapidjson::Document &base_rule, std::vector<RulesetContent
     std::vector<std::string_view> temp(4);
     for(RulesetContent &x : ruleset_content_array)
     {
-        if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+        if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
             break;
         rule_group = x.rule_group;
-        retrieved_rules = x.rule_content.get();
+        const std::string &retrieved_rules = x.rule_content.get();
         if(retrieved_rules.empty())
         {
             writeLog(0, "Failed to fetch ruleset or ruleset is empty: '" + x.rule_path + "'!", LOG_LEVEL_WARNING);
@@ -567,29 +893,13 @@ void rulesetToSingBox(rapidjson::Document &base_rule, std::vector<RulesetContent
             total_rules++;
             continue;
         }
-        retrieved_rules = convertRuleset(retrieved_rules, x.rule_type);
-        char delimiter = getLineBreak(retrieved_rules);
-
-        strStrm.clear();
-        strStrm<<retrieved_rules;
-
-        std::string::size_type lineSize;
         rapidjson::Value rule(rapidjson::kObjectType);
 
-        while(getline(strStrm, strLine, delimiter))
+        for(const ParsedRule &parsed : getParsedRuleset(x).rules)
         {
-            if(global.maxAllowedRules && total_rules > global.maxAllowedRules)
+            if(global->maxAllowedRules && total_rules > global->maxAllowedRules)
                 break;
-            strLine = trimWhitespace(strLine, true, true); //remove whitespaces
-            lineSize = strLine.size();
-            if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
-                continue;
-            if(strFind(strLine, "//"))
-            {
-                strLine.erase(strLine.find("//"));
-                strLine = trimWhitespace(strLine);
-            }
-            appendSingBoxRule(temp, rule, strLine, allocator);
+            appendSingBoxRule(rule, parsed, allocator);
         }
         if (rule.ObjectEmpty()) continue;
         rule.AddMember("outbound", rapidjson::Value(rule_group.c_str(), allocator), allocator);
@@ -2,8 +2,12 @@
 #define RULECONVERT_H_INCLUDED
 
 #include <string>
+#include <string_view>
 #include <vector>
 #include <future>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 #include <yaml-cpp/yaml.h>
 #include <rapidjson/document.h>
@@ -19,6 +23,91 @@ enum ruleset_type
     RULESET_CLASH_CLASSICAL
 };
 
+/// generators a rule can be written to, by the rule types each of them supports
+enum rule_target
+{
+    RULE_TARGET_CLASH = 1 << 0,
+    RULE_TARGET_SURGE = 1 << 1,
+    RULE_TARGET_SURGE2 = 1 << 2,
+    RULE_TARGET_QUANX = 1 << 3,
+    RULE_TARGET_SURFBOARD = 1 << 4,
+    RULE_TARGET_SINGBOX = 1 << 5
+};
+
+/// every rule type a generator knows of
+enum rule_type
+{
+    RULE_TYPE_UNKNOWN,
+    RULE_TYPE_DOMAIN,
+    RULE_TYPE_DOMAIN_SUFFIX,
+    RULE_TYPE_DOMAIN_KEYWORD,
+    RULE_TYPE_DOMAIN_REGEX,
+    RULE_TYPE_IP_CIDR,
+    RULE_TYPE_IP_CIDR6,
+    RULE_TYPE_SRC_IP_CIDR,
+    RULE_TYPE_SRC_IP,
+    RULE_TYPE_GEOIP,
+    RULE_TYPE_SRC_GEOIP,
+    RULE_TYPE_GEOSITE,
+    RULE_TYPE_MATCH,
+    RULE_TYPE_FINAL,
+    RULE_TYPE_SRC_PORT,
+    RULE_TYPE_SRC_PORT_RANGE,
+    RULE_TYPE_DST_PORT,
+    RULE_TYPE_DEST_PORT,
+    RULE_TYPE_IN_PORT,
+    RULE_TYPE_PORT,
+    RULE_TYPE_PORT_RANGE,
+    RULE_TYPE_PROCESS_NAME,
+    RULE_TYPE_PROCESS_PATH,
+    RULE_TYPE_PACKAGE_NAME,
+    RULE_TYPE_USER_AGENT,
+    RULE_TYPE_URL_REGEX,
+    RULE_TYPE_HOST,
+    RULE_TYPE_HOST_SUFFIX,
+    RULE_TYPE_HOST_KEYWORD,
+    RULE_TYPE_IP_VERSION,
+    RULE_TYPE_INBOUND,
+    RULE_TYPE_PROTOCOL,
+    RULE_TYPE_NETWORK,
+    RULE_TYPE_USER,
+    RULE_TYPE_USER_ID,
+    RULE_TYPE_AND,
+    RULE_TYPE_OR,
+    RULE_TYPE_NOT
+};
+
+struct RuleTypeMatch
+{
+    rule_type type = RULE_TYPE_UNKNOWN; /// the leading token of the rule, unknown when it is not exactly a known type
+    int type_targets = 0; /// rule_target bits of type
+    int targets = 0; /// rule_target bits of every known type the rule starts with
+};
+
+/// one rule of a parsed ruleset, the views point into the text of the ParsedRuleset holding it
+struct ParsedRule
+{
+    std::string_view line; /// whole rule with comments and surrounding whitespace removed
+    std::string_view type, pattern, option; /// first three comma separated fields, empty when missing
+    size_t field_count = 0;
+    rule_type kind = RULE_TYPE_UNKNOWN;
+    int targets = 0; /// rule_target bits
+};
+
+/// a ruleset converted to Surge format and split into rules, built once and then only read
+struct ParsedRuleset
+{
+    std::string text;
+    std::vector<ParsedRule> rules;
+};
+
+struct RulesetParseState
+{
+    std::once_flag once, hash_once;
+    std::shared_ptr<const ParsedRuleset> parsed;
+    size_t content_hash = 0;
+};
+
 struct RulesetContent
 {
     std::string rule_group;
@@ -27,11 +116,28 @@ struct RulesetContent
     int rule_type = RULESET_SURGE;
     std::shared_future<std::string> rule_content;
     int update_interval = 0;
+    /// rule_content parsed on first use, shared by every copy of this entry
+    std::shared_ptr<RulesetParseState> parse_state = std::make_shared<RulesetParseState>();
 };
 
+/// receives generated rules a chunk at a time, returns false to stop the generation
+using RuleWriter = std::function<bool(const std::string &chunk)>;
+/// rule generation deferred until the output before the rules has been sent
+using RuleProvider = std::function<bool(const RuleWriter &writer)>;
+/// generated rules are handed to a RuleWriter in chunks of about this size
+constexpr size_t rule_chunk_size = 65536;
+
+RuleTypeMatch classifyRule(std::string_view line);
 std::string convertRuleset(const std::string &content, int type);
+std::shared_ptr<const ParsedRuleset> parseRuleset(const std::string &content, int type);
+const ParsedRuleset &getParsedRuleset(const RulesetContent &ruleset);
+void flushRuleCache();
 void rulesetToClash(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules, bool new_field_name);
 std::string rulesetToClashStr(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules, bool new_field_name);
+std::string rulesetToClashHeader(YAML::Node &base_rule, bool overwrite_original_rules, bool new_field_name);
+bool rulesetToClashStream(std::vector<RulesetContent> &ruleset_content_array, const RuleWriter &writer);
+/// compiles the destination rules into a binary rule-set, format is a ruleset_binary value
+bool rulesetToBinary(std::vector<RulesetContent> &ruleset_content_array, int format, std::string &output);
 void rulesetToSurge(INIReader &base_rule, std::vector<RulesetContent> &ruleset_content_array, int surge_ver, bool overwrite_original_rules, const std::string& remote_path_prefix);
 void rulesetToSingBox(rapidjson::Document &base_rule, std::vector<RulesetContent> &ruleset_content_array, bool overwrite_original_rules);
 
@@ -61,60 +61,94 @@ std::string vmessLinkConstruct(const std::string &remarks, const std::string &ad
     return sb.GetString();
 }
 
-bool matchRange(const std::string &range, int target)
+std::vector<MatchRange> parseRange(const std::string &range)
 {
+    std::vector<MatchRange> result;
     string_array vArray = split(range, ",");
-    bool match = false;
     std::string range_begin_str, range_end_str;
-    int range_begin, range_end;
     static const std::string reg_num = "-?\\d+", reg_range = "(\\d+)-(\\d+)", reg_not = "\\!-?(\\d+)", reg_not_range = "\\!(\\d+)-(\\d+)", reg_less = "(\\d+)-", reg_more = "(\\d+)\\+";
     for(std::string &x : vArray)
     {
+        MatchRange item;
         if(regMatch(x, reg_num))
         {
-            if(to_int(x, INT_MAX) == target)
-                match = true;
+            item.Type = MatchRangeType::Equal;
+            item.Begin = to_int(x, INT_MAX);
         }
         else if(regMatch(x, reg_range))
         {
             regGetMatch(x, reg_range, 3, 0, &range_begin_str, &range_end_str);
-            range_begin = to_int(range_begin_str, INT_MAX);
-            range_end = to_int(range_end_str, INT_MIN);
-            if(target >= range_begin && target <= range_end)
-                match = true;
+            item.Type = MatchRangeType::Within;
+            item.Begin = to_int(range_begin_str, INT_MAX);
+            item.End = to_int(range_end_str, INT_MIN);
         }
         else if(regMatch(x, reg_not))
         {
-            match = true;
-            if(to_int(regReplace(x, reg_not, "$1"), INT_MAX) == target)
-                match = false;
+            item.Type = MatchRangeType::NotEqual;
+            item.Begin = to_int(regReplace(x, reg_not, "$1"), INT_MAX);
         }
         else if(regMatch(x, reg_not_range))
         {
-            match = true;
             regGetMatch(x, reg_range, 3, 0, &range_begin_str, &range_end_str);
-            range_begin = to_int(range_begin_str, INT_MAX);
-            range_end = to_int(range_end_str, INT_MIN);
-            if(target >= range_begin && target <= range_end)
-                match = false;
+            item.Type = MatchRangeType::NotWithin;
+            item.Begin = to_int(range_begin_str, INT_MAX);
+            item.End = to_int(range_end_str, INT_MIN);
         }
         else if(regMatch(x, reg_less))
         {
-            if(to_int(regReplace(x, reg_less, "$1"), INT_MAX) >= target)
-                match = true;
+            item.Type = MatchRangeType::UpTo;
+            item.Begin = to_int(regReplace(x, reg_less, "$1"), INT_MAX);
         }
         else if(regMatch(x, reg_more))
         {
-            if(to_int(regReplace(x, reg_more, "$1"), INT_MIN) <= target)
+            item.Type = MatchRangeType::From;
+            item.Begin = to_int(regReplace(x, reg_more, "$1"), INT_MIN);
+        }
+        else
+            continue;
+        result.emplace_back(item);
+    }
+    return result;
+}
+
+bool matchRange(const std::vector<MatchRange> &range, int target)
+{
+    bool match = false;
+    for(const MatchRange &x : range)
+    {
+        switch(x.Type)
+        {
+        case MatchRangeType::Equal:
+            if(x.Begin == target)
+                match = true;
+            break;
+        case MatchRangeType::Within:
+            if(target >= x.Begin && target <= x.End)
+                match = true;
+            break;
+        case MatchRangeType::NotEqual:
+            match = x.Begin != target;
+            break;
+        case MatchRangeType::NotWithin:
+            match = !(target >= x.Begin && target <= x.End);
+            break;
+        case MatchRangeType::UpTo:
+            if(x.Begin >= target)
                 match = true;
+            break;
+        case MatchRangeType::From:
+            if(x.Begin <= target)
+                match = true;
+            break;
         }
     }
     return match;
 }
 
-bool applyMatcher(const std::string &rule, std::string &real_rule, const Proxy &node)
+NodeMatcher compileMatcher(const std::string &rule)
 {
-    std::string target, ret_real_rule;
+    NodeMatcher matcher;
+    std::string target;
     static const std::string groupid_regex = R"(^!!(?:GROUPID|INSERT)=([\d\-+!,]+)(?:!!(.*))?$)", group_regex = R"(^!!(?:GROUP)=(.+?)(?:!!(.*))?$)";
     static const std::string type_regex = R"(^!!(?:TYPE)=(.+?)(?:!!(.*))?$)", port_regex = R"(^!!(?:PORT)=(.+?)(?:!!(.*))?$)", server_regex = R"(^!!(?:SERVER)=(.+?)(?:!!(.*))?$)";
     static const std::map<ProxyType, const char *> types = {
@@ -132,40 +166,74 @@ bool applyMatcher(const std::string &rule, std::string &real_rule, const Proxy &
     };
     if(startsWith(rule, "!!GROUP="))
     {
-        regGetMatch(rule, group_regex, 3, 0, &target, &ret_real_rule);
-        real_rule = ret_real_rule;
-        return regFind(node.Group, target);
+        regGetMatch(rule, group_regex, 3, 0, &target, &matcher.Rule);
+        matcher.Type = MatcherType::Group;
+        matcher.Target = regCompile(target);
     }
     else if(startsWith(rule, "!!GROUPID=") || startsWith(rule, "!!INSERT="))
     {
-        int dir = startsWith(rule, "!!INSERT=") ? -1 : 1;
-        regGetMatch(rule, groupid_regex, 3, 0, &target, &ret_real_rule);
-        real_rule = ret_real_rule;
-        return matchRange(target, dir * node.GroupId);
+        regGetMatch(rule, groupid_regex, 3, 0, &target, &matcher.Rule);
+        matcher.Type = startsWith(rule, "!!INSERT=") ? MatcherType::Insert : MatcherType::GroupId;
+        matcher.Range = parseRange(target);
     }
     else if(startsWith(rule, "!!TYPE="))
     {
-        regGetMatch(rule, type_regex, 3, 0, &target, &ret_real_rule);
-        real_rule = ret_real_rule;
-        if(node.Type == ProxyType::Unknown)
-            return false;
-        return regMatch(types.at(node.Type), target);
+        regGetMatch(rule, type_regex, 3, 0, &target, &matcher.Rule);
+        matcher.Type = MatcherType::Type;
+        /// the type names are fixed, so resolve the pattern against all of them now
+        for(auto &x : types)
+        {
+            if(regMatch(x.second, target))
+                matcher.TypeMask |= 1u << static_cast<int>(x.first);
+        }
     }
     else if(startsWith(rule, "!!PORT="))
     {
-        regGetMatch(rule, port_regex, 3, 0, &target, &ret_real_rule);
-        real_rule = ret_real_rule;
-        return matchRange(target, node.Port);
+        regGetMatch(rule, port_regex, 3, 0, &target, &matcher.Rule);
+        matcher.Type = MatcherType::Port;
+        matcher.Range = parseRange(target);
     }
     else if(startsWith(rule, "!!SERVER="))
     {
-        regGetMatch(rule, server_regex, 3, 0, &target, &ret_real_rule);
-        real_rule = ret_real_rule;
-        return regFind(node.Hostname, target);
+        regGetMatch(rule, server_regex, 3, 0, &target, &matcher.Rule);
+        matcher.Type = MatcherType::Server;
+        matcher.Target = regCompile(target);
     }
     else
-        real_rule = rule;
-    return true;
+        matcher.Rule = rule;
+    if(!matcher.Rule.empty())
+        matcher.RuleRegex = regCompile(matcher.Rule);
+    return matcher;
+}
+
+NodeMatchers compileMatchers(const string_array &rules)
+{
+    NodeMatchers matchers;
+    matchers.reserve(rules.size());
+    for(const std::string &x : rules)
+        matchers.emplace_back(compileMatcher(x));
+    return matchers;
+}
+
+bool applyMatcher(const NodeMatcher &matcher, const Proxy &node)
+{
+    switch(matcher.Type)
+    {
+    case MatcherType::Group:
+        return regFind(node.Group, matcher.Target);
+    case MatcherType::GroupId:
+        return matchRange(matcher.Range, node.GroupId);
+    case MatcherType::Insert:
+        return matchRange(matcher.Range, -static_cast<int>(node.GroupId));
+    case MatcherType::Type:
+        return matcher.TypeMask & (1u << static_cast<int>(node.Type));
+    case MatcherType::Port:
+        return matchRange(matcher.Range, node.Port);
+    case MatcherType::Server:
+        return regFind(node.Hostname, matcher.Target);
+    default:
+        return true;
+    }
 }
 
 void processRemark(std::string &remark, const string_array &remarks_list, bool proc_comma = true)
@@ -195,7 +263,6 @@ void processRemark(std::string &remark, const string_array &remarks_list, bool p
 
 void groupGenerate(const std::string &rule, std::vector<Proxy> &nodelist, string_array &filtered_nodelist, bool add_direct, extra_settings &ext)
 {
-    std::string real_rule;
     if(startsWith(rule, "[]") && add_direct)
     {
         filtered_nodelist.emplace_back(rule.substr(2));
@@ -216,14 +283,15 @@ void groupGenerate(const std::string &rule, std::vector<Proxy> &nodelist, string
             {
                 script_print_stack(ctx);
             }
-        }, global.scriptCleanContext);
+        }, global->scriptCleanContext);
     }
 #endif // NO_JS_RUNTIME
     else
     {
+        NodeMatcher matcher = compileMatcher(rule);
         for(Proxy &x : nodelist)
         {
-            if(applyMatcher(rule, real_rule, x) && (real_rule.empty() || regFind(x.Remark, real_rule)) && std::find(filtered_nodelist.begin(), filtered_nodelist.end(), x.Remark) == filtered_nodelist.end())
+            if(applyMatcher(matcher, x) && (matcher.Rule.empty() || regFind(x.Remark, matcher.RuleRegex)) && std::find(filtered_nodelist.begin(), filtered_nodelist.end(), x.Remark) == filtered_nodelist.end())
                 filtered_nodelist.emplace_back(x.Remark);
         }
     }
@@ -690,7 +758,8 @@ void proxyToClash(std::vector<Proxy> &nodes, YAML::Node &yamlnode, const ProxyGr
     }
 }
 
-std::string proxyToClash(std::vector<Proxy> &nodes, const std::string &base_conf, std::vector<RulesetContent> &ruleset_content_array, const ProxyGroupConfigs &extra_proxy_group, bool clashR, extra_settings &ext)
+/// when deferred_rules is given, generated rules are left out of the output and handed back as a provider
+std::string proxyToClash(std::vector<Proxy> &nodes, const std::string &base_conf, std::vector<RulesetContent> &ruleset_content_array, const ProxyGroupConfigs &extra_proxy_group, bool clashR, extra_settings &ext, RuleProvider *deferred_rules)
 {
     YAML::Node yamlnode;
 
@@ -732,8 +801,22 @@ std::string proxyToClash(std::vector<Proxy> &nodes, const std::string &base_conf
         return YAML::Dump(yamlnode);
     }
 
-    std::string output_content = rulesetToClashStr(yamlnode, ruleset_content_array, ext.overwrite_original_rules, ext.clash_new_field_name);
-    output_content.insert(0, YAML::Dump(yamlnode));
+    std::string rule_header = rulesetToClashHeader(yamlnode, ext.overwrite_original_rules, ext.clash_new_field_name);
+    std::string output_content = YAML::Dump(yamlnode);
+    output_content += rule_header;
+    if(deferred_rules)
+    {
+        *deferred_rules = [ruleset_content_array](const RuleWriter &writer) mutable
+        {
+            return rulesetToClashStream(ruleset_content_array, writer);
+        };
+        return output_content;
+    }
+    rulesetToClashStream(ruleset_content_array, [&output_content](const std::string &chunk)
+    {
+        output_content += chunk;
+        return true;
+    });
     //rulesetToClash(yamlnode, ruleset_content_array, ext.overwrite_original_rules, ext.clash_new_field_name);
     //std::string output_content = YAML::Dump(yamlnode);
 
@@ -887,7 +970,7 @@ std::string proxyToSurge(std::vector<Proxy> &nodes, const std::string &base_conf
             proxy += "\", local-port=" + std::to_string(local_port);
             if(isIPv4(hostname) || isIPv6(hostname))
                 proxy += ", addresses=" + hostname;
-            else if(global.surgeResolveHostname)
+            else if(global->surgeResolveHostname)
                 proxy += ", addresses=" + hostnameToIPAddr(hostname);
             local_port++;
             break;
@@ -2611,7 +2694,7 @@ void proxyToSingBox(std::vector<Proxy> &nodes, rapidjson::Document &json, std::v
         outbounds.PushBack(group, allocator);
     }
 
-    if (global.singBoxAddClashModes)
+    if (global->singBoxAddClashModes)
     {
         auto global_group = rapidjson::Value(rapidjson::kObjectType);
         global_group.AddMember("type", "selector", allocator);
@@ -9,6 +9,7 @@
 #include "handler/settings.h"
 #include "handler/webget.h"
 #include "utils/logger.h"
+#include "utils/metrics.h"
 #include "utils/network.h"
 #include "utils/regexp.h"
 #include "utils/urlencode.h"
@@ -46,10 +47,10 @@ std::string parseHostname(inja::Arguments &args)
     if(!urls.size())
         return std::string();
 
-    std::string input_content, output_content, proxy = parseProxy(global.proxyConfig);
+    std::string input_content, output_content, proxy = parseProxy(global->proxyConfig);
     for(std::string &x : urls)
     {
-        input_content = webGet(x, proxy, global.cacheConfig);
+        input_content = webGet(x, proxy, global->cacheConfig);
         regGetMatch(input_content, matcher, 2, 0, &hostname);
         if(hostname.size())
         {
@@ -71,14 +72,15 @@ std::string parseHostname(inja::Arguments &args)
 #ifndef NO_WEBGET
 std::string template_webGet(inja::Arguments &args)
 {
-    std::string data = args.at(0)->get<std::string>(), proxy = parseProxy(global.proxyConfig);
+    std::string data = args.at(0)->get<std::string>(), proxy = parseProxy(global->proxyConfig);
     writeLog(0, "Template called fetch with url '" + data + "'.", LOG_LEVEL_INFO);
-    return webGet(data, proxy, global.cacheConfig);
+    return webGet(data, proxy, global->cacheConfig);
 }
 #endif // NO_WEBGET
 
 int render_template(const std::string &content, const template_args &vars, std::string &output, const std::string &include_scope)
 {
+    StageTimer timer(METRIC_STAGE_RENDER);
     std::string absolute_scope;
     try
     {
@@ -179,7 +181,7 @@ int render_template(const std::string &content, const template_args &vars, std::
     });
     env.add_callback("getLink", 1, [](inja::Arguments &args)
     {
-        return global.managedConfigPrefix + args.at(0)->get<std::string>();
+        return global->managedConfigPrefix + args.at(0)->get<std::string>();
     });
     env.add_callback("startsWith", 2, [](inja::Arguments &args)
     {
@@ -310,9 +312,8 @@ std::string findFileName(const std::string &path)
 int renderClashScript(YAML::Node &base_rule, std::vector<RulesetContent> &ruleset_content_array, const std::string &remote_path_prefix, bool script, bool overwrite_original_rules, bool clash_classical_ruleset)
 {
     nlohmann::json data;
-    std::string match_group, geoips, retrieved_rules;
+    std::string match_group, geoips;
     std::string strLine, rule_group, rule_path, rule_path_typed, rule_name, old_rule_name;
-    std::stringstream strStrm;
     string_array vArray, groups;
     string_map keywords, urls, names;
     std::map<std::string, bool> has_domain, has_ipcidr;
@@ -406,62 +407,46 @@ int renderClashScript(YAML::Node &base_rule, std::vector<RulesetContent> &rulese
                     continue;
             }
 
-            retrieved_rules = x.rule_content.get();
-            if(retrieved_rules.empty())
+            if(x.rule_content.get().empty())
             {
                 writeLog(0, "Failed to fetch ruleset or ruleset is empty: '" + x.rule_path + "'!", LOG_LEVEL_WARNING);
                 continue;
             }
 
-            retrieved_rules = convertRuleset(retrieved_rules, x.rule_type);
-            char delimiter = getLineBreak(retrieved_rules);
-
-            strStrm.clear();
-            strStrm<<retrieved_rules;
-            std::string::size_type lineSize;
             bool has_no_resolve = false;
-            while(getline(strStrm, strLine, delimiter))
+            for(const ParsedRule &rule : getParsedRuleset(x).rules)
             {
-                lineSize = strLine.size();
-                if(lineSize && strLine[lineSize - 1] == '\r') //remove line break
-                    strLine.erase(--lineSize);
-                if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
-                    continue;
-
-                if(startsWith(strLine, "DOMAIN-KEYWORD,"))
+                if(rule.line.starts_with("DOMAIN-KEYWORD,"))
                 {
                     if(script)
                     {
-                        vArray = split(strLine, ",");
-                        if(vArray.size() < 2)
+                        if(rule.field_count < 2)
                             continue;
                         if(keywords.find(rule_name) == keywords.end())
-                            keywords[rule_name] = "\"" + trim(vArray[1]) + "\"";
+                            keywords[rule_name] = "\"" + trim(std::string(rule.pattern)) + "\"";
                         else
-                            keywords[rule_name] += ",\"" + trim(vArray[1]) + "\"";
+                            keywords[rule_name] += ",\"" + trim(std::string(rule.pattern)) + "\"";
                     }
                     else
                     {
-                        vArray = split(strLine, ",");
-                        if(vArray.size() < 2)
-                        {
-                            strLine = vArray[0] + "," + rule_group;
-                        }
-                        else
+                        strLine = rule.type;
+                        if(rule.field_count >= 2)
+                            strLine += "," + trim(std::string(rule.pattern));
+                        strLine += "," + rule_group;
+                        if(rule.field_count > 2)
                         {
-                            strLine = vArray[0] + "," + trim(vArray[1]) + "," + rule_group;
-                            if(vArray.size() > 2)
-                                strLine += "," + vArray[2];
+                            strLine += ",";
+                            strLine += rule.option;
                         }
                         rules.emplace_back(strLine);
                     }
                 }
-                else if(!has_domain[rule_name] && (startsWith(strLine, "DOMAIN,") || startsWith(strLine, "DOMAIN-SUFFIX,")))
+                else if(!has_domain[rule_name] && (rule.line.starts_with("DOMAIN,") || rule.line.starts_with("DOMAIN-SUFFIX,")))
                     has_domain[rule_name] = true;
-                else if(!has_ipcidr[rule_name] && (startsWith(strLine, "IP-CIDR,") || startsWith(strLine, "IP-CIDR6,")))
+                else if(!has_ipcidr[rule_name] && (rule.line.starts_with("IP-CIDR,") || rule.line.starts_with("IP-CIDR6,")))
                 {
                     has_ipcidr[rule_name] = true;
-                    if(strLine.find(",no-resolve") != std::string::npos)
+                    if(rule.line.find(",no-resolve") != std::string_view::npos)
                         has_no_resolve = true;
                 }
             }
@@ -2,11 +2,15 @@
 #include <string>
 #include <mutex>
 #include <numeric>
+#include <optional>
+#include <list>
+#include <unordered_map>
 
 #include <yaml-cpp/yaml.h>
 
 #include "config/binding.h"
 #include "generator/config/nodemanip.h"
+#include "generator/config/rulebinary.h"
 #include "generator/config/ruleconvert.h"
 #include "generator/config/subexport.h"
 #include "generator/template/templates.h"
@@ -16,7 +20,9 @@
 #include "utils/file_extra.h"
 #include "utils/ini_reader/ini_reader.h"
 #include "utils/logger.h"
+#include "utils/metrics.h"
 #include "utils/network.h"
+#include "utils/rapidjson_extra.h"
 #include "utils/regexp.h"
 #include "utils/stl_extra.h"
 #include "utils/string.h"
@@ -43,7 +49,6 @@ std::string parseProxy(const std::string &source)
     return proxy;
 }
 
-extern string_array ClashRuleTypes, SurgeRuleTypes, QuanXRuleTypes;
 
 struct UAProfile
 {
@@ -133,47 +138,14 @@ void matchUserAgent(const std::string &user_agent, std::string &target, tribool
     }
 }
 
-std::string getRuleset(RESPONSE_CALLBACK_ARGS)
+/// converts fetched rulesets to the type requested from /getruleset, handing the output to the writer in chunks
+static bool writeRuleset(std::vector<RulesetContent> &rca, int type_int, const std::string &group, const RuleWriter &writer)
 {
-    auto &argument = request.argument;
-    int *status_code = &response.status_code;
-    /// type: 1 for Surge, 2 for Quantumult X, 3 for Clash domain rule-provider, 4 for Clash ipcidr rule-provider, 5 for Surge DOMAIN-SET, 6 for Clash classical ruleset
-    std::string url = urlSafeBase64Decode(getUrlArg(argument, "url")), type = getUrlArg(argument, "type"), group = urlSafeBase64Decode(getUrlArg(argument, "group"));
-    std::string output_content, dummy;
-    int type_int = to_int(type, 0);
-
-    if(url.empty() || type.empty() || (type_int == 2 && group.empty()) || (type_int < 1 || type_int > 6))
-    {
-        *status_code = 400;
-        return "Invalid request!";
-    }
-
-    std::string proxy = parseProxy(global.proxyRuleset);
-    string_array vArray = split(url, "|");
-    for(std::string &x : vArray)
-        x.insert(0, "ruleset,");
-    std::vector<RulesetContent> rca;
-    RulesetConfigs confs = INIBinding::from<RulesetConfig>::from_ini(vArray);
-    refreshRulesets(confs, rca);
-    for(RulesetContent &x : rca)
-    {
-        std::string content = x.rule_content.get();
-        output_content += convertRuleset(content, x.rule_type);
-    }
-
-    if(output_content.empty())
-    {
-        *status_code = 400;
-        return "Invalid request!";
-    }
-
-    std::string strLine;
-    std::stringstream ss;
+    StageTimer timer(METRIC_STAGE_RULESET);
+    std::string output_content, strLine;
     const std::string rule_match_regex = "^(.*?,.*?)(,.*)(,.*)$";
-
-    ss << output_content;
-    char delimiter = getLineBreak(output_content);
     std::string::size_type lineSize, posb, pose;
+    bool has_rules = false;
     auto filterLine = [&]()
     {
         posb = 0;
@@ -183,99 +155,106 @@ std::string getRuleset(RESPONSE_CALLBACK_ARGS)
         posb = pose + 1;
         pose = strLine.find(',', posb);
         if(pose == std::string::npos)
-        {
             pose = strLine.size();
-            if(strLine[pose - 1] == '\r')
-                pose--;
-        }
         pose -= posb;
         return 0;
     };
 
-    lineSize = output_content.size();
-    output_content.clear();
-    output_content.reserve(lineSize);
-
+    output_content.reserve(rule_chunk_size + 1024);
     if(type_int == 3 || type_int == 4 || type_int == 6)
         output_content = "payload:\n";
 
-    while(getline(ss, strLine, delimiter))
+    for(RulesetContent &x : rca)
     {
-        if(strFind(strLine, "//"))
+        std::string content = convertRuleset(x.rule_content.get(), x.rule_type);
+        LineReader reader(content);
+        std::string_view line;
+        while(reader.next(line))
         {
-            strLine.erase(strLine.find("//"));
-            strLine = trimWhitespace(strLine);
-        }
-        switch(type_int)
-        {
-        case 2:
-            if(!std::any_of(QuanXRuleTypes.begin(), QuanXRuleTypes.end(), [&strLine](const std::string& type){return startsWith(strLine, type);}))
-                continue;
-            break;
-        case 1:
-            if(!std::any_of(SurgeRuleTypes.begin(), SurgeRuleTypes.end(), [&strLine](const std::string& type){return startsWith(strLine, type);}))
-                continue;
-            break;
-        case 3:
-            if(!startsWith(strLine, "DOMAIN-SUFFIX,") && !startsWith(strLine, "DOMAIN,"))
-                continue;
-            if(filterLine())
-                continue;
-            output_content += "  - '";
-            if(strLine[posb - 2] == 'X')
-                output_content += "+.";
-            output_content += trim(strLine.substr(posb, pose));
-            output_content += "'\n";
-            continue;
-        case 4:
-            if(!startsWith(strLine, "IP-CIDR,") && !startsWith(strLine, "IP-CIDR6,"))
-                continue;
-            if(filterLine())
-                continue;
-            output_content += "  - '";
-            output_content += trim(strLine.substr(posb, pose));
-            output_content += "'\n";
-            continue;
-        case 5:
-            if(!startsWith(strLine, "DOMAIN-SUFFIX,") && !startsWith(strLine, "DOMAIN,"))
+            strLine.assign(line);
+            if(output_content.size() >= rule_chunk_size)
+            {
+                if(!writer(output_content))
+                    return false;
+                output_content.clear();
+            }
+            if(strFind(strLine, "//"))
+            {
+                strLine.erase(strLine.find("//"));
+                strLine = trimWhitespace(strLine);
+            }
+            RuleTypeMatch match = classifyRule(strLine);
+            switch(type_int)
+            {
+            case 2:
+                if(!(match.targets & RULE_TARGET_QUANX))
+                    continue;
+                break;
+            case 1:
+                if(!(match.targets & RULE_TARGET_SURGE))
+                    continue;
+                break;
+            case 3:
+                if(match.type != RULE_TYPE_DOMAIN_SUFFIX && match.type != RULE_TYPE_DOMAIN)
+                    continue;
+                if(filterLine())
+                    continue;
+                output_content += "  - '";
+                if(strLine[posb - 2] == 'X')
+                    output_content += "+.";
+                output_content += trim(strLine.substr(posb, pose));
+                output_content += "'\n";
+                has_rules = true;
                 continue;
-            if(filterLine())
+            case 4:
+                if(match.type != RULE_TYPE_IP_CIDR && match.type != RULE_TYPE_IP_CIDR6)
+                    continue;
+                if(filterLine())
+                    continue;
+                output_content += "  - '";
+                output_content += trim(strLine.substr(posb, pose));
+                output_content += "'\n";
+                has_rules = true;
                 continue;
-            if(strLine[posb - 2] == 'X')
-                output_content += '.';
-            output_content += trim(strLine.substr(posb, pose));
-            output_content += '\n';
-            continue;
-        case 6:
-            if(!std::any_of(ClashRuleTypes.begin(), ClashRuleTypes.end(), [&strLine](const std::string& type){return startsWith(strLine, type);}))
+            case 5:
+                if(match.type != RULE_TYPE_DOMAIN_SUFFIX && match.type != RULE_TYPE_DOMAIN)
+                    continue;
+                if(filterLine())
+                    continue;
+                if(strLine[posb - 2] == 'X')
+                    output_content += '.';
+                output_content += trim(strLine.substr(posb, pose));
+                output_content += '\n';
                 continue;
-            output_content += "  - ";
-        default:
-            break;
-        }
-
-        lineSize = strLine.size();
-        if(lineSize && strLine[lineSize - 1] == '\r') //remove line break
-            strLine.erase(--lineSize);
+            case 6:
+                if(!(match.targets & RULE_TARGET_CLASH))
+                    continue;
+                output_content += "  - ";
+            default:
+                break;
+            }
 
-        if(!strLine.empty() && (strLine[0] != ';' && strLine[0] != '#' && !(lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')))
-        {
-            if(type_int == 2)
+            lineSize = strLine.size();
+            if(!strLine.empty() && (strLine[0] != ';' && strLine[0] != '#' && !(lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')))
             {
-                if(startsWith(strLine, "IP-CIDR6"))
-                    strLine.replace(0, 8, "IP6-CIDR");
-                strLine += "," + group;
-                if(count_least(strLine, ',', 3) && regReplace(strLine, rule_match_regex, "$2") == ",no-resolve")
-                    strLine = regReplace(strLine, rule_match_regex, "$1$3$2");
-                else
-                    strLine = regReplace(strLine, rule_match_regex, "$1$3");
+                if(type_int == 2)
+                {
+                    if(startsWith(strLine, "IP-CIDR6"))
+                        strLine.replace(0, 8, "IP6-CIDR");
+                    strLine += "," + group;
+                    if(count_least(strLine, ',', 3) && regReplace(strLine, rule_match_regex, "$2") == ",no-resolve")
+                        strLine = regReplace(strLine, rule_match_regex, "$1$3$2");
+                    else
+                        strLine = regReplace(strLine, rule_match_regex, "$1$3");
+                }
             }
+            output_content += strLine;
+            output_content += '\n';
+            has_rules = true;
         }
-        output_content += strLine;
-        output_content += '\n';
     }
 
-    if(output_content == "payload:\n")
+    if(!has_rules)
     {
         switch(type_int)
         {
@@ -290,16 +269,80 @@ std::string getRuleset(RESPONSE_CALLBACK_ARGS)
             break;
         }
     }
+    return output_content.empty() || writer(output_content);
+}
+
+std::string getRuleset(RESPONSE_CALLBACK_ARGS)
+{
+    auto &argument = request.argument;
+    int *status_code = &response.status_code;
+    /// type: 1 for Surge, 2 for Quantumult X, 3 for Clash domain rule-provider, 4 for Clash ipcidr rule-provider, 5 for Surge DOMAIN-SET, 6 for Clash classical ruleset,
+    /// 7 for mihomo domain .mrs, 8 for mihomo ipcidr .mrs, 9 for sing-box .srs
+    std::string url = urlSafeBase64Decode(getUrlArg(argument, "url")), type = getUrlArg(argument, "type"), group = urlSafeBase64Decode(getUrlArg(argument, "group"));
+    int type_int = to_int(type, 0);
+
+    if(url.empty() || type.empty() || (type_int == 2 && group.empty()) || (type_int < 1 || type_int > 9))
+    {
+        *status_code = 400;
+        return "Invalid request!";
+    }
+    int binary_format = type_int - 7 + RULESET_BINARY_MRS_DOMAIN;
+    if(type_int >= 7 && !binaryRulesetAvailable(binary_format))
+    {
+        *status_code = 501;
+        return "This rule-set type is not supported by this build!";
+    }
+
+    std::string proxy = parseProxy(global->proxyRuleset);
+    string_array vArray = split(url, "|");
+    for(std::string &x : vArray)
+        x.insert(0, "ruleset,");
+    std::vector<RulesetContent> rca;
+    RulesetConfigs confs = INIBinding::from<RulesetConfig>::from_ini(vArray);
+    refreshRulesets(confs, rca);
+    if(std::all_of(rca.begin(), rca.end(), [](const RulesetContent &x){ return x.rule_content.get().empty(); }))
+    {
+        *status_code = 400;
+        return "Invalid request!";
+    }
+
+    if(type_int >= 7)
+    {
+        std::string output_content;
+        if(!rulesetToBinary(rca, binary_format, output_content))
+        {
+            *status_code = 400;
+            return "No rules in these rulesets can be written to this rule-set type!";
+        }
+        response.content_type = "application/octet-stream";
+        return output_content;
+    }
+
+    if(global->streamOutput && request.method == "GET")
+    {
+        response.provider = [rca, type_int, group](const content_sink &sink) mutable
+        {
+            return writeRuleset(rca, type_int, group, sink);
+        };
+        return "";
+    }
+
+    std::string output_content;
+    writeRuleset(rca, type_int, group, [&output_content](const std::string &chunk)
+    {
+        output_content += chunk;
+        return true;
+    });
     return output_content;
 }
 
 void checkExternalBase(const std::string &path, std::string &dest)
 {
-    if(isLink(path) || (startsWith(path, global.basePath) && fileExist(path)))
+    if(isLink(path) || (startsWith(path, global->basePath) && fileExist(path)))
         dest = path;
 }
 
-std::string subconverter(RESPONSE_CALLBACK_ARGS)
+static std::string generateSubscription(RESPONSE_CALLBACK_ARGS)
 {
     auto &argument = request.argument;
     int *status_code = &response.status_code;
@@ -324,8 +367,12 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         return "Invalid target!";
     }
     //check if we need to read configuration
-    if(global.reloadConfOnRequest && (!global.APIMode || global.CFWChildProcess) && !global.generatorMode)
+    std::optional<SettingsScope> reloaded;
+    if(global->reloadConfOnRequest && (!global->APIMode || global->CFWChildProcess) && !global->generatorMode)
+    {
         readConf();
+        reloaded.emplace(global.latest());
+    }
 
     /// string values
     std::string argUrl = getUrlArg(argument, "url");
@@ -344,28 +391,32 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     tribool argPrependInsert = getUrlArg(argument, "prepend"), argGenClassicalRuleProvider = getUrlArg(argument, "classic"), argTLS13 = getUrlArg(argument, "tls13");
 
     std::string base_content, output_content;
-    ProxyGroupConfigs lCustomProxyGroups = global.customProxyGroups;
-    RulesetConfigs lCustomRulesets = global.customRulesets;
-    string_array lIncludeRemarks = global.includeRemarks, lExcludeRemarks = global.excludeRemarks;
+    ProxyGroupConfigs lCustomProxyGroups = global->customProxyGroups;
+    RulesetConfigs lCustomRulesets = global->customRulesets;
+    string_array lIncludeRemarks = global->includeRemarks, lExcludeRemarks = global->excludeRemarks;
     std::vector<RulesetContent> lRulesetContent;
+    RegexMatchConfigs lRenames, lEmojis;
     extra_settings ext;
     std::string subInfo, dummy;
-    int interval = !argUpdateInterval.empty() ? to_int(argUpdateInterval, global.updateInterval) : global.updateInterval;
-    bool authorized = !global.APIMode || getUrlArg(argument, "token") == global.accessToken, strict = !argUpdateStrict.empty() ? argUpdateStrict == "true" : global.updateStrict;
+    int interval = !argUpdateInterval.empty() ? to_int(argUpdateInterval, global->updateInterval) : global->updateInterval;
+    bool authorized = !global->APIMode || getUrlArg(argument, "token") == global->accessToken, strict = !argUpdateStrict.empty() ? argUpdateStrict == "true" : global->updateStrict;
 
     if(std::find(gRegexBlacklist.cbegin(), gRegexBlacklist.cend(), argIncludeRemark) != gRegexBlacklist.cend() || std::find(gRegexBlacklist.cbegin(), gRegexBlacklist.cend(), argExcludeRemark) != gRegexBlacklist.cend())
+    {
+        *status_code = 400;
         return "Invalid request!";
+    }
 
     /// for external configuration
-    std::string lClashBase = global.clashBase, lSurgeBase = global.surgeBase, lMellowBase = global.mellowBase, lSurfboardBase = global.surfboardBase;
-    std::string lQuanBase = global.quanBase, lQuanXBase = global.quanXBase, lLoonBase = global.loonBase, lSSSubBase = global.SSSubBase;
-    std::string lSingBoxBase = global.singBoxBase;
+    std::string lClashBase = global->clashBase, lSurgeBase = global->surgeBase, lMellowBase = global->mellowBase, lSurfboardBase = global->surfboardBase;
+    std::string lQuanBase = global->quanBase, lQuanXBase = global->quanXBase, lLoonBase = global->loonBase, lSSSubBase = global->SSSubBase;
+    std::string lSingBoxBase = global->singBoxBase;
 
     /// validate urls
-    argEnableInsert.define(global.enableInsert);
-    if(argUrl.empty() && (!global.APIMode || authorized))
-        argUrl = global.defaultUrls;
-    if((argUrl.empty() && !(!global.insertUrls.empty() && argEnableInsert)) || argTarget.empty())
+    argEnableInsert.define(global->enableInsert);
+    if(argUrl.empty() && (!global->APIMode || authorized))
+        argUrl = global->defaultUrls;
+    if((argUrl.empty() && !(!global->insertUrls.empty() && argEnableInsert)) || argTarget.empty())
     {
         *status_code = 400;
         return "Invalid request!";
@@ -398,33 +449,33 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
 
     /// save template variables
     template_args tpl_args;
-    tpl_args.global_vars = global.templateVars;
+    tpl_args.global_vars = global->templateVars;
     tpl_args.request_params = req_arg_map;
 
     /// check for proxy settings
-    std::string proxy = parseProxy(global.proxySubscription);
+    std::string proxy = parseProxy(global->proxySubscription);
 
     /// check other flags
     ext.authorized = authorized;
-    ext.append_proxy_type = argAppendType.get(global.appendType);
+    ext.append_proxy_type = argAppendType.get(global->appendType);
     if((argTarget == "clash" || argTarget == "clashr") && argGenClashScript.is_undef())
         argExpandRulesets.define(true);
 
-    ext.clash_proxies_style = global.clashProxiesStyle;
-    ext.clash_proxy_groups_style = global.clashProxyGroupsStyle;
+    ext.clash_proxies_style = global->clashProxiesStyle;
+    ext.clash_proxy_groups_style = global->clashProxyGroupsStyle;
 
     /// read preference from argument, assign global var if not in argument
-    ext.tfo.define(argTFO).define(global.TFOFlag);
-    ext.udp.define(argUDP).define(global.UDPFlag);
-    ext.skip_cert_verify.define(argSkipCertVerify).define(global.skipCertVerify);
-    ext.tls13.define(argTLS13).define(global.TLS13Flag);
+    ext.tfo.define(argTFO).define(global->TFOFlag);
+    ext.udp.define(argUDP).define(global->UDPFlag);
+    ext.skip_cert_verify.define(argSkipCertVerify).define(global->skipCertVerify);
+    ext.tls13.define(argTLS13).define(global->TLS13Flag);
 
-    ext.sort_flag = argSort.get(global.enableSort);
-    argUseSortScript.define(!global.sortScript.empty());
+    ext.sort_flag = argSort.get(global->enableSort);
+    argUseSortScript.define(!global->sortScript.empty());
     if(ext.sort_flag && argUseSortScript)
-        ext.sort_script = global.sortScript;
-    ext.filter_deprecated = argFilterDeprecated.get(global.filterDeprecated);
-    ext.clash_new_field_name = argClashNewField.get(global.clashUseNewField);
+        ext.sort_script = global->sortScript;
+    ext.filter_deprecated = argFilterDeprecated.get(global->filterDeprecated);
+    ext.clash_new_field_name = argClashNewField.get(global->clashUseNewField);
     ext.clash_script = argGenClashScript.get();
     ext.clash_classical_ruleset = argGenClassicalRuleProvider.get();
     if(!argExpandRulesets)
@@ -433,16 +484,16 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         ext.clash_script = false;
 
     ext.nodelist = argGenNodeList;
-    ext.surge_ssr_path = global.surgeSSRPath;
-    ext.quanx_dev_id = !argDeviceID.empty() ? argDeviceID : global.quanXDevID;
-    ext.enable_rule_generator = global.enableRuleGen;
-    ext.overwrite_original_rules = global.overwriteOriginalRules;
+    ext.surge_ssr_path = global->surgeSSRPath;
+    ext.quanx_dev_id = !argDeviceID.empty() ? argDeviceID : global->quanXDevID;
+    ext.enable_rule_generator = global->enableRuleGen;
+    ext.overwrite_original_rules = global->overwriteOriginalRules;
     if(!argExpandRulesets)
-        ext.managed_config_prefix = global.managedConfigPrefix;
+        ext.managed_config_prefix = global->managedConfigPrefix;
 
     /// load external configuration
     if(argExternalConfig.empty())
-        argExternalConfig = global.defaultExtConfig;
+        argExternalConfig = global->defaultExtConfig;
     if(!argExternalConfig.empty())
     {
         //std::cerr<<"External configuration file provided. Loading...\n";
@@ -474,9 +525,15 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
                 }
             }
             if(!extconf.rename.empty())
-                ext.rename_array = extconf.rename;
+            {
+                lRenames = std::move(extconf.rename);
+                ext.rename_array = &lRenames;
+            }
             if(!extconf.emoji.empty())
-                ext.emoji_array = extconf.emoji;
+            {
+                lEmojis = std::move(extconf.emoji);
+                ext.emoji_array = &lEmojis;
+            }
             if(!extconf.include.empty())
                 lIncludeRemarks = extconf.include;
             if(!extconf.exclude.empty())
@@ -506,14 +563,10 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     }
     if(ext.enable_rule_generator && !ext.nodelist && !lSimpleSubscription)
     {
-        if(lCustomRulesets != global.customRulesets)
+        if(lCustomRulesets != global->customRulesets || global->updateRulesetOnRequest)
             refreshRulesets(lCustomRulesets, lRulesetContent);
         else
-        {
-            if(global.updateRulesetOnRequest)
-                refreshRulesets(global.customRulesets, global.rulesetsContent);
-            lRulesetContent = global.rulesetsContent;
-        }
+            lRulesetContent = global->rulesetsContent;
     }
 
     if(!argEmoji.is_undef())
@@ -521,14 +574,17 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         argAddEmoji.set(argEmoji);
         argRemoveEmoji.set(true);
     }
-    ext.add_emoji = argAddEmoji.get(global.addEmoji);
-    ext.remove_emoji = argRemoveEmoji.get(global.removeEmoji);
-    if(ext.add_emoji && ext.emoji_array.empty())
-        ext.emoji_array = safe_get_emojis();
+    ext.add_emoji = argAddEmoji.get(global->addEmoji);
+    ext.remove_emoji = argRemoveEmoji.get(global->removeEmoji);
+    if(ext.add_emoji && !ext.emoji_array)
+        ext.emoji_array = &global->emojis;
     if(!argRenames.empty())
-        ext.rename_array = INIBinding::from<RegexMatchConfig>::from_ini(split(argRenames, "`"), "@");
-    else if(ext.rename_array.empty())
-        ext.rename_array = safe_get_renames();
+    {
+        lRenames = INIBinding::from<RegexMatchConfig>::from_ini(split(argRenames, "`"), "@");
+        ext.rename_array = &lRenames;
+    }
+    else if(!ext.rename_array)
+        ext.rename_array = &global->renames;
 
     /// check custom include/exclude settings
     if (!argIncludeRemark.empty())
@@ -585,7 +641,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     }
 
     /// initialize script runtime
-    if(authorized && !global.scriptCleanContext)
+    if(authorized && !global->scriptCleanContext)
     {
         ext.js_runtime = new qjs::Runtime();
         script_runtime_init(*ext.js_runtime);
@@ -593,11 +649,9 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         script_context_init(*ext.js_context);
     }
 
-    //start parsing urls
-    RegexMatchConfigs stream_temp = safe_get_streams(), time_temp = safe_get_times();
-
     //loading urls
     string_array urls;
+    std::string failed_link;
     std::vector<Proxy> nodes, insert_nodes;
     int groupID = 0;
 
@@ -605,36 +659,25 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     parse_set.proxy = &proxy;
     parse_set.exclude_remarks = &lExcludeRemarks;
     parse_set.include_remarks = &lIncludeRemarks;
-    parse_set.stream_rules = &stream_temp;
-    parse_set.time_rules = &time_temp;
+    parse_set.stream_rules = &global->streamNodeRules;
+    parse_set.time_rules = &global->timeNodeRules;
     parse_set.sub_info = &subInfo;
     parse_set.authorized = authorized;
     parse_set.request_header = &request.headers;
     parse_set.js_runtime = ext.js_runtime;
     parse_set.js_context = ext.js_context;
 
-    if(!global.insertUrls.empty() && argEnableInsert)
+    if(!global->insertUrls.empty() && argEnableInsert)
     {
         groupID = -1;
-        urls = split(global.insertUrls, "|");
+        urls = split(global->insertUrls, "|");
         // Remove empty urls
         urls.erase(std::remove_if(urls.begin(), urls.end(), [](const std::string& str) { return str.empty(); }), urls.end());
         importItems(urls, true);
-        for(std::string &x : urls)
+        if(addNodesParallel(urls, insert_nodes, groupID, -1, parse_set, failed_link) == -1)
         {
-            x = regTrim(x);
-            writeLog(0, "Fetching node data from url '" + x + "'.", LOG_LEVEL_INFO);
-            if(addNodes(x, insert_nodes, groupID, parse_set) == -1)
-            {
-                if(global.skipFailedLinks)
-                    writeLog(0, "The following link doesn't contain any valid node info: " + x, LOG_LEVEL_WARNING);
-                else
-                {
-                    *status_code = 400;
-                    return "The following link doesn't contain any valid node info: " + x;
-                }
-            }
-            groupID--;
+            *status_code = 400;
+            return "The following link doesn't contain any valid node info: " + failed_link;
         }
     }
     urls = split(argUrl, "|");
@@ -642,22 +685,10 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     urls.erase(std::remove_if(urls.begin(), urls.end(), [](const std::string& str) { return str.empty(); }), urls.end());
     importItems(urls, true);
     groupID = 0;
-    for(std::string &x : urls)
+    if(addNodesParallel(urls, nodes, groupID, 1, parse_set, failed_link) == -1)
     {
-        x = regTrim(x);
-        //std::cerr<<"Fetching node data from url '"<<x<<"'."<<std::endl;
-        writeLog(0, "Fetching node data from url '" + x + "'.", LOG_LEVEL_INFO);
-        if(addNodes(x, nodes, groupID, parse_set) == -1)
-        {
-            if(global.skipFailedLinks)
-                writeLog(0, "The following link doesn't contain any valid node info: " + x, LOG_LEVEL_WARNING);
-            else
-            {
-                *status_code = 400;
-                return "The following link doesn't contain any valid node info: " + x;
-            }
-        }
-        groupID++;
+        *status_code = 400;
+        return "The following link doesn't contain any valid node info: " + failed_link;
     }
     //exit if found nothing
     if(nodes.empty() && insert_nodes.empty())
@@ -665,13 +696,13 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         *status_code = 400;
         return "No nodes were found!";
     }
-    if(!subInfo.empty() && argAppendUserinfo.get(global.appendUserinfo))
+    if(!subInfo.empty() && argAppendUserinfo.get(global->appendUserinfo))
         response.headers.emplace("Subscription-UserInfo", subInfo);
 
     if(request.method == "HEAD")
         return "";
 
-    argPrependInsert.define(global.prependInsert);
+    argPrependInsert.define(global->prependInsert);
     if(argPrependInsert)
     {
         std::move(nodes.begin(), nodes.end(), std::back_inserter(insert_nodes));
@@ -682,7 +713,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         std::move(insert_nodes.begin(), insert_nodes.end(), std::back_inserter(nodes));
     }
     //run filter script
-    std::string filterScript = global.filterScript;
+    std::string filterScript = global->filterScript;
     if(authorized && !argFilterScript.empty())
         filterScript = argFilterScript;
     if(!filterScript.empty())
@@ -724,7 +755,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
             {
                 script_print_stack(ctx);
             }
-        }, global.scriptCleanContext);
+        }, global->scriptCleanContext);
     }
 
     //check custom group name
@@ -753,10 +784,12 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     std::vector<RulesetContent> dummy_ruleset;
     std::string managed_url = base64Decode(getUrlArg(argument, "profile_data"));
     if(managed_url.empty())
-        managed_url = global.managedConfigPrefix + "/sub?" + joinArguments(argument);
+        managed_url = global->managedConfigPrefix + "/sub?" + joinArguments(argument);
 
     //std::cerr<<"Generate target: ";
-    proxy = parseProxy(global.proxyConfig);
+    proxy = parseProxy(global->proxyConfig);
+    /// base rendering and rule conversion below are timed as their own stages
+    StageTimer export_timer(METRIC_STAGE_EXPORT);
     switch(hash_(argTarget))
     {
     case "clash"_hash: case "clashr"_hash:
@@ -771,12 +804,22 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         }
         else
         {
-            if(render_template(fetchFile(lClashBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lClashBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
             }
-            output_content = proxyToClash(nodes, base_content, lRulesetContent, lCustomProxyGroups, argTarget == "clashr", ext);
+            /// uploads need the whole output, so only plain GET responses leave the rules to be streamed
+            RuleProvider deferred_rules;
+            output_content = proxyToClash(nodes, base_content, lRulesetContent, lCustomProxyGroups, argTarget == "clashr", ext, global->streamOutput && !argUpload && request.method == "GET" && !traceCurrent() ? &deferred_rules : nullptr);
+            if(deferred_rules)
+            {
+                response.provider = [head = std::move(output_content), deferred_rules](const content_sink &sink)
+                {
+                    return sink(head) && deferred_rules(sink);
+                };
+                output_content.clear();
+            }
         }
 
         if(argUpload)
@@ -795,7 +838,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         }
         else
         {
-            if(render_template(fetchFile(lSurgeBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lSurgeBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
@@ -805,7 +848,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
             if(argUpload)
                 uploadGist("surge" + argSurgeVer, argUploadPath, output_content, true);
 
-            if(global.writeManagedConfig && !global.managedConfigPrefix.empty())
+            if(global->writeManagedConfig && !global->managedConfigPrefix.empty())
                 output_content = "#!MANAGED-CONFIG " + managed_url + (interval ? " interval=" + std::to_string(interval) : "") \
                  + " strict=" + std::string(strict ? "true" : "false") + "\n\n" + output_content;
         }
@@ -813,7 +856,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     case "surfboard"_hash:
         writeLog(0, "Generate target: Surfboard", LOG_LEVEL_INFO);
 
-        if(render_template(fetchFile(lSurfboardBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+        if(render_template(fetchFile(lSurfboardBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
         {
             *status_code = 400;
             return base_content;
@@ -822,14 +865,14 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         if(argUpload)
             uploadGist("surfboard", argUploadPath, output_content, true);
 
-        if(global.writeManagedConfig && !global.managedConfigPrefix.empty())
+        if(global->writeManagedConfig && !global->managedConfigPrefix.empty())
             output_content = "#!MANAGED-CONFIG " + managed_url + (interval ? " interval=" + std::to_string(interval) : "") \
                  + " strict=" + std::string(strict ? "true" : "false") + "\n\n" + output_content;
         break;
     case "mellow"_hash:
         writeLog(0, "Generate target: Mellow", LOG_LEVEL_INFO);
 
-        if(render_template(fetchFile(lMellowBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+        if(render_template(fetchFile(lMellowBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
         {
             *status_code = 400;
             return base_content;
@@ -842,7 +885,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
     case "sssub"_hash:
         writeLog(0, "Generate target: SS Subscription", LOG_LEVEL_INFO);
 
-        if(render_template(fetchFile(lSSSubBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+        if(render_template(fetchFile(lSSSubBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
         {
             *status_code = 400;
             return base_content;
@@ -885,7 +928,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         writeLog(0, "Generate target: Quantumult", LOG_LEVEL_INFO);
         if(!ext.nodelist)
         {
-            if(render_template(fetchFile(lQuanBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lQuanBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
@@ -901,7 +944,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         writeLog(0, "Generate target: Quantumult X", LOG_LEVEL_INFO);
         if(!ext.nodelist)
         {
-            if(render_template(fetchFile(lQuanXBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lQuanXBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
@@ -917,7 +960,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         writeLog(0, "Generate target: Loon", LOG_LEVEL_INFO);
         if(!ext.nodelist)
         {
-            if(render_template(fetchFile(lLoonBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lLoonBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
@@ -939,7 +982,7 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         writeLog(0, "Generate target: sing-box", LOG_LEVEL_INFO);
         if(!ext.nodelist)
         {
-            if(render_template(fetchFile(lSingBoxBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+            if(render_template(fetchFile(lSingBoxBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
             {
                 *status_code = 400;
                 return base_content;
@@ -957,11 +1000,237 @@ std::string subconverter(RESPONSE_CALLBACK_ARGS)
         return "Unrecognized target";
     }
     writeLog(0, "Generate completed.", LOG_LEVEL_INFO);
+    RegexCacheStats regex_stats = regGetCacheStats();
+    writeLog(0, "Regex cache: " + std::to_string(regex_stats.hits) + " hit(s), " + std::to_string(regex_stats.misses) + " miss(es), " + std::to_string(regex_stats.size) + "/" + std::to_string(regex_stats.capacity) + " pattern(s) cached.", LOG_LEVEL_DEBUG);
     if(!argFilename.empty())
         response.headers.emplace("Content-Disposition", "attachment; filename=\"" + argFilename + "\"; filename*=utf-8''" + urlEncode(argFilename));
     return output_content;
 }
 
+/// generated /sub responses, bounded by global->responseCacheSize bytes and kept for global->cacheSubscription seconds
+struct ResponseCacheEntry
+{
+    std::string key;
+    std::string content;
+    std::string content_type;
+    string_icase_map headers;
+    time_t generate_time = 0;
+};
+
+struct ResponseCache
+{
+    std::mutex lock;
+    std::list<ResponseCacheEntry> lru;
+    std::unordered_map<std::string_view, std::list<ResponseCacheEntry>::iterator> index;
+    size_t size = 0;
+};
+
+static ResponseCache response_cache;
+
+static size_t responseCacheEntrySize(const ResponseCacheEntry &entry)
+{
+    size_t size = entry.key.size() + entry.content.size() + entry.content_type.size();
+    for(auto &x : entry.headers)
+        size += x.first.size() + x.second.size();
+    return size;
+}
+
+static void responseCacheEvict(size_t budget)
+{
+    while(response_cache.size > budget && !response_cache.lru.empty())
+    {
+        auto &entry = response_cache.lru.back();
+        response_cache.size -= responseCacheEntrySize(entry);
+        response_cache.index.erase(entry.key);
+        response_cache.lru.pop_back();
+    }
+}
+
+void flushResponseCache()
+{
+    std::lock_guard<std::mutex> guard(response_cache.lock);
+    response_cache.index.clear();
+    response_cache.lru.clear();
+    response_cache.size = 0;
+}
+
+static double toMilliseconds(std::chrono::steady_clock::duration elapsed)
+{
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+static void writeTraceRules(rapidjson::Writer<rapidjson::StringBuffer> &writer, const std::vector<RequestTrace::Rule> &rules)
+{
+    writer.StartArray();
+    for(auto &x : rules)
+    {
+        writer.StartObject();
+        writer.Key("rule");
+        writer.String(x.rule.data(), x.rule.size());
+        writer.Key("calls");
+        writer.Uint64(x.calls);
+        writer.Key("ms");
+        writer.Double(toMilliseconds(x.elapsed));
+        writer.EndObject();
+    }
+    writer.EndArray();
+}
+
+/// generates the subscription with a trace attached, then reports it in Server-Timing and optionally as a JSON body
+static std::string tracedSubscription(RESPONSE_CALLBACK_ARGS, bool json)
+{
+    auto trace = std::make_shared<RequestTrace>();
+    auto start = std::chrono::steady_clock::now();
+    std::string content;
+    {
+        TraceScope trace_scope(trace);
+        content = generateSubscription(request, response);
+    }
+    auto total = std::chrono::steady_clock::now() - start;
+
+    std::lock_guard<std::mutex> guard(trace->lock);
+    std::string timing;
+    char buffer[64];
+    for(int i = 0; i < METRIC_STAGE_COUNT; i++)
+    {
+        if(trace->stages[i] == std::chrono::steady_clock::duration::zero())
+            continue;
+        snprintf(buffer, sizeof(buffer), "%s;dur=%.3f, ", metricStageName(static_cast<metric_stage>(i)), toMilliseconds(trace->stages[i]));
+        timing += buffer;
+    }
+    snprintf(buffer, sizeof(buffer), "total;dur=%.3f", toMilliseconds(total));
+    timing += buffer;
+    response.headers["Server-Timing"] = timing;
+    if(!json)
+        return content;
+
+    rapidjson::StringBuffer sb;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
+    writer.StartObject();
+    writer.Key("total_ms");
+    writer.Double(toMilliseconds(total));
+    writer.Key("status_code");
+    writer.Int(response.status_code);
+    writer.Key("output_bytes");
+    writer.Uint64(content.size());
+    writer.Key("stages");
+    writer.StartObject();
+    for(int i = 0; i < METRIC_STAGE_COUNT; i++)
+    {
+        writer.Key(metricStageName(static_cast<metric_stage>(i)));
+        writer.Double(toMilliseconds(trace->stages[i]));
+    }
+    writer.EndObject();
+    writer.Key("fetches");
+    writer.StartArray();
+    for(auto &x : trace->fetches)
+    {
+        writer.StartObject();
+        writer.Key("url");
+        writer.String(x.url.data(), x.url.size());
+        writer.Key("cache");
+        writer.String(x.cache.data(), x.cache.size());
+        writer.Key("bytes");
+        writer.Uint64(x.bytes);
+        writer.Key("ms");
+        writer.Double(toMilliseconds(x.elapsed));
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("filters");
+    writer.StartArray();
+    for(auto &x : trace->filters)
+    {
+        writer.StartObject();
+        writer.Key("group_id");
+        writer.Int(x.group_id);
+        writer.Key("before");
+        writer.Uint64(x.before);
+        writer.Key("after");
+        writer.Uint64(x.after);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.Key("rename_rules");
+    writeTraceRules(writer, trace->rename_rules);
+    writer.Key("emoji_rules");
+    writeTraceRules(writer, trace->emoji_rules);
+    writer.EndObject();
+
+    response.content_type = "application/json";
+    response.headers.erase("Content-Disposition");
+    return sb.GetString();
+}
+
+std::string subconverter(RESPONSE_CALLBACK_ARGS)
+{
+    /// timing reports are only handed to the token holder, and never cached
+    std::string argTiming = getUrlArg(request.argument, "timing"), argTrace = getUrlArg(request.argument, "trace");
+    if((argTiming == "true" || argTrace == "true") && !global->accessToken.empty() && getUrlArg(request.argument, "token") == global->accessToken)
+        return tracedSubscription(request, response, argTrace == "true");
+
+    /// uploads are side effects, HEAD requests only want the headers, and reloading the config on request flushes the cache every time
+    if(!global->responseCacheSize || global->cacheSubscription <= 0 || global->reloadConfOnRequest || request.method != "GET" || getUrlArg(request.argument, "upload") == "true")
+        return generateSubscription(request, response);
+
+    /// arguments are kept sorted by name, so the same query in any order maps to the same key
+    std::string key;
+    for(auto &x : request.argument)
+    {
+        key += x.first;
+        key += '=';
+        key += x.second;
+        key += '\n';
+    }
+    /// looked up without operator[], the headers are forwarded upstream and an empty User-Agent would replace the default one
+    key += "User-Agent: ";
+    auto user_agent = request.headers.find("User-Agent");
+    if(user_agent != request.headers.end())
+        key += user_agent->second;
+
+    {
+        std::lock_guard<std::mutex> guard(response_cache.lock);
+        auto iter = response_cache.index.find(key);
+        if(iter != response_cache.index.end())
+        {
+            auto &entry = *iter->second;
+            if(difftime(time(nullptr), entry.generate_time) <= global->cacheSubscription)
+            {
+                writeLog(0, "Serving generated subscription from response cache.", LOG_LEVEL_INFO);
+                response_cache.lru.splice(response_cache.lru.begin(), response_cache.lru, iter->second);
+                response.content_type = entry.content_type;
+                response.headers = entry.headers;
+                return entry.content;
+            }
+            response_cache.size -= responseCacheEntrySize(entry);
+            response_cache.lru.erase(iter->second);
+            response_cache.index.erase(iter);
+        }
+    }
+
+    std::string content = generateSubscription(request, response);
+    if(response.status_code != 200 || response.provider)
+        return content;
+
+    ResponseCacheEntry entry {std::move(key), content, response.content_type, response.headers, time(nullptr)};
+    size_t entry_size = responseCacheEntrySize(entry), budget = global->responseCacheSize;
+    if(entry_size > budget)
+        return content;
+    std::lock_guard<std::mutex> guard(response_cache.lock);
+    auto iter = response_cache.index.find(entry.key);
+    if(iter != response_cache.index.end()) /// generated by another request in the meantime
+    {
+        response_cache.size -= responseCacheEntrySize(*iter->second);
+        response_cache.lru.erase(iter->second);
+        response_cache.index.erase(iter);
+    }
+    responseCacheEvict(budget - entry_size);
+    response_cache.lru.emplace_front(std::move(entry));
+    response_cache.index.emplace(response_cache.lru.front().key, response_cache.lru.begin());
+    response_cache.size += entry_size;
+    return content;
+}
+
 std::string simpleToClashR(RESPONSE_CALLBACK_ARGS)
 {
     auto argument = joinArguments(request.argument);
@@ -992,12 +1261,12 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
     string_array dummy_str_array;
     std::vector<Proxy> nodes;
     std::string base_content, url = argument.size() <= 5 ? "" : argument.substr(5);
-    const std::string proxygroup_name = global.clashUseNewField ? "proxy-groups" : "Proxy Group", rule_name = global.clashUseNewField ? "rules" : "Rule";
+    const std::string proxygroup_name = global->clashUseNewField ? "proxy-groups" : "Proxy Group", rule_name = global->clashUseNewField ? "rules" : "Rule";
 
     ini.store_any_line = true;
 
     if(url.empty())
-        url = global.defaultUrls;
+        url = global->defaultUrls;
     if(url.empty() || argument.substr(0, 5) != "link=")
     {
         *status_code = 400;
@@ -1010,22 +1279,22 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
     }
     writeLog(0, "SurgeConfToClash called with url '" + url + "'.", LOG_LEVEL_INFO);
 
-    std::string proxy = parseProxy(global.proxyConfig);
+    std::string proxy = parseProxy(global->proxyConfig);
     YAML::Node clash;
     template_args tpl_args;
-    tpl_args.global_vars = global.templateVars;
-    tpl_args.local_vars["clash.new_field_name"] = global.clashUseNewField ? "true" : "false";
+    tpl_args.global_vars = global->templateVars;
+    tpl_args.local_vars["clash.new_field_name"] = global->clashUseNewField ? "true" : "false";
     tpl_args.request_params["target"] = "clash";
     tpl_args.request_params["url"] = url;
 
-    if(render_template(fetchFile(global.clashBase, proxy, global.cacheConfig), tpl_args, base_content, global.templatePath) != 0)
+    if(render_template(fetchFile(global->clashBase, proxy, global->cacheConfig), tpl_args, base_content, global->templatePath) != 0)
     {
         *status_code = 400;
         return base_content;
     }
     clash = YAML::Load(base_content);
 
-    base_content = fetchFile(url, proxy, global.cacheConfig);
+    base_content = fetchFile(url, proxy, global->cacheConfig);
 
     if(ini.parse(base_content) != INIREADER_EXCEPTION_NONE)
     {
@@ -1078,7 +1347,7 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
         clash[proxygroup_name].push_back(singlegroup);
     }
 
-    proxy = parseProxy(global.proxySubscription);
+    proxy = parseProxy(global->proxySubscription);
     eraseElements(dummy_str_array);
 
     RegexMatchConfigs dummy_regex_array;
@@ -1089,21 +1358,12 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
     parse_set.stream_rules = parse_set.time_rules = &dummy_regex_array;
     parse_set.request_header = &request.headers;
     parse_set.sub_info = &subInfo;
-    parse_set.authorized = !global.APIMode;
-    for(std::string &x : links)
+    parse_set.authorized = !global->APIMode;
+    std::string failed_link;
+    if(addNodesParallel(links, nodes, 0, 0, parse_set, failed_link) == -1)
     {
-        //std::cerr<<"Fetching node data from url '"<<x<<"'."<<std::endl;
-        writeLog(0, "Fetching node data from url '" + x + "'.", LOG_LEVEL_INFO);
-        if(addNodes(x, nodes, 0, parse_set) == -1)
-        {
-            if(global.skipFailedLinks)
-                writeLog(0, "The following link doesn't contain any valid node info: " + x, LOG_LEVEL_WARNING);
-            else
-            {
-                *status_code = 400;
-                return "The following link doesn't contain any valid node info: " + x;
-            }
-        }
+        *status_code = 400;
+        return "The following link doesn't contain any valid node info: " + failed_link;
     }
 
     //exit if found nothing
@@ -1114,15 +1374,15 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
     }
 
     extra_settings ext;
-    ext.sort_flag = global.enableSort;
-    ext.filter_deprecated = global.filterDeprecated;
-    ext.clash_new_field_name = global.clashUseNewField;
-    ext.udp = global.UDPFlag;
-    ext.tfo = global.TFOFlag;
-    ext.skip_cert_verify = global.skipCertVerify;
-    ext.tls13 = global.TLS13Flag;
-    ext.clash_proxies_style = global.clashProxiesStyle;
-    ext.clash_proxy_groups_style = global.clashProxyGroupsStyle;
+    ext.sort_flag = global->enableSort;
+    ext.filter_deprecated = global->filterDeprecated;
+    ext.clash_new_field_name = global->clashUseNewField;
+    ext.udp = global->UDPFlag;
+    ext.tfo = global->TFOFlag;
+    ext.skip_cert_verify = global->skipCertVerify;
+    ext.tls13 = global->TLS13Flag;
+    ext.clash_proxies_style = global->clashProxiesStyle;
+    ext.clash_proxy_groups_style = global->clashProxyGroupsStyle;
 
     ProxyGroupConfigs dummy_groups;
     proxyToClash(nodes, clash, dummy_groups, false, ext);
@@ -1162,7 +1422,6 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
     YAML::Node rule;
     string_array strArray;
     std::string strLine;
-    std::stringstream ss;
     std::string::size_type lineSize;
     for(std::string &x : dummy_str_array)
     {
@@ -1171,37 +1430,34 @@ std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS)
             strArray = split(x, ",");
             if(strArray.size() != 3)
                 continue;
-            content = webGet(strArray[1], proxy, global.cacheRuleset);
+            content = webGet(strArray[1], proxy, global->cacheRuleset);
             if(content.empty())
                 continue;
 
-            ss << content;
-            char delimiter = getLineBreak(content);
-
-            while(getline(ss, strLine, delimiter))
+            LineReader reader(content);
+            std::string_view line;
+            while(reader.next(line))
             {
+                strLine.assign(line);
                 lineSize = strLine.size();
-                if(lineSize && strLine[lineSize - 1] == '\r') //remove line break
-                    strLine.erase(--lineSize);
                 if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
                     continue;
-                else if(!std::any_of(ClashRuleTypes.begin(), ClashRuleTypes.end(), [&strLine](const std::string& type){return startsWith(strLine, type);})) //remove unsupported types
+                else if(!(classifyRule(strLine).targets & RULE_TARGET_CLASH)) //remove unsupported types
                     continue;
                 strLine += strArray[2];
                 if(count_least(strLine, ',', 3))
                     strLine = regReplace(strLine, "^(.*?,.*?)(,.*)(,.*)$", "$1$3$2");
                 rule.push_back(strLine);
             }
-            ss.clear();
             continue;
         }
-        else if(!std::any_of(ClashRuleTypes.begin(), ClashRuleTypes.end(), [&strLine](const std::string& type){return startsWith(strLine, type);}))
+        else if(!(classifyRule(x).targets & RULE_TARGET_CLASH))
             continue;
         rule.push_back(x);
     }
     clash[rule_name] = rule;
 
-    response.headers["profile-update-interval"] = std::to_string(global.updateInterval / 3600);
+    response.headers["profile-update-interval"] = std::to_string(global->updateInterval / 3600);
     writeLog(0, "Conversion completed.", LOG_LEVEL_INFO);
     return YAML::Dump(clash);
 }
@@ -1291,11 +1547,11 @@ std::string getProfile(RESPONSE_CALLBACK_ARGS)
             *status_code = 403;
             return "Forbidden";
         }
-        token = global.accessToken;
+        token = global->accessToken;
     }
     else
     {
-        if(token != global.accessToken)
+        if(token != global->accessToken)
         {
             *status_code = 403;
             return "Forbidden";
@@ -1354,7 +1610,7 @@ std::string getProfile(RESPONSE_CALLBACK_ARGS)
     update_container(contents, "include", all_includes);
 
     contents.emplace("token", token);
-    contents.emplace("profile_data", base64Encode(global.managedConfigPrefix + "/getprofile?" + joinArguments(argument)));
+    contents.emplace("profile_data", base64Encode(global->managedConfigPrefix + "/getprofile?" + joinArguments(argument)));
     std::copy(argument.cbegin(), argument.cend(), std::inserter(contents, contents.end()));
     request.argument = contents;
     return subconverter(request, response);
@@ -1363,9 +1619,9 @@ std::string getProfile(RESPONSE_CALLBACK_ARGS)
 /*
 std::string jinja2_webGet(const std::string &url)
 {
-    std::string proxy = parseProxy(global.proxyConfig);
+    std::string proxy = parseProxy(global->proxyConfig);
     writeLog(0, "Template called fetch with url '" + url + "'.", LOG_LEVEL_INFO);
-    return webGet(url, proxy, global.cacheConfig);
+    return webGet(url, proxy, global->cacheConfig);
 }*/
 
 inline std::string intToStream(unsigned long long stream)
@@ -1412,6 +1668,7 @@ std::string subInfoToMessage(std::string subinfo)
 
 int simpleGenerator()
 {
+    SettingsScope scope(global.latest());
     //std::cerr<<"\nReading generator configuration...\n";
     writeLog(0, "Reading generator configuration...", LOG_LEVEL_INFO);
     std::string config = fileGet("generate.ini"), path, profile, content;
@@ -1433,11 +1690,11 @@ int simpleGenerator()
     writeLog(0, "Read generator configuration completed.\n", LOG_LEVEL_INFO);
 
     string_array sections = ini.get_section_names();
-    if(!global.generateProfiles.empty())
+    if(!global->generateProfiles.empty())
     {
         //std::cerr<<"Generating with specific artifacts: \""<<gen_profile<<"\"...\n";
-        writeLog(0, "Generating with specific artifacts: \"" + global.generateProfiles + "\"...", LOG_LEVEL_INFO);
-        string_array targets = split(global.generateProfiles, ","), new_targets;
+        writeLog(0, "Generating with specific artifacts: \"" + global->generateProfiles + "\"...", LOG_LEVEL_INFO);
+        string_array targets = split(global->generateProfiles, ","), new_targets;
         for(std::string &x : targets)
         {
             x = trim(x);
@@ -1458,7 +1715,7 @@ int simpleGenerator()
         writeLog(0, "Generating all artifacts...", LOG_LEVEL_INFO);
 
     string_multimap allItems;
-    std::string proxy = parseProxy(global.proxySubscription);
+    std::string proxy = parseProxy(global->proxySubscription);
     for(std::string &x : sections)
     {
         Request request;
@@ -1479,7 +1736,7 @@ int simpleGenerator()
         {
             profile = ini.get("profile");
             request.argument.emplace("name", profile);
-            request.argument.emplace("token", global.accessToken);
+            request.argument.emplace("token", global->accessToken);
             request.argument.emplace("expand", "true");
             content = getProfile(request, response);
         }
@@ -1488,7 +1745,7 @@ int simpleGenerator()
             if(ini.get_bool("direct"))
             {
                 std::string url = ini.get("url");
-                content = fetchFile(url, proxy, global.cacheSubscription);
+                content = fetchFile(url, proxy, global->cacheSubscription);
                 if(content.empty())
                 {
                     //std::cerr<<"Artifact '"<<x<<"' generate ERROR! Please check your link.\n\n";
@@ -1539,19 +1796,19 @@ std::string renderTemplate(RESPONSE_CALLBACK_ARGS)
     std::string path = getUrlArg(argument, "path");
     writeLog(0, "Trying to render template '" + path + "'...", LOG_LEVEL_INFO);
 
-    if(!startsWith(path, global.templatePath) || !fileExist(path))
+    if(!startsWith(path, global->templatePath) || !fileExist(path))
     {
         *status_code = 404;
         return "Not found";
     }
-    std::string template_content = fetchFile(path, parseProxy(global.proxyConfig), global.cacheConfig);
+    std::string template_content = fetchFile(path, parseProxy(global->proxyConfig), global->cacheConfig);
     if(template_content.empty())
     {
         *status_code = 400;
         return "File empty or out of scope";
     }
     template_args tpl_args;
-    tpl_args.global_vars = global.templateVars;
+    tpl_args.global_vars = global->templateVars;
 
     //load request arguments as template variables
     string_map req_arg_map;
@@ -1562,7 +1819,7 @@ std::string renderTemplate(RESPONSE_CALLBACK_ARGS)
     tpl_args.request_params = req_arg_map;
 
     std::string output_content;
-    if(render_template(template_content, tpl_args, output_content, global.templatePath) != 0)
+    if(render_template(template_content, tpl_args, output_content, global->templatePath) != 0)
     {
         *status_code = 400;
         writeLog(0, "Render failed with error.", LOG_LEVEL_WARNING);
@@ -12,6 +12,7 @@
 std::string parseProxy(const std::string &source);
 
 void refreshRulesets(RulesetConfigs &ruleset_list, std::vector<RulesetContent> &rca);
+void refreshGlobalRulesets();
 void readConf();
 int simpleGenerator();
 std::string convertRuleset(const std::string &content, int type);
@@ -20,6 +21,7 @@ std::string getProfile(RESPONSE_CALLBACK_ARGS);
 std::string getRuleset(RESPONSE_CALLBACK_ARGS);
 
 std::string subconverter(RESPONSE_CALLBACK_ARGS);
+void flushResponseCache();
 std::string simpleToClashR(RESPONSE_CALLBACK_ARGS);
 std::string surgeConfToClash(RESPONSE_CALLBACK_ARGS);
 
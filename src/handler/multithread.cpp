@@ -2,79 +2,75 @@
 #include <thread>
 
 #include "handler/settings.h"
+#include "utils/executor.h"
 #include "utils/network.h"
 #include "webget.h"
 #include "multithread.h"
 //#include "vfs.h"
 
-//safety lock for multi-thread
-std::mutex on_emoji, on_rename, on_stream, on_time;
-
-RegexMatchConfigs safe_get_emojis()
-{
-    guarded_mutex guard(on_emoji);
-    return global.emojis;
-}
-
-RegexMatchConfigs safe_get_renames()
-{
-    guarded_mutex guard(on_rename);
-    return global.renames;
-}
-
-RegexMatchConfigs safe_get_streams()
+Executor &sharedExecutor()
 {
-    guarded_mutex guard(on_stream);
-    return global.streamNodeRules;
+    /// sized once from the settings read at startup and kept until exit, so no worker outlives what it uses
+    static Executor *executor = new Executor(global->executorThreads ? global->executorThreads : std::max(2u, std::thread::hardware_concurrency()));
+    return *executor;
 }
 
-RegexMatchConfigs safe_get_times()
+static std::string fetchFileContent(const std::string &path, const std::string &proxy, int cache_ttl, bool find_local)
 {
-    guarded_mutex guard(on_time);
-    return global.timeNodeRules;
-}
-
-void safe_set_emojis(RegexMatchConfigs data)
-{
-    guarded_mutex guard(on_emoji);
-    global.emojis.swap(data);
-}
-
-void safe_set_renames(RegexMatchConfigs data)
-{
-    guarded_mutex guard(on_rename);
-    global.renames.swap(data);
+    /*if(vfs::vfs_exist(path))
+        return vfs::vfs_get(path);
+    else */if(find_local && fileExist(path, true))
+        return fileGet(path, true);
+    else if(isLink(path))
+        return webGet(path, proxy, cache_ttl);
+    return std::string();
 }
 
-void safe_set_streams(RegexMatchConfigs data)
+std::shared_future<std::string> fetchFileAsync(const std::string &path, const std::string &proxy, int cache_ttl, bool find_local, bool async)
 {
-    guarded_mutex guard(on_stream);
-    global.streamNodeRules.swap(data);
+    if(async)
+        return sharedExecutor().submit([path, proxy, cache_ttl, find_local](){ return fetchFileContent(path, proxy, cache_ttl, find_local); }).share();
+    std::promise<std::string> result;
+    result.set_value(fetchFileContent(path, proxy, cache_ttl, find_local));
+    return result.get_future().share();
 }
 
-void safe_set_times(RegexMatchConfigs data)
+std::string fetchFile(const std::string &path, const std::string &proxy, int cache_ttl, bool find_local)
 {
-    guarded_mutex guard(on_time);
-    global.timeNodeRules.swap(data);
+    return fetchFileAsync(path, proxy, cache_ttl, find_local, false).get();
 }
 
-std::shared_future<std::string> fetchFileAsync(const std::string &path, const std::string &proxy, int cache_ttl, bool find_local, bool async)
+std::vector<std::shared_future<std::string>> fetchFilesAsync(const string_array &paths, const std::string &proxy, int cache_ttl, bool find_local, bool async)
 {
-    std::shared_future<std::string> retVal;
-    /*if(vfs::vfs_exist(path))
-        retVal = std::async(std::launch::async, [path](){return vfs::vfs_get(path);});
-    else */if(find_local && fileExist(path, true))
-        retVal = std::async(std::launch::async, [path](){return fileGet(path, true);});
-    else if(isLink(path))
-        retVal = std::async(std::launch::async, [path, proxy, cache_ttl](){return webGet(path, proxy, cache_ttl);});
+    std::vector<std::shared_future<std::string>> retVal;
+    auto promises = std::make_shared<std::vector<std::promise<std::string>>>(paths.size());
+    for(auto &x : *promises)
+        retVal.emplace_back(x.get_future().share());
+    /// all links are downloaded together by one webGetMulti() batch instead of one thread each
+    auto worker = [paths, proxy, cache_ttl, find_local, promises]()
+    {
+        std::vector<FetchTask> tasks;
+        std::vector<size_t> task_index;
+        for(size_t i = 0; i < paths.size(); i++)
+        {
+            const std::string &path = paths[i];
+            if(find_local && fileExist(path, true))
+                (*promises)[i].set_value(fileGet(path, true));
+            else if(isLink(path))
+            {
+                tasks.push_back(FetchTask{path, proxy, static_cast<unsigned int>(cache_ttl)});
+                task_index.push_back(i);
+            }
+            else
+                (*promises)[i].set_value(std::string());
+        }
+        webGetMulti(tasks);
+        for(size_t i = 0; i < tasks.size(); i++)
+            (*promises)[task_index[i]].set_value(std::move(tasks[i].content));
+    };
+    if(async)
+        sharedExecutor().post(worker);
     else
-        return std::async(std::launch::async, [](){return std::string();});
-    if(!async)
-        retVal.wait();
+        worker();
     return retVal;
 }
-
-std::string fetchFile(const std::string &path, const std::string &proxy, int cache_ttl, bool find_local)
-{
-    return fetchFileAsync(path, proxy, cache_ttl, find_local, false).get();
-}
@@ -8,14 +8,12 @@
 #include "server/webserver.h"
 #include "utils/logger.h"
 #include "utils/network.h"
+#include "utils/regexp.h"
 #include "interfaces.h"
 #include "multithread.h"
 #include "settings.h"
 
-//multi-thread lock
-std::mutex gMutexConfigure;
-
-Settings global;
+SettingsHandle global;
 
 extern WebServer webServer;
 
@@ -25,8 +23,7 @@ const std::map<std::string, ruleset_type> RulesetTypes = {{"clash-domain:", RULE
 int importItems(string_array &target, bool scope_limit)
 {
     string_array result;
-    std::stringstream ss;
-    std::string path, content, strLine;
+    std::string path, content;
     unsigned int itemCount = 0;
     for(std::string &x : target)
     {
@@ -38,31 +35,26 @@ int importItems(string_array &target, bool scope_limit)
         path = x.substr(x.find(":") + 1);
         writeLog(0, "Trying to import items from " + path);
 
-        std::string proxy = parseProxy(global.proxyConfig);
+        std::string proxy = parseProxy(global->proxyConfig);
 
         if(fileExist(path))
             content = fileGet(path, scope_limit);
         else if(isLink(path))
-            content = webGet(path, proxy, global.cacheConfig);
+            content = webGet(path, proxy, global->cacheConfig);
         else
             writeLog(0, "File not found or not a valid URL: " + path, LOG_LEVEL_ERROR);
         if(content.empty())
             return -1;
 
-        ss << content;
-        char delimiter = getLineBreak(content);
-        std::string::size_type lineSize;
-        while(getline(ss, strLine, delimiter))
+        LineReader reader(content);
+        std::string_view line;
+        while(reader.next(line))
         {
-            lineSize = strLine.size();
-            if(lineSize && strLine[lineSize - 1] == '\r') //remove line break
-                strLine.erase(--lineSize);
-            if(!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) //empty lines and comments are ignored
+            if(line.empty() || line[0] == ';' || line[0] == '#' || line.starts_with("//")) //empty lines and comments are ignored
                 continue;
-            result.emplace_back(std::move(strLine));
+            result.emplace_back(line);
             itemCount++;
         }
-        ss.clear();
     }
     target.swap(result);
     writeLog(0, "Imported " + std::to_string(itemCount) + " item(s).");
@@ -82,7 +74,7 @@ void importItems(std::vector<toml::value> &root, const std::string &import_key,
     auto iter = root.begin();
     size_t count = 0;
 
-    std::string proxy = parseProxy(global.proxyConfig);
+    std::string proxy = parseProxy(global->proxyConfig);
     while(iter != root.end())
     {
         auto& table = iter->as_table();
@@ -95,7 +87,7 @@ void importItems(std::vector<toml::value> &root, const std::string &import_key,
             if(fileExist(path))
                 content = fileGet(path, scope_limit);
             else if(isLink(path))
-                content = webGet(path, proxy, global.cacheConfig);
+                content = webGet(path, proxy, global->cacheConfig);
             else
                 writeLog(0, "File not found or not a valid URL: " + path, LOG_LEVEL_ERROR);
             if(!content.empty())
@@ -251,7 +243,9 @@ void refreshRulesets(RulesetConfigs &ruleset_list, std::vector<RulesetContent> &
     std::string rule_group, rule_url, rule_url_typed, interval;
     RulesetContent rc;
 
-    std::string proxy = parseProxy(global.proxyRuleset);
+    std::string proxy = parseProxy(global->proxyRuleset);
+    string_array fetch_urls;
+    std::vector<size_t> fetch_index;
 
     for(RulesetConfig &x : ruleset_list)
     {
@@ -261,7 +255,9 @@ void refreshRulesets(RulesetConfigs &ruleset_list, std::vector<RulesetContent> &
         if(pos != std::string::npos)
         {
             writeLog(0, "Adding rule '" + rule_url.substr(pos + 2) + "," + rule_group + "'.", LOG_LEVEL_INFO);
-            rc = {rule_group, "", "", RULESET_SURGE, std::async(std::launch::async, [=](){return rule_url.substr(pos);}), 0};
+            std::promise<std::string> rule;
+            rule.set_value(rule_url.substr(pos));
+            rc = {rule_group, "", "", RULESET_SURGE, rule.get_future().share(), 0};
         }
         else
         {
@@ -274,21 +270,26 @@ void refreshRulesets(RulesetConfigs &ruleset_list, std::vector<RulesetContent> &
                 type = iter->second;
             }
             writeLog(0, "Updating ruleset url '" + rule_url + "' with group '" + rule_group + "'.", LOG_LEVEL_INFO);
-            rc = {rule_group, rule_url, rule_url_typed, type, fetchFileAsync(rule_url, proxy, global.cacheRuleset, true, global.asyncFetchRuleset), x.Interval};
+            rc = {rule_group, rule_url, rule_url_typed, type, {}, x.Interval};
+            fetch_urls.emplace_back(rule_url);
+            fetch_index.emplace_back(ruleset_content_array.size());
         }
         ruleset_content_array.emplace_back(std::move(rc));
     }
+    auto contents = fetchFilesAsync(fetch_urls, proxy, global->cacheRuleset, true, global->asyncFetchRuleset);
+    for(size_t i = 0; i < contents.size(); i++)
+        ruleset_content_array[fetch_index[i]].rule_content = contents[i];
     ruleset_content_array.shrink_to_fit();
 }
 
-void readYAMLConf(YAML::Node &node)
+static void readYAMLConf(YAML::Node &node, Settings &conf)
 {
     YAML::Node section = node["common"];
     std::string strLine;
     string_array tempArray;
 
-    section["api_mode"] >> global.APIMode;
-    section["api_access_token"] >> global.accessToken;
+    section["api_mode"] >> conf.APIMode;
+    section["api_access_token"] >> conf.accessToken;
     if(section["default_url"].IsSequence())
     {
         section["default_url"] >> tempArray;
@@ -298,11 +299,11 @@ void readYAMLConf(YAML::Node &node)
             {
                 return std::move(a) + "|" + std::move(b);
             });
-            global.defaultUrls = strLine;
+            conf.defaultUrls = strLine;
             eraseElements(tempArray);
         }
     }
-    global.enableInsert = safe_as<std::string>(section["enable_insert"]);
+    conf.enableInsert = safe_as<std::string>(section["enable_insert"]);
     if(section["insert_url"].IsSequence())
     {
         section["insert_url"] >> tempArray;
@@ -312,33 +313,33 @@ void readYAMLConf(YAML::Node &node)
             {
                 return std::move(a) + "|" + std::move(b);
             });
-            global.insertUrls = strLine;
+            conf.insertUrls = strLine;
             eraseElements(tempArray);
         }
     }
-    section["prepend_insert_url"] >> global.prependInsert;
+    section["prepend_insert_url"] >> conf.prependInsert;
     if(section["exclude_remarks"].IsSequence())
-        section["exclude_remarks"] >> global.excludeRemarks;
+        section["exclude_remarks"] >> conf.excludeRemarks;
     if(section["include_remarks"].IsSequence())
-        section["include_remarks"] >> global.includeRemarks;
-    global.filterScript = safe_as<bool>(section["enable_filter"]) ? safe_as<std::string>(section["filter_script"]) : "";
-    section["base_path"] >> global.basePath;
-    section["clash_rule_base"] >> global.clashBase;
-    section["surge_rule_base"] >> global.surgeBase;
-    section["surfboard_rule_base"] >> global.surfboardBase;
-    section["mellow_rule_base"] >> global.mellowBase;
-    section["quan_rule_base"] >> global.quanBase;
-    section["quanx_rule_base"] >> global.quanXBase;
-    section["loon_rule_base"] >> global.loonBase;
-    section["sssub_rule_base"] >> global.SSSubBase;
-    section["singbox_rule_base"] >> global.singBoxBase;
-
-    section["default_external_config"] >> global.defaultExtConfig;
-    section["append_proxy_type"] >> global.appendType;
-    section["proxy_config"] >> global.proxyConfig;
-    section["proxy_ruleset"] >> global.proxyRuleset;
-    section["proxy_subscription"] >> global.proxySubscription;
-    section["reload_conf_on_request"] >> global.reloadConfOnRequest;
+        section["include_remarks"] >> conf.includeRemarks;
+    conf.filterScript = safe_as<bool>(section["enable_filter"]) ? safe_as<std::string>(section["filter_script"]) : "";
+    section["base_path"] >> conf.basePath;
+    section["clash_rule_base"] >> conf.clashBase;
+    section["surge_rule_base"] >> conf.surgeBase;
+    section["surfboard_rule_base"] >> conf.surfboardBase;
+    section["mellow_rule_base"] >> conf.mellowBase;
+    section["quan_rule_base"] >> conf.quanBase;
+    section["quanx_rule_base"] >> conf.quanXBase;
+    section["loon_rule_base"] >> conf.loonBase;
+    section["sssub_rule_base"] >> conf.SSSubBase;
+    section["singbox_rule_base"] >> conf.singBoxBase;
+
+    section["default_external_config"] >> conf.defaultExtConfig;
+    section["append_proxy_type"] >> conf.appendType;
+    section["proxy_config"] >> conf.proxyConfig;
+    section["proxy_ruleset"] >> conf.proxyRuleset;
+    section["proxy_subscription"] >> conf.proxySubscription;
+    section["reload_conf_on_request"] >> conf.reloadConfOnRequest;
 
     if(node["userinfo"].IsDefined())
     {
@@ -347,14 +348,14 @@ void readYAMLConf(YAML::Node &node)
         {
             readRegexMatch(section["stream_rule"], "|", tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "|");
-            safe_set_streams(configs);
+            conf.streamNodeRules = configs;
             eraseElements(tempArray);
         }
         if(section["time_rule"].IsSequence())
         {
             readRegexMatch(section["time_rule"], "|", tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "|");
-            safe_set_times(configs);
+            conf.timeNodeRules = configs;
             eraseElements(tempArray);
         }
     }
@@ -367,54 +368,54 @@ void readYAMLConf(YAML::Node &node)
         section["tcp_fast_open_flag"] >> tfo_flag;
         section["skip_cert_verify_flag"] >> scv_flag;
         */
-        global.UDPFlag.set(safe_as<std::string>(section["udp_flag"]));
-        global.TFOFlag.set(safe_as<std::string>(section["tcp_fast_open_flag"]));
-        global.skipCertVerify.set(safe_as<std::string>(section["skip_cert_verify_flag"]));
-        global.TLS13Flag.set(safe_as<std::string>(section["tls13_flag"]));
-        section["sort_flag"] >> global.enableSort;
-        section["sort_script"] >> global.sortScript;
-        section["filter_deprecated_nodes"] >> global.filterDeprecated;
-        section["append_sub_userinfo"] >> global.appendUserinfo;
-        section["clash_use_new_field_name"] >> global.clashUseNewField;
-        section["clash_proxies_style"] >> global.clashProxiesStyle;
-        section["clash_proxy_groups_style"] >> global.clashProxyGroupsStyle;
-        section["singbox_add_clash_modes"] >> global.singBoxAddClashModes;
+        conf.UDPFlag.set(safe_as<std::string>(section["udp_flag"]));
+        conf.TFOFlag.set(safe_as<std::string>(section["tcp_fast_open_flag"]));
+        conf.skipCertVerify.set(safe_as<std::string>(section["skip_cert_verify_flag"]));
+        conf.TLS13Flag.set(safe_as<std::string>(section["tls13_flag"]));
+        section["sort_flag"] >> conf.enableSort;
+        section["sort_script"] >> conf.sortScript;
+        section["filter_deprecated_nodes"] >> conf.filterDeprecated;
+        section["append_sub_userinfo"] >> conf.appendUserinfo;
+        section["clash_use_new_field_name"] >> conf.clashUseNewField;
+        section["clash_proxies_style"] >> conf.clashProxiesStyle;
+        section["clash_proxy_groups_style"] >> conf.clashProxyGroupsStyle;
+        section["singbox_add_clash_modes"] >> conf.singBoxAddClashModes;
     }
 
     if(section["rename_node"].IsSequence())
     {
         readRegexMatch(section["rename_node"], "@", tempArray, false);
         auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "@");
-        safe_set_renames(configs);
+        conf.renames = configs;
         eraseElements(tempArray);
     }
 
     if(node["managed_config"].IsDefined())
     {
         section = node["managed_config"];
-        section["write_managed_config"] >> global.writeManagedConfig;
-        section["managed_config_prefix"] >> global.managedConfigPrefix;
-        section["config_update_interval"] >> global.updateInterval;
-        section["config_update_strict"] >> global.updateStrict;
-        section["quanx_device_id"] >> global.quanXDevID;
+        section["write_managed_config"] >> conf.writeManagedConfig;
+        section["managed_config_prefix"] >> conf.managedConfigPrefix;
+        section["config_update_interval"] >> conf.updateInterval;
+        section["config_update_strict"] >> conf.updateStrict;
+        section["quanx_device_id"] >> conf.quanXDevID;
     }
 
     if(node["surge_external_proxy"].IsDefined())
     {
-        node["surge_external_proxy"]["surge_ssr_path"] >> global.surgeSSRPath;
-        node["surge_external_proxy"]["resolve_hostname"] >> global.surgeResolveHostname;
+        node["surge_external_proxy"]["surge_ssr_path"] >> conf.surgeSSRPath;
+        node["surge_external_proxy"]["resolve_hostname"] >> conf.surgeResolveHostname;
     }
 
     if(node["emojis"].IsDefined())
     {
         section = node["emojis"];
-        section["add_emoji"] >> global.addEmoji;
-        section["remove_old_emoji"] >> global.removeEmoji;
+        section["add_emoji"] >> conf.addEmoji;
+        section["remove_old_emoji"] >> conf.removeEmoji;
         if(section["rules"].IsSequence())
         {
             readEmoji(section["rules"], tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, ",");
-            safe_set_emojis(configs);
+            conf.emojis = configs;
             eraseElements(tempArray);
         }
     }
@@ -423,23 +424,23 @@ void readYAMLConf(YAML::Node &node)
     if(node[rulesets_title].IsDefined())
     {
         section = node[rulesets_title];
-        section["enabled"] >> global.enableRuleGen;
-        if(!global.enableRuleGen)
+        section["enabled"] >> conf.enableRuleGen;
+        if(!conf.enableRuleGen)
         {
-            global.overwriteOriginalRules = false;
-            global.updateRulesetOnRequest = false;
+            conf.overwriteOriginalRules = false;
+            conf.updateRulesetOnRequest = false;
         }
         else
         {
-            section["overwrite_original_rules"] >> global.overwriteOriginalRules;
-            section["update_ruleset_on_request"] >> global.updateRulesetOnRequest;
+            section["overwrite_original_rules"] >> conf.overwriteOriginalRules;
+            section["update_ruleset_on_request"] >> conf.updateRulesetOnRequest;
         }
         const char *ruleset_title = section["rulesets"].IsDefined() ? "rulesets" : "surge_ruleset";
         if(section[ruleset_title].IsSequence())
         {
             string_array vArray;
             readRuleset(section[ruleset_title], vArray, false);
-            global.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
+            conf.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
         }
     }
 
@@ -448,21 +449,21 @@ void readYAMLConf(YAML::Node &node)
     {
         string_array vArray;
         readGroup(node[groups_title]["custom_proxy_group"], vArray, false);
-        global.customProxyGroups = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
+        conf.customProxyGroups = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
     }
 
     if(node["template"].IsDefined())
     {
-        node["template"]["template_path"] >> global.templatePath;
+        node["template"]["template_path"] >> conf.templatePath;
         if(node["template"]["globals"].IsSequence())
         {
-            eraseElements(global.templateVars);
+            eraseElements(conf.templateVars);
             for(size_t i = 0; i < node["template"]["globals"].size(); i++)
             {
                 std::string key, value;
                 node["template"]["globals"][i]["key"] >> key;
                 node["template"]["globals"][i]["value"] >> value;
-                global.templateVars[key] = value;
+                conf.templateVars[key] = value;
             }
         }
     }
@@ -499,69 +500,82 @@ void readYAMLConf(YAML::Node &node)
             vArray.emplace_back(std::move(strLine));
         }
         importItems(vArray, false);
-        global.enableCron = !vArray.empty();
-        global.cronTasks = INIBinding::from<CronTaskConfig>::from_ini(vArray);
+        conf.enableCron = !vArray.empty();
+        conf.cronTasks = INIBinding::from<CronTaskConfig>::from_ini(vArray);
         refresh_schedule();
     }
 
     if(node["server"].IsDefined())
     {
-        node["server"]["listen"] >> global.listenAddress;
-        node["server"]["port"] >> global.listenPort;
-        node["server"]["serve_file_root"] >>= webServer.serve_file_root;
-        webServer.serve_file = !webServer.serve_file_root.empty();
+        node["server"]["listen"] >> conf.listenAddress;
+        node["server"]["port"] >> conf.listenPort;
+        node["server"]["serve_file_root"] >>= conf.serveFileRoot;
+        node["server"]["compress_level"] >> conf.compressLevel;
+        node["server"]["compress_min_size"] >> conf.compressMinSize;
+        node["server"]["compress_cache_size"] >> conf.compressCacheSize;
     }
 
     if(node["advanced"].IsDefined())
     {
         std::string log_level;
         node["advanced"]["log_level"] >> log_level;
-        node["advanced"]["print_debug_info"] >> global.printDbgInfo;
-        if(global.printDbgInfo)
-            global.logLevel = LOG_LEVEL_VERBOSE;
+        node["advanced"]["print_debug_info"] >> conf.printDbgInfo;
+        if(conf.printDbgInfo)
+            conf.logLevel = LOG_LEVEL_VERBOSE;
         else
         {
             switch(hash_(log_level))
             {
             case "warn"_hash:
-                global.logLevel = LOG_LEVEL_WARNING;
+                conf.logLevel = LOG_LEVEL_WARNING;
                 break;
             case "error"_hash:
-                global.logLevel = LOG_LEVEL_ERROR;
+                conf.logLevel = LOG_LEVEL_ERROR;
                 break;
             case "fatal"_hash:
-                global.logLevel = LOG_LEVEL_FATAL;
+                conf.logLevel = LOG_LEVEL_FATAL;
                 break;
             case "verbose"_hash:
-                global.logLevel = LOG_LEVEL_VERBOSE;
+                conf.logLevel = LOG_LEVEL_VERBOSE;
                 break;
             case "debug"_hash:
-                global.logLevel = LOG_LEVEL_DEBUG;
+                conf.logLevel = LOG_LEVEL_DEBUG;
                 break;
             default:
-                global.logLevel = LOG_LEVEL_INFO;
+                conf.logLevel = LOG_LEVEL_INFO;
             }
         }
-        node["advanced"]["max_pending_connections"] >> global.maxPendingConns;
-        node["advanced"]["max_concurrent_threads"] >> global.maxConcurThreads;
-        node["advanced"]["max_allowed_rulesets"] >> global.maxAllowedRulesets;
-        node["advanced"]["max_allowed_rules"] >> global.maxAllowedRules;
-        node["advanced"]["max_allowed_download_size"] >> global.maxAllowedDownloadSize;
+        node["advanced"]["max_pending_connections"] >> conf.maxPendingConns;
+        node["advanced"]["max_concurrent_threads"] >> conf.maxConcurThreads;
+        node["advanced"]["max_allowed_rulesets"] >> conf.maxAllowedRulesets;
+        node["advanced"]["max_allowed_rules"] >> conf.maxAllowedRules;
+        node["advanced"]["max_allowed_download_size"] >> conf.maxAllowedDownloadSize;
+        node["advanced"]["regex_cache_size"] >> conf.regexCacheSize;
+        regSetCacheCapacity(conf.regexCacheSize);
+        node["advanced"]["memory_cache_size"] >> conf.memoryCacheSize;
+        node["advanced"]["response_cache_size"] >> conf.responseCacheSize;
+        node["advanced"]["rule_cache_size"] >> conf.ruleCacheSize;
+        node["advanced"]["curl_pool_size"] >> conf.curlPoolSize;
+        node["advanced"]["curl_pool_idle_timeout"] >> conf.curlPoolIdleTimeout;
+        node["advanced"]["max_parallel_fetches"] >> conf.maxParallelFetches;
+        node["advanced"]["max_host_fetches"] >> conf.maxHostFetches;
+        node["advanced"]["executor_threads"] >> conf.executorThreads;
+        node["advanced"]["stream_output"] >> conf.streamOutput;
         if(node["advanced"]["enable_cache"].IsDefined())
         {
             if(safe_as<bool>(node["advanced"]["enable_cache"]))
             {
-                node["advanced"]["cache_subscription"] >> global.cacheSubscription;
-                node["advanced"]["cache_config"] >> global.cacheConfig;
-                node["advanced"]["cache_ruleset"] >> global.cacheRuleset;
-                node["advanced"]["serve_cache_on_fetch_fail"] >> global.serveCacheOnFetchFail;
+                node["advanced"]["cache_subscription"] >> conf.cacheSubscription;
+                node["advanced"]["cache_config"] >> conf.cacheConfig;
+                node["advanced"]["cache_ruleset"] >> conf.cacheRuleset;
+                node["advanced"]["serve_cache_on_fetch_fail"] >> conf.serveCacheOnFetchFail;
             }
             else
-                global.cacheSubscription = global.cacheConfig = global.cacheRuleset = 0; //disable cache
+                conf.cacheSubscription = conf.cacheConfig = conf.cacheRuleset = 0; //disable cache
         }
-        node["advanced"]["script_clean_context"] >> global.scriptCleanContext;
-        node["advanced"]["async_fetch_ruleset"] >> global.asyncFetchRuleset;
-        node["advanced"]["skip_failed_links"] >> global.skipFailedLinks;
+        node["advanced"]["script_clean_context"] >> conf.scriptCleanContext;
+        node["advanced"]["async_fetch_ruleset"] >> conf.asyncFetchRuleset;
+        node["advanced"]["skip_failed_links"] >> conf.skipFailedLinks;
     }
     writeLog(0, "Load preference settings in YAML format completed.", LOG_LEVEL_INFO);
 }
@@ -582,122 +596,122 @@ void operate_toml_kv_table(const std::vector<toml::table> &arr, const toml::valu
     }
 }
 
-void readTOMLConf(toml::value &root)
+static void readTOMLConf(toml::value &root, Settings &conf)
 {
     auto section_common = toml::find(root, "common");
     string_array default_url, insert_url;
 
     find_if_exist(section_common, "default_url", default_url, "insert_url", insert_url);
-    global.defaultUrls = join(default_url, "|");
-    global.insertUrls = join(insert_url, "|");
+    conf.defaultUrls = join(default_url, "|");
+    conf.insertUrls = join(insert_url, "|");
 
     bool filter = false;
     find_if_exist(section_common,
-                  "api_mode", global.APIMode,
-                  "api_access_token", global.accessToken,
-                  "exclude_remarks", global.excludeRemarks,
-                  "include_remarks", global.includeRemarks,
-                  "enable_insert", global.enableInsert,
-                  "prepend_insert_url", global.prependInsert,
+                  "api_mode", conf.APIMode,
+                  "api_access_token", conf.accessToken,
+                  "exclude_remarks", conf.excludeRemarks,
+                  "include_remarks", conf.includeRemarks,
+                  "enable_insert", conf.enableInsert,
+                  "prepend_insert_url", conf.prependInsert,
                   "enable_filter", filter,
-                  "default_external_config", global.defaultExtConfig,
-                  "base_path", global.basePath,
-                  "clash_rule_base", global.clashBase,
-                  "surge_rule_base", global.surgeBase,
-                  "surfboard_rule_base", global.surfboardBase,
-                  "mellow_rule_base", global.mellowBase,
-                  "quan_rule_base", global.quanBase,
-                  "quanx_rule_base", global.quanXBase,
-                  "loon_rule_base", global.loonBase,
-                  "sssub_rule_base", global.SSSubBase,
-                  "singbox_rule_base", global.singBoxBase,
-                  "proxy_config", global.proxyConfig,
-                  "proxy_ruleset", global.proxyRuleset,
-                  "proxy_subscription", global.proxySubscription,
-                  "append_proxy_type", global.appendType,
-                  "reload_conf_on_request", global.reloadConfOnRequest
+                  "default_external_config", conf.defaultExtConfig,
+                  "base_path", conf.basePath,
+                  "clash_rule_base", conf.clashBase,
+                  "surge_rule_base", conf.surgeBase,
+                  "surfboard_rule_base", conf.surfboardBase,
+                  "mellow_rule_base", conf.mellowBase,
+                  "quan_rule_base", conf.quanBase,
+                  "quanx_rule_base", conf.quanXBase,
+                  "loon_rule_base", conf.loonBase,
+                  "sssub_rule_base", conf.SSSubBase,
+                  "singbox_rule_base", conf.singBoxBase,
+                  "proxy_config", conf.proxyConfig,
+                  "proxy_ruleset", conf.proxyRuleset,
+                  "proxy_subscription", conf.proxySubscription,
+                  "append_proxy_type", conf.appendType,
+                  "reload_conf_on_request", conf.reloadConfOnRequest
     );
 
     if(filter)
-        find_if_exist(section_common, "filter_script", global.filterScript);
+        find_if_exist(section_common, "filter_script", conf.filterScript);
     else
-        global.filterScript.clear();
+        conf.filterScript.clear();
 
-    safe_set_streams(toml::find_or<RegexMatchConfigs>(root, "userinfo", "stream_rule", RegexMatchConfigs{}));
-    safe_set_times(toml::find_or<RegexMatchConfigs>(root, "userinfo", "time_rule", RegexMatchConfigs{}));
+    conf.streamNodeRules = toml::find_or<RegexMatchConfigs>(root, "userinfo", "stream_rule", RegexMatchConfigs{});
+    conf.timeNodeRules = toml::find_or<RegexMatchConfigs>(root, "userinfo", "time_rule", RegexMatchConfigs{});
 
     auto section_node_pref = toml::find(root, "node_pref");
 
     find_if_exist(section_node_pref,
-                  "udp_flag", global.UDPFlag,
-                  "tcp_fast_open_flag", global.TFOFlag,
-                  "skip_cert_verify_flag", global.skipCertVerify,
-                  "tls13_flag", global.TLS13Flag,
-                  "sort_flag", global.enableSort,
-                  "sort_script", global.sortScript,
-                  "filter_deprecated_nodes", global.filterDeprecated,
-                  "append_sub_userinfo", global.appendUserinfo,
-                  "clash_use_new_field_name", global.clashUseNewField,
-                  "clash_proxies_style", global.clashProxiesStyle,
-                  "clash_proxy_groups_style", global.clashProxyGroupsStyle,
-                  "singbox_add_clash_modes", global.singBoxAddClashModes
+                  "udp_flag", conf.UDPFlag,
+                  "tcp_fast_open_flag", conf.TFOFlag,
+                  "skip_cert_verify_flag", conf.skipCertVerify,
+                  "tls13_flag", conf.TLS13Flag,
+                  "sort_flag", conf.enableSort,
+                  "sort_script", conf.sortScript,
+                  "filter_deprecated_nodes", conf.filterDeprecated,
+                  "append_sub_userinfo", conf.appendUserinfo,
+                  "clash_use_new_field_name", conf.clashUseNewField,
+                  "clash_proxies_style", conf.clashProxiesStyle,
+                  "clash_proxy_groups_style", conf.clashProxyGroupsStyle,
+                  "singbox_add_clash_modes", conf.singBoxAddClashModes
     );
 
     auto renameconfs = toml::find_or<std::vector<toml::value>>(section_node_pref, "rename_node", {});
     importItems(renameconfs, "rename_node", false);
-    safe_set_renames(toml::get<RegexMatchConfigs>(toml::value(renameconfs)));
+    conf.renames = toml::get<RegexMatchConfigs>(toml::value(renameconfs));
 
     auto section_managed = toml::find(root, "managed_config");
 
     find_if_exist(section_managed,
-                  "write_managed_config", global.writeManagedConfig,
-                  "managed_config_prefix", global.managedConfigPrefix,
-                  "config_update_interval", global.updateInterval,
-                  "config_update_strict", global.updateStrict,
-                  "quanx_device_id", global.quanXDevID
+                  "write_managed_config", conf.writeManagedConfig,
+                  "managed_config_prefix", conf.managedConfigPrefix,
+                  "config_update_interval", conf.updateInterval,
+                  "config_update_strict", conf.updateStrict,
+                  "quanx_device_id", conf.quanXDevID
     );
 
     auto section_surge_external = toml::find(root, "surge_external_proxy");
     find_if_exist(section_surge_external,
-                  "surge_ssr_path", global.surgeSSRPath,
-                  "resolve_hostname", global.surgeResolveHostname
+                  "surge_ssr_path", conf.surgeSSRPath,
+                  "resolve_hostname", conf.surgeResolveHostname
     );
 
     auto section_emojis = toml::find(root, "emojis");
 
     find_if_exist(section_emojis,
-                  "add_emoji", global.addEmoji,
-                  "remove_old_emoji", global.removeEmoji
+                  "add_emoji", conf.addEmoji,
+                  "remove_old_emoji", conf.removeEmoji
     );
 
     auto emojiconfs = toml::find_or<std::vector<toml::value>>(section_emojis, "emoji", {});
     importItems(emojiconfs, "emoji", false);
-    safe_set_emojis(toml::get<RegexMatchConfigs>(toml::value(emojiconfs)));
+    conf.emojis = toml::get<RegexMatchConfigs>(toml::value(emojiconfs));
 
     auto groups = toml::find_or<std::vector<toml::value>>(root, "custom_groups", {});
     importItems(groups, "custom_groups", false);
-    global.customProxyGroups = toml::get<ProxyGroupConfigs>(toml::value(groups));
+    conf.customProxyGroups = toml::get<ProxyGroupConfigs>(toml::value(groups));
 
     auto section_ruleset = toml::find(root, "ruleset");
 
     find_if_exist(section_ruleset,
-                  "enabled", global.enableRuleGen,
-                  "overwrite_original_rules", global.overwriteOriginalRules,
-                  "update_ruleset_on_request", global.updateRulesetOnRequest
+                  "enabled", conf.enableRuleGen,
+                  "overwrite_original_rules", conf.overwriteOriginalRules,
+                  "update_ruleset_on_request", conf.updateRulesetOnRequest
     );
 
     auto rulesets = toml::find_or<std::vector<toml::value>>(root, "rulesets", {});
     importItems(rulesets, "rulesets", false);
-    global.customRulesets = toml::get<RulesetConfigs>(toml::value(rulesets));
+    conf.customRulesets = toml::get<RulesetConfigs>(toml::value(rulesets));
 
     auto section_template = toml::find(root, "template");
 
-    global.templatePath = toml::find_or(section_template, "template_path", "template");
+    conf.templatePath = toml::find_or(section_template, "template_path", "template");
 
-    eraseElements(global.templateVars);
+    eraseElements(conf.templateVars);
     operate_toml_kv_table(toml::find_or<std::vector<toml::table>>(section_template, "globals", {}), "key", "value", [&](const toml::value &key, const toml::value &value)
     {
-        global.templateVars[key.as_string()] = value.as_string();
+        conf.templateVars[key.as_string()] = value.as_string();
     });
 
     webServer.reset_redirect();
@@ -708,103 +722,116 @@ void readTOMLConf(toml::value &root)
 
     auto tasks = toml::find_or<std::vector<toml::value>>(root, "tasks", {});
     importItems(tasks, "tasks", false);
-    global.cronTasks = toml::get<CronTaskConfigs>(toml::value(tasks));
+    conf.cronTasks = toml::get<CronTaskConfigs>(toml::value(tasks));
     refresh_schedule();
 
     auto section_server = toml::find(root, "server");
 
     find_if_exist(section_server,
-                  "listen", global.listenAddress,
-                  "port", global.listenPort,
-                  "serve_file_root", webServer.serve_file_root
+                  "listen", conf.listenAddress,
+                  "port", conf.listenPort,
+                  "serve_file_root", conf.serveFileRoot,
+                  "compress_level", conf.compressLevel,
+                  "compress_min_size", conf.compressMinSize,
+                  "compress_cache_size", conf.compressCacheSize
     );
-    webServer.serve_file = !webServer.serve_file_root.empty();
 
     auto section_advanced = toml::find(root, "advanced");
 
     std::string log_level;
     bool enable_cache = true;
-    int cache_subscription = global.cacheSubscription, cache_config = global.cacheConfig, cache_ruleset = global.cacheRuleset;
+    int cache_subscription = conf.cacheSubscription, cache_config = conf.cacheConfig, cache_ruleset = conf.cacheRuleset;
 
     find_if_exist(section_advanced,
                   "log_level", log_level,
-                  "print_debug_info", global.printDbgInfo,
-                  "max_pending_connections", global.maxPendingConns,
-                  "max_concurrent_threads", global.maxConcurThreads,
-                  "max_allowed_rulesets", global.maxAllowedRulesets,
-                  "max_allowed_rules", global.maxAllowedRules,
-                  "max_allowed_download_size", global.maxAllowedDownloadSize,
+                  "print_debug_info", conf.printDbgInfo,
+                  "max_pending_connections", conf.maxPendingConns,
+                  "max_concurrent_threads", conf.maxConcurThreads,
+                  "max_allowed_rulesets", conf.maxAllowedRulesets,
+                  "max_allowed_rules", conf.maxAllowedRules,
+                  "max_allowed_download_size", conf.maxAllowedDownloadSize,
+                  "regex_cache_size", conf.regexCacheSize,
+                  "memory_cache_size", conf.memoryCacheSize,
+                  "response_cache_size", conf.responseCacheSize,
+                  "rule_cache_size", conf.ruleCacheSize,
+                  "curl_pool_size", conf.curlPoolSize,
+                  "curl_pool_idle_timeout", conf.curlPoolIdleTimeout,
+                  "max_parallel_fetches", conf.maxParallelFetches,
+                  "max_host_fetches", conf.maxHostFetches,
+                  "executor_threads", conf.executorThreads,
+                  "stream_output", conf.streamOutput,
                   "enable_cache", enable_cache,
                   "cache_subscription", cache_subscription,
                   "cache_config", cache_config,
                   "cache_ruleset", cache_ruleset,
-                  "script_clean_context", global.scriptCleanContext,
-                  "async_fetch_ruleset", global.asyncFetchRuleset,
-                  "skip_failed_links", global.skipFailedLinks
+                  "script_clean_context", conf.scriptCleanContext,
+                  "async_fetch_ruleset", conf.asyncFetchRuleset,
+                  "skip_failed_links", conf.skipFailedLinks
     );
 
-    if(global.printDbgInfo)
-        global.logLevel = LOG_LEVEL_VERBOSE;
+    if(conf.printDbgInfo)
+        conf.logLevel = LOG_LEVEL_VERBOSE;
     else
     {
         switch(hash_(log_level))
         {
         case "warn"_hash:
-            global.logLevel = LOG_LEVEL_WARNING;
+            conf.logLevel = LOG_LEVEL_WARNING;
             break;
         case "error"_hash:
-            global.logLevel = LOG_LEVEL_ERROR;
+            conf.logLevel = LOG_LEVEL_ERROR;
             break;
         case "fatal"_hash:
-            global.logLevel = LOG_LEVEL_FATAL;
+            conf.logLevel = LOG_LEVEL_FATAL;
             break;
         case "verbose"_hash:
-            global.logLevel = LOG_LEVEL_VERBOSE;
+            conf.logLevel = LOG_LEVEL_VERBOSE;
             break;
         case "debug"_hash:
-            global.logLevel = LOG_LEVEL_DEBUG;
+            conf.logLevel = LOG_LEVEL_DEBUG;
             break;
         default:
-            global.logLevel = LOG_LEVEL_INFO;
+            conf.logLevel = LOG_LEVEL_INFO;
         }
     }
 
+    regSetCacheCapacity(conf.regexCacheSize);
+
     if(enable_cache)
     {
-        global.cacheSubscription = cache_subscription;
-        global.cacheConfig = cache_config;
-        global.cacheRuleset = cache_ruleset;
+        conf.cacheSubscription = cache_subscription;
+        conf.cacheConfig = cache_config;
+        conf.cacheRuleset = cache_ruleset;
     }
     else
     {
-        global.cacheSubscription = global.cacheConfig = global.cacheRuleset = 0;
+        conf.cacheSubscription = conf.cacheConfig = conf.cacheRuleset = 0;
     }
 
     writeLog(0, "Load preference settings in TOML format completed.", LOG_LEVEL_INFO);
 }
 
-void readConf()
+static void loadConf(Settings &conf)
 {
-    guarded_mutex guard(gMutexConfigure);
     writeLog(0, "Loading preference settings...", LOG_LEVEL_INFO);
 
-    eraseElements(global.excludeRemarks);
-    eraseElements(global.includeRemarks);
-    eraseElements(global.customProxyGroups);
-    eraseElements(global.customRulesets);
+    eraseElements(conf.excludeRemarks);
+    eraseElements(conf.includeRemarks);
+    eraseElements(conf.customProxyGroups);
+    eraseElements(conf.customRulesets);
 
     try
     {
-        std::string prefdata = fileGet(global.prefPath, false);
+        std::string prefdata = fileGet(conf.prefPath, false);
         if(prefdata.find("common:") != std::string::npos)
         {
             YAML::Node yaml = YAML::Load(prefdata);
             if(yaml.size() && yaml["common"])
-                return readYAMLConf(yaml);
+                return readYAMLConf(yaml, conf);
         }
-        toml::value conf = parseToml(prefdata, global.prefPath);
-        if(!conf.is_empty() && toml::find_or<int>(conf, "version", 0))
-            return readTOMLConf(conf);
+        toml::value root = parseToml(prefdata, conf.prefPath);
+        if(!root.is_empty() && toml::find_or<int>(root, "version", 0))
+            return readTOMLConf(root, conf);
     }
     catch (YAML::Exception &e)
     {
@@ -822,7 +849,7 @@ void readConf()
     INIReader ini;
     ini.allow_dup_section_titles = true;
     //ini.do_utf8_to_gbk = true;
-    int retVal = ini.parse_file(global.prefPath);
+    int retVal = ini.parse_file(conf.prefPath);
     if(retVal != INIREADER_EXCEPTION_NONE)
     {
         writeLog(0, "Unable to load preference settings as INI. Reason: " + ini.get_last_error(), LOG_LEVEL_FATAL);
@@ -832,39 +859,39 @@ void readConf()
     string_array tempArray;
 
     ini.enter_section("common");
-    ini.get_bool_if_exist("api_mode", global.APIMode);
-    ini.get_if_exist("api_access_token", global.accessToken);
-    ini.get_if_exist("default_url", global.defaultUrls);
-    global.enableInsert = ini.get("enable_insert");
-    ini.get_if_exist("insert_url", global.insertUrls);
-    ini.get_bool_if_exist("prepend_insert_url", global.prependInsert);
+    ini.get_bool_if_exist("api_mode", conf.APIMode);
+    ini.get_if_exist("api_access_token", conf.accessToken);
+    ini.get_if_exist("default_url", conf.defaultUrls);
+    conf.enableInsert = ini.get("enable_insert");
+    ini.get_if_exist("insert_url", conf.insertUrls);
+    ini.get_bool_if_exist("prepend_insert_url", conf.prependInsert);
     if(ini.item_prefix_exist("exclude_remarks"))
-        ini.get_all("exclude_remarks", global.excludeRemarks);
+        ini.get_all("exclude_remarks", conf.excludeRemarks);
     if(ini.item_prefix_exist("include_remarks"))
-        ini.get_all("include_remarks", global.includeRemarks);
-    global.filterScript = ini.get_bool("enable_filter") ? ini.get("filter_script") : "";
-    ini.get_if_exist("base_path", global.basePath);
-    ini.get_if_exist("clash_rule_base", global.clashBase);
-    ini.get_if_exist("surge_rule_base", global.surgeBase);
-    ini.get_if_exist("surfboard_rule_base", global.surfboardBase);
-    ini.get_if_exist("mellow_rule_base", global.mellowBase);
-    ini.get_if_exist("quan_rule_base", global.quanBase);
-    ini.get_if_exist("quanx_rule_base", global.quanXBase);
-    ini.get_if_exist("loon_rule_base", global.loonBase);
-    ini.get_if_exist("sssub_rule_base", global.SSSubBase);
-    ini.get_if_exist("singbox_rule_base", global.singBoxBase);
-    ini.get_if_exist("default_external_config", global.defaultExtConfig);
-    ini.get_bool_if_exist("append_proxy_type", global.appendType);
-    ini.get_if_exist("proxy_config", global.proxyConfig);
-    ini.get_if_exist("proxy_ruleset", global.proxyRuleset);
-    ini.get_if_exist("proxy_subscription", global.proxySubscription);
-    ini.get_bool_if_exist("reload_conf_on_request", global.reloadConfOnRequest);
+        ini.get_all("include_remarks", conf.includeRemarks);
+    conf.filterScript = ini.get_bool("enable_filter") ? ini.get("filter_script") : "";
+    ini.get_if_exist("base_path", conf.basePath);
+    ini.get_if_exist("clash_rule_base", conf.clashBase);
+    ini.get_if_exist("surge_rule_base", conf.surgeBase);
+    ini.get_if_exist("surfboard_rule_base", conf.surfboardBase);
+    ini.get_if_exist("mellow_rule_base", conf.mellowBase);
+    ini.get_if_exist("quan_rule_base", conf.quanBase);
+    ini.get_if_exist("quanx_rule_base", conf.quanXBase);
+    ini.get_if_exist("loon_rule_base", conf.loonBase);
+    ini.get_if_exist("sssub_rule_base", conf.SSSubBase);
+    ini.get_if_exist("singbox_rule_base", conf.singBoxBase);
+    ini.get_if_exist("default_external_config", conf.defaultExtConfig);
+    ini.get_bool_if_exist("append_proxy_type", conf.appendType);
+    ini.get_if_exist("proxy_config", conf.proxyConfig);
+    ini.get_if_exist("proxy_ruleset", conf.proxyRuleset);
+    ini.get_if_exist("proxy_subscription", conf.proxySubscription);
+    ini.get_bool_if_exist("reload_conf_on_request", conf.reloadConfOnRequest);
 
     if(ini.section_exist("surge_external_proxy"))
     {
         ini.enter_section("surge_external_proxy");
-        ini.get_if_exist("surge_ssr_path", global.surgeSSRPath);
-        ini.get_bool_if_exist("resolve_hostname", global.surgeResolveHostname);
+        ini.get_if_exist("surge_ssr_path", conf.surgeSSRPath);
+        ini.get_bool_if_exist("resolve_hostname", conf.surgeResolveHostname);
     }
 
     if(ini.section_exist("node_pref"))
@@ -875,24 +902,24 @@ void readConf()
         ini.get_bool_if_exist("tcp_fast_open_flag", tfo_flag);
         ini.get_bool_if_exist("skip_cert_verify_flag", scv_flag);
         */
-        global.UDPFlag.set(ini.get("udp_flag"));
-        global.TFOFlag.set(ini.get("tcp_fast_open_flag"));
-        global.skipCertVerify.set(ini.get("skip_cert_verify_flag"));
-        global.TLS13Flag.set(ini.get("tls13_flag"));
-        ini.get_bool_if_exist("sort_flag", global.enableSort);
-        global.sortScript = ini.get("sort_script");
-        ini.get_bool_if_exist("filter_deprecated_nodes", global.filterDeprecated);
-        ini.get_bool_if_exist("append_sub_userinfo", global.appendUserinfo);
-        ini.get_bool_if_exist("clash_use_new_field_name", global.clashUseNewField);
-        ini.get_if_exist("clash_proxies_style", global.clashProxiesStyle);
-        ini.get_if_exist("clash_proxy_groups_style", global.clashProxyGroupsStyle);
-        ini.get_bool_if_exist("singbox_add_clash_modes", global.singBoxAddClashModes);
+        conf.UDPFlag.set(ini.get("udp_flag"));
+        conf.TFOFlag.set(ini.get("tcp_fast_open_flag"));
+        conf.skipCertVerify.set(ini.get("skip_cert_verify_flag"));
+        conf.TLS13Flag.set(ini.get("tls13_flag"));
+        ini.get_bool_if_exist("sort_flag", conf.enableSort);
+        conf.sortScript = ini.get("sort_script");
+        ini.get_bool_if_exist("filter_deprecated_nodes", conf.filterDeprecated);
+        ini.get_bool_if_exist("append_sub_userinfo", conf.appendUserinfo);
+        ini.get_bool_if_exist("clash_use_new_field_name", conf.clashUseNewField);
+        ini.get_if_exist("clash_proxies_style", conf.clashProxiesStyle);
+        ini.get_if_exist("clash_proxy_groups_style", conf.clashProxyGroupsStyle);
+        ini.get_bool_if_exist("singbox_add_clash_modes", conf.singBoxAddClashModes);
         if(ini.item_prefix_exist("rename_node"))
         {
             ini.get_all("rename_node", tempArray);
             importItems(tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "@");
-            safe_set_renames(configs);
+            conf.renames = configs;
             eraseElements(tempArray);
         }
     }
@@ -905,7 +932,7 @@ void readConf()
             ini.get_all("stream_rule", tempArray);
             importItems(tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "|");
-            safe_set_streams(configs);
+            conf.streamNodeRules = configs;
             eraseElements(tempArray);
         }
         if(ini.item_prefix_exist("time_rule"))
@@ -913,27 +940,27 @@ void readConf()
             ini.get_all("time_rule", tempArray);
             importItems(tempArray, false);
             auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, "|");
-            safe_set_times(configs);
+            conf.timeNodeRules = configs;
             eraseElements(tempArray);
         }
     }
 
     ini.enter_section("managed_config");
-    ini.get_bool_if_exist("write_managed_config", global.writeManagedConfig);
-    ini.get_if_exist("managed_config_prefix", global.managedConfigPrefix);
-    ini.get_int_if_exist("config_update_interval", global.updateInterval);
-    ini.get_bool_if_exist("config_update_strict", global.updateStrict);
-    ini.get_if_exist("quanx_device_id", global.quanXDevID);
+    ini.get_bool_if_exist("write_managed_config", conf.writeManagedConfig);
+    ini.get_if_exist("managed_config_prefix", conf.managedConfigPrefix);
+    ini.get_int_if_exist("config_update_interval", conf.updateInterval);
+    ini.get_bool_if_exist("config_update_strict", conf.updateStrict);
+    ini.get_if_exist("quanx_device_id", conf.quanXDevID);
 
     ini.enter_section("emojis");
-    ini.get_bool_if_exist("add_emoji", global.addEmoji);
-    ini.get_bool_if_exist("remove_old_emoji", global.removeEmoji);
+    ini.get_bool_if_exist("add_emoji", conf.addEmoji);
+    ini.get_bool_if_exist("remove_old_emoji", conf.removeEmoji);
     if(ini.item_prefix_exist("rule"))
     {
         ini.get_all("rule", tempArray);
         importItems(tempArray, false);
         auto configs = INIBinding::from<RegexMatchConfig>::from_ini(tempArray, ",");
-        safe_set_emojis(configs);
+        conf.emojis = configs;
         eraseElements(tempArray);
     }
 
@@ -941,30 +968,30 @@ void readConf()
         ini.enter_section("rulesets");
     else
         ini.enter_section("ruleset");
-    global.enableRuleGen = ini.get_bool("enabled");
-    if(global.enableRuleGen)
+    conf.enableRuleGen = ini.get_bool("enabled");
+    if(conf.enableRuleGen)
     {
-        ini.get_bool_if_exist("overwrite_original_rules", global.overwriteOriginalRules);
-        ini.get_bool_if_exist("update_ruleset_on_request", global.updateRulesetOnRequest);
+        ini.get_bool_if_exist("overwrite_original_rules", conf.overwriteOriginalRules);
+        ini.get_bool_if_exist("update_ruleset_on_request", conf.updateRulesetOnRequest);
         if(ini.item_prefix_exist("ruleset"))
         {
             string_array vArray;
             ini.get_all("ruleset", vArray);
             importItems(vArray, false);
-            global.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
+            conf.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
         }
         else if(ini.item_prefix_exist("surge_ruleset"))
         {
             string_array vArray;
             ini.get_all("surge_ruleset", vArray);
             importItems(vArray, false);
-            global.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
+            conf.customRulesets = INIBinding::from<RulesetConfig>::from_ini(vArray);
         }
     }
     else
     {
-        global.overwriteOriginalRules = false;
-        global.updateRulesetOnRequest = false;
+        conf.overwriteOriginalRules = false;
+        conf.updateRulesetOnRequest = false;
     }
 
     if(ini.section_exist("proxy_groups"))
@@ -976,21 +1003,21 @@ void readConf()
         string_array vArray;
         ini.get_all("custom_proxy_group", vArray);
         importItems(vArray, false);
-        global.customProxyGroups = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
+        conf.customProxyGroups = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
     }
 
     ini.enter_section("template");
-    ini.get_if_exist("template_path", global.templatePath);
+    ini.get_if_exist("template_path", conf.templatePath);
     string_multimap tempmap;
     ini.get_items(tempmap);
-    eraseElements(global.templateVars);
+    eraseElements(conf.templateVars);
     for(auto &x : tempmap)
     {
         if(x.first == "template_path")
             continue;
-        global.templateVars[x.first] = x.second;
+        conf.templateVars[x.first] = x.second;
     }
-    global.templateVars["managed_config_prefix"] = global.managedConfigPrefix;
+    conf.templateVars["managed_config_prefix"] = conf.managedConfigPrefix;
 
     if(ini.section_exist("aliases"))
     {
@@ -1007,73 +1034,101 @@ void readConf()
         ini.enter_section("tasks");
         ini.get_all("task", vArray);
         importItems(vArray, false);
-        global.enableCron = !vArray.empty();
-        global.cronTasks = INIBinding::from<CronTaskConfig>::from_ini(vArray);
+        conf.enableCron = !vArray.empty();
+        conf.cronTasks = INIBinding::from<CronTaskConfig>::from_ini(vArray);
         refresh_schedule();
     }
 
     ini.enter_section("server");
-    ini.get_if_exist("listen", global.listenAddress);
-    ini.get_int_if_exist("port", global.listenPort);
-    webServer.serve_file_root = ini.get("serve_file_root");
-    webServer.serve_file = !webServer.serve_file_root.empty();
+    ini.get_if_exist("listen", conf.listenAddress);
+    ini.get_int_if_exist("port", conf.listenPort);
+    conf.serveFileRoot = ini.get("serve_file_root");
+    ini.get_int_if_exist("compress_level", conf.compressLevel);
+    ini.get_number_if_exist("compress_min_size", conf.compressMinSize);
+    ini.get_number_if_exist("compress_cache_size", conf.compressCacheSize);
 
     ini.enter_section("advanced");
     std::string log_level;
     ini.get_if_exist("log_level", log_level);
-    ini.get_bool_if_exist("print_debug_info", global.printDbgInfo);
-    if(global.printDbgInfo)
-        global.logLevel = LOG_LEVEL_VERBOSE;
+    ini.get_bool_if_exist("print_debug_info", conf.printDbgInfo);
+    if(conf.printDbgInfo)
+        conf.logLevel = LOG_LEVEL_VERBOSE;
     else
     {
         switch(hash_(log_level))
         {
         case "warn"_hash:
-            global.logLevel = LOG_LEVEL_WARNING;
+            conf.logLevel = LOG_LEVEL_WARNING;
             break;
         case "error"_hash:
-            global.logLevel = LOG_LEVEL_ERROR;
+            conf.logLevel = LOG_LEVEL_ERROR;
             break;
         case "fatal"_hash:
-            global.logLevel = LOG_LEVEL_FATAL;
+            conf.logLevel = LOG_LEVEL_FATAL;
             break;
         case "verbose"_hash:
-            global.logLevel = LOG_LEVEL_VERBOSE;
+            conf.logLevel = LOG_LEVEL_VERBOSE;
             break;
         case "debug"_hash:
-            global.logLevel = LOG_LEVEL_DEBUG;
+            conf.logLevel = LOG_LEVEL_DEBUG;
             break;
         default:
-            global.logLevel = LOG_LEVEL_INFO;
+            conf.logLevel = LOG_LEVEL_INFO;
         }
     }
-    ini.get_int_if_exist("max_pending_connections", global.maxPendingConns);
-    ini.get_int_if_exist("max_concurrent_threads", global.maxConcurThreads);
-    ini.get_number_if_exist("max_allowed_rulesets", global.maxAllowedRulesets);
-    ini.get_number_if_exist("max_allowed_rules", global.maxAllowedRules);
-    ini.get_number_if_exist("max_allowed_download_size", global.maxAllowedDownloadSize);
+    ini.get_int_if_exist("max_pending_connections", conf.maxPendingConns);
+    ini.get_int_if_exist("max_concurrent_threads", conf.maxConcurThreads);
+    ini.get_number_if_exist("max_allowed_rulesets", conf.maxAllowedRulesets);
+    ini.get_number_if_exist("max_allowed_rules", conf.maxAllowedRules);
+    ini.get_number_if_exist("max_allowed_download_size", conf.maxAllowedDownloadSize);
+    ini.get_number_if_exist("regex_cache_size", conf.regexCacheSize);
+    regSetCacheCapacity(conf.regexCacheSize);
+    ini.get_number_if_exist("memory_cache_size", conf.memoryCacheSize);
+    ini.get_number_if_exist("response_cache_size", conf.responseCacheSize);
+    ini.get_number_if_exist("rule_cache_size", conf.ruleCacheSize);
+    ini.get_number_if_exist("curl_pool_size", conf.curlPoolSize);
+    ini.get_int_if_exist("curl_pool_idle_timeout", conf.curlPoolIdleTimeout);
+    ini.get_number_if_exist("max_parallel_fetches", conf.maxParallelFetches);
+    ini.get_number_if_exist("max_host_fetches", conf.maxHostFetches);
+    ini.get_number_if_exist("executor_threads", conf.executorThreads);
+    ini.get_bool_if_exist("stream_output", conf.streamOutput);
     if(ini.item_exist("enable_cache"))
     {
         if(ini.get_bool("enable_cache"))
         {
-            ini.get_int_if_exist("cache_subscription", global.cacheSubscription);
-            ini.get_int_if_exist("cache_config", global.cacheConfig);
-            ini.get_int_if_exist("cache_ruleset", global.cacheRuleset);
-            ini.get_bool_if_exist("serve_cache_on_fetch_fail", global.serveCacheOnFetchFail);
+            ini.get_int_if_exist("cache_subscription", conf.cacheSubscription);
+            ini.get_int_if_exist("cache_config", conf.cacheConfig);
+            ini.get_int_if_exist("cache_ruleset", conf.cacheRuleset);
+            ini.get_bool_if_exist("serve_cache_on_fetch_fail", conf.serveCacheOnFetchFail);
         }
         else
         {
-            global.cacheSubscription = global.cacheConfig = global.cacheRuleset = 0; //disable cache
-            global.serveCacheOnFetchFail = false;
+            conf.cacheSubscription = conf.cacheConfig = conf.cacheRuleset = 0; //disable cache
+            conf.serveCacheOnFetchFail = false;
         }
     }
-    ini.get_bool_if_exist("script_clean_context", global.scriptCleanContext);
-    ini.get_bool_if_exist("async_fetch_ruleset", global.asyncFetchRuleset);
-    ini.get_bool_if_exist("skip_failed_links", global.skipFailedLinks);
+    ini.get_bool_if_exist("script_clean_context", conf.scriptCleanContext);
+    ini.get_bool_if_exist("async_fetch_ruleset", conf.asyncFetchRuleset);
+    ini.get_bool_if_exist("skip_failed_links", conf.skipFailedLinks);
 
     writeLog(0, "Load preference settings in INI format completed.", LOG_LEVEL_INFO);
 }
 
+void readConf()
+{
+    /// loads into a copy and swaps it in once complete, requests keep the settings they started with
+    global.update(loadConf);
+    flushResponseCache();
+}
+
+void refreshGlobalRulesets()
+{
+    global.update([](Settings &conf)
+    {
+        refreshRulesets(conf.customRulesets, conf.rulesetsContent);
+    });
+}
+
 int loadExternalYAML(YAML::Node &node, ExternalConfig &ext)
 {
     YAML::Node section = node["custom"], object;
@@ -1097,7 +1152,7 @@ int loadExternalYAML(YAML::Node &node, ExternalConfig &ext)
     if(section[group_name].size())
     {
         string_array vArray;
-        readGroup(section[group_name], vArray, global.APIMode);
+        readGroup(section[group_name], vArray, global->APIMode);
         ext.custom_proxy_group = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
     }
 
@@ -1105,8 +1160,8 @@ int loadExternalYAML(YAML::Node &node, ExternalConfig &ext)
     if(section[ruleset_name].size())
     {
         string_array vArray;
-        readRuleset(section[ruleset_name], vArray, global.APIMode);
-        if(global.maxAllowedRulesets && vArray.size() > global.maxAllowedRulesets)
+        readRuleset(section[ruleset_name], vArray, global->APIMode);
+        if(global->maxAllowedRulesets && vArray.size() > global->maxAllowedRulesets)
         {
             writeLog(0, "Ruleset count in external config has exceeded limit.", LOG_LEVEL_WARNING);
             return -1;
@@ -1117,7 +1172,7 @@ int loadExternalYAML(YAML::Node &node, ExternalConfig &ext)
     if(section["rename_node"].size())
     {
         string_array vArray;
-        readRegexMatch(section["rename_node"], "@", vArray, global.APIMode);
+        readRegexMatch(section["rename_node"], "@", vArray, global->APIMode);
         ext.rename = INIBinding::from<RegexMatchConfig>::from_ini(vArray, "@");
     }
 
@@ -1127,7 +1182,7 @@ int loadExternalYAML(YAML::Node &node, ExternalConfig &ext)
     if(section[emoji_name].size())
     {
         string_array vArray;
-        readEmoji(section[emoji_name], vArray, global.APIMode);
+        readEmoji(section[emoji_name], vArray, global->APIMode);
         ext.emoji = INIBinding::from<RegexMatchConfig>::from_ini(vArray, ",");
     }
 
@@ -1183,7 +1238,7 @@ int loadExternalTOML(toml::value &root, ExternalConfig &ext)
 
     auto rulesets = toml::find_or<std::vector<toml::value>>(root, "rulesets", {});
     importItems(rulesets, "rulesets", false);
-    if(global.maxAllowedRulesets && rulesets.size() > global.maxAllowedRulesets)
+    if(global->maxAllowedRulesets && rulesets.size() > global->maxAllowedRulesets)
     {
         writeLog(0, "Ruleset count in external config has exceeded limit. ", LOG_LEVEL_WARNING);
         return -1;
@@ -1203,8 +1258,8 @@ int loadExternalTOML(toml::value &root, ExternalConfig &ext)
 
 int loadExternalConfig(std::string &path, ExternalConfig &ext)
 {
-    std::string base_content, proxy = parseProxy(global.proxyConfig), config = fetchFile(path, proxy, global.cacheConfig);
-    if(render_template(config, *ext.tpl_args, base_content, global.templatePath) != 0)
+    std::string base_content, proxy = parseProxy(global->proxyConfig), config = fetchFile(path, proxy, global->cacheConfig);
+    if(render_template(config, *ext.tpl_args, base_content, global->templatePath) != 0)
         base_content = config;
 
     try
@@ -1240,7 +1295,7 @@ int loadExternalConfig(std::string &path, ExternalConfig &ext)
     {
         string_array vArray;
         ini.get_all("custom_proxy_group", vArray);
-        importItems(vArray, global.APIMode);
+        importItems(vArray, global->APIMode);
         ext.custom_proxy_group = INIBinding::from<ProxyGroupConfig>::from_ini(vArray);
     }
     std::string ruleset_name = ini.item_prefix_exist("ruleset") ? "ruleset" : "surge_ruleset";
@@ -1248,8 +1303,8 @@ int loadExternalConfig(std::string &path, ExternalConfig &ext)
     {
         string_array vArray;
         ini.get_all(ruleset_name, vArray);
-        importItems(vArray, global.APIMode);
-        if(global.maxAllowedRulesets && vArray.size() > global.maxAllowedRulesets)
+        importItems(vArray, global->APIMode);
+        if(global->maxAllowedRulesets && vArray.size() > global->maxAllowedRulesets)
         {
             writeLog(0, "Ruleset count in external config has exceeded limit. ", LOG_LEVEL_WARNING);
             return -1;
@@ -1274,7 +1329,7 @@ int loadExternalConfig(std::string &path, ExternalConfig &ext)
     {
         string_array vArray;
         ini.get_all("rename", vArray);
-        importItems(vArray, global.APIMode);
+        importItems(vArray, global->APIMode);
         ext.rename = INIBinding::from<RegexMatchConfig>::from_ini(vArray, "@");
     }
     ext.add_emoji = ini.get("add_emoji");
@@ -1283,7 +1338,7 @@ int loadExternalConfig(std::string &path, ExternalConfig &ext)
     {
         string_array vArray;
         ini.get_all("emoji", vArray);
-        importItems(vArray, global.APIMode);
+        importItems(vArray, global->APIMode);
         ext.emoji = INIBinding::from<RegexMatchConfig>::from_ini(vArray, ",");
     }
     if(ini.item_prefix_exist("include_remarks"))
@@ -2,6 +2,10 @@
 #define SETTINGS_H_INCLUDED
 
 #include <string>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
 
 #include "config/crontask.h"
 #include "config/regmatch.h"
@@ -61,9 +65,27 @@ struct Settings
     //cache system
     bool serveCacheOnFetchFail = false;
     int cacheSubscription = 60, cacheConfig = 300, cacheRuleset = 21600;
+    size_t memoryCacheSize = 16777216, responseCacheSize = 0, ruleCacheSize = 16777216;
+
+    //connection pool
+    size_t curlPoolSize = 8;
+    int curlPoolIdleTimeout = 60;
+    size_t maxParallelFetches = 16, maxHostFetches = 4;
+
+    //task executor
+    size_t executorThreads = 0;
+
+    //response output
+    bool streamOutput = false;
+
+    //web server, the file root is only read when the server starts, compression level 0 disables compression
+    std::string serveFileRoot;
+    int compressLevel = 6;
+    size_t compressMinSize = 1024, compressCacheSize = 4194304;
 
     //limits
     size_t maxAllowedRulesets = 64, maxAllowedRules = 32768;
+    size_t regexCacheSize = 1024;
     bool scriptCleanContext = false;
 
     //cron system
@@ -96,7 +118,88 @@ struct ExternalConfig
     tribool remove_old_emoji;
 };
 
-extern Settings global;
+using SettingsPtr = std::shared_ptr<const Settings>;
+
+/// the snapshot pinned on this thread, null when nothing is pinned
+inline SettingsPtr &settingsPinned()
+{
+    thread_local SettingsPtr pinned;
+    return pinned;
+}
+
+/// pins a snapshot on this thread for its own lifetime, so everything a request reads comes from the same settings
+class SettingsScope
+{
+public:
+    explicit SettingsScope(SettingsPtr settings) : previous(std::move(settingsPinned())) { settingsPinned() = std::move(settings); }
+    ~SettingsScope() { settingsPinned() = std::move(previous); }
+    SettingsScope(const SettingsScope&) = delete;
+    SettingsScope& operator=(const SettingsScope&) = delete;
+
+private:
+    SettingsPtr previous;
+};
+
+/// settings are never changed in place, a reload builds a new copy and swaps it in as a whole,
+/// readers only ever take a reference to a snapshot and never wait for a reload to finish
+class SettingsHandle
+{
+public:
+    SettingsHandle() : settings(std::make_shared<Settings>()) {}
+    SettingsHandle(const SettingsHandle&) = delete;
+    SettingsHandle& operator=(const SettingsHandle&) = delete;
+
+    const Settings *operator->() const { return &get(); }
+    const Settings &operator*() const { return get(); }
+
+    /// the pinned snapshot, or the latest one when nothing is pinned. an unpinned thread keeps its snapshot
+    /// until a newer one is published, so do not hold on to references across calls outside of a SettingsScope
+    const Settings &get() const
+    {
+        const SettingsPtr &pinned = settingsPinned();
+        if(pinned)
+            return *pinned;
+        thread_local SettingsPtr cached;
+        thread_local uint64_t cached_version = 0;
+        uint64_t current_version = version.load(std::memory_order_acquire);
+        if(cached_version != current_version)
+        {
+            cached = latest();
+            cached_version = current_version;
+        }
+        return *cached;
+    }
+
+    /// the snapshot this thread is working with, to be pinned again on other threads working for it
+    SettingsPtr current() const
+    {
+        const SettingsPtr &pinned = settingsPinned();
+        return pinned ? pinned : latest();
+    }
+
+    SettingsPtr latest() const { return std::atomic_load(&settings); }
+
+    /// copies the latest settings, lets func change the copy and publishes it, the copy is pinned on this thread
+    /// while func runs so that anything it calls reads the new values. updates run one at a time, do not nest them
+    void update(const std::function<void(Settings&)> &func)
+    {
+        std::lock_guard<std::mutex> guard(write_lock);
+        auto draft = std::make_shared<Settings>(*latest());
+        {
+            SettingsScope scope(draft);
+            func(*draft);
+        }
+        std::atomic_store(&settings, SettingsPtr(std::move(draft)));
+        version.fetch_add(1, std::memory_order_release);
+    }
+
+private:
+    SettingsPtr settings;
+    std::atomic<uint64_t> version {1};
+    std::mutex write_lock;
+};
+
+extern SettingsHandle global;
 
 int importItems(string_array &target, bool scope_limit = true);
 int loadExternalConfig(std::string &path, ExternalConfig &ext);
@@ -1,9 +1,15 @@
 #include <iostream>
 #include <unistd.h>
 #include <sys/stat.h>
-//#include <mutex>
+#include <utime.h>
+#include <mutex>
 #include <thread>
 #include <atomic>
+#include <list>
+#include <unordered_map>
+#include <future>
+#include <vector>
+#include <algorithm>
 
 #include <curl/curl.h>
 
@@ -13,6 +19,7 @@
 #include "utils/file_extra.h"
 #include "utils/lock.h"
 #include "utils/logger.h"
+#include "utils/metrics.h"
 #include "utils/urlencode.h"
 #include "version.h"
 #include "webget.h"
@@ -23,12 +30,103 @@
 #endif // _stat
 #endif // _WIN32
 
-/*
-using guarded_mutex = std::lock_guard<std::mutex>;
-std::mutex cache_rw_lock;
-*/
+/// guards the files under cache/, one stripe per url hash so fetches of unrelated urls never wait on each other
+static StripedRWLock<64> cache_locks;
 
-RWLock cache_rw_lock;
+/// in-memory tier in front of the cache/ directory, bounded by global->memoryCacheSize bytes
+struct MemoryCacheEntry
+{
+    std::string url;
+    std::string content;
+    std::string headers;
+    bool has_headers = false;
+    time_t fetch_time = 0;
+};
+
+struct MemoryCache
+{
+    std::mutex lock;
+    std::list<MemoryCacheEntry> lru;
+    std::unordered_map<std::string_view, std::list<MemoryCacheEntry>::iterator> index;
+    size_t size = 0;
+};
+
+static MemoryCache memory_cache;
+
+static size_t memoryCacheEntrySize(const MemoryCacheEntry &entry)
+{
+    return entry.url.size() + entry.content.size() + entry.headers.size();
+}
+
+static void memoryCacheEvict(size_t budget)
+{
+    while(memory_cache.size > budget && !memory_cache.lru.empty())
+    {
+        auto &entry = memory_cache.lru.back();
+        memory_cache.size -= memoryCacheEntrySize(entry);
+        memory_cache.index.erase(entry.url);
+        memory_cache.lru.pop_back();
+    }
+}
+
+/// max_age < 0 accepts stale entries, used when serving cache on fetch failure
+static bool memoryCacheGet(const std::string &url, int max_age, std::string &content, std::string *response_headers)
+{
+    std::lock_guard<std::mutex> guard(memory_cache.lock);
+    auto iter = memory_cache.index.find(url);
+    if(iter == memory_cache.index.end())
+        return false;
+    auto &entry = *iter->second;
+    if(max_age >= 0 && difftime(time(nullptr), entry.fetch_time) > max_age)
+        return false;
+    if(response_headers && !entry.has_headers)
+        return false;
+    memory_cache.lru.splice(memory_cache.lru.begin(), memory_cache.lru, iter->second);
+    content = entry.content;
+    if(response_headers)
+        *response_headers = entry.headers;
+    return true;
+}
+
+static void memoryCachePut(const std::string &url, const std::string &content, const std::string *response_headers, time_t fetch_time)
+{
+    size_t budget = global->memoryCacheSize;
+    MemoryCacheEntry entry {url, content, response_headers ? *response_headers : "", response_headers != nullptr, fetch_time};
+    size_t entry_size = memoryCacheEntrySize(entry);
+    std::lock_guard<std::mutex> guard(memory_cache.lock);
+    auto iter = memory_cache.index.find(url);
+    if(iter != memory_cache.index.end())
+    {
+        memory_cache.size -= memoryCacheEntrySize(*iter->second);
+        memory_cache.lru.erase(iter->second);
+        memory_cache.index.erase(iter);
+    }
+    if(entry_size > budget) /// too large to be kept, also covers a disabled memory cache
+    {
+        memoryCacheEvict(budget);
+        return;
+    }
+    memoryCacheEvict(budget - entry_size);
+    memory_cache.lru.emplace_front(std::move(entry));
+    memory_cache.index.emplace(memory_cache.lru.front().url, memory_cache.lru.begin());
+    memory_cache.size += entry_size;
+}
+
+static void memoryCacheTouch(const std::string &url, time_t fetch_time)
+{
+    std::lock_guard<std::mutex> guard(memory_cache.lock);
+    auto iter = memory_cache.index.find(url);
+    if(iter != memory_cache.index.end())
+        iter->second->fetch_time = fetch_time;
+}
+
+static void memoryCacheClear()
+{
+    std::lock_guard<std::mutex> guard(memory_cache.lock);
+    memory_cache.index.clear();
+    memory_cache.lru.clear();
+    memory_cache.size = 0;
+}
 
 //std::string user_agent_str = "Mozilla/5.0 (Windows NT 10.0; Win64; x64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/74.0.3729.169 Safari/537.36";
 static auto user_agent_str = "subconverter/" VERSION " cURL/" LIBCURL_VERSION;
@@ -38,6 +136,13 @@ struct curl_progress_data
     long size_limit = 0L;
 };
 
+/// body sink for content decoded by curl, so the size limit applies to what ends up in memory
+struct curl_write_data
+{
+    std::string *content = nullptr;
+    long size_limit = 0L;
+};
+
 static inline void curl_init()
 {
     static bool init = false;
@@ -48,6 +153,86 @@ static inline void curl_init()
     }
 }
 
+/// idle easy handles are kept for reuse, they share DNS, connection and TLS session caches
+struct CurlHandlePool
+{
+    std::mutex lock;
+    std::vector<std::pair<CURL*, time_t>> idle;
+};
+
+static CurlHandlePool curl_pool;
+static std::mutex curl_share_locks[CURL_LOCK_DATA_LAST];
+
+static void curl_share_lock(CURL *, curl_lock_data data, curl_lock_access, void *)
+{
+    curl_share_locks[data].lock();
+}
+
+static void curl_share_unlock(CURL *, curl_lock_data data, void *)
+{
+    curl_share_locks[data].unlock();
+}
+
+static CURLSH *curl_get_share()
+{
+    static CURLSH *share = []()
+    {
+        CURLSH *handle = curl_share_init();
+        curl_share_setopt(handle, CURLSHOPT_LOCKFUNC, curl_share_lock);
+        curl_share_setopt(handle, CURLSHOPT_UNLOCKFUNC, curl_share_unlock);
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+        return handle;
+    }();
+    return share;
+}
+
+static CURL *curl_acquire_handle()
+{
+    CURL *handle = nullptr;
+    time_t now = time(nullptr);
+    {
+        std::lock_guard<std::mutex> guard(curl_pool.lock);
+        /// handles are returned to the back, so expired ones are at the front
+        auto fresh = std::find_if(curl_pool.idle.begin(), curl_pool.idle.end(), [now](const std::pair<CURL*, time_t> &x)
+        {
+            return difftime(now, x.second) <= global->curlPoolIdleTimeout;
+        });
+        std::for_each(curl_pool.idle.begin(), fresh, [](const std::pair<CURL*, time_t> &x){ curl_easy_cleanup(x.first); });
+        curl_pool.idle.erase(curl_pool.idle.begin(), fresh);
+        if(!curl_pool.idle.empty())
+        {
+            handle = curl_pool.idle.back().first;
+            curl_pool.idle.pop_back();
+        }
+    }
+    if(!handle)
+    {
+        handle = curl_easy_init();
+        curl_easy_setopt(handle, CURLOPT_SHARE, curl_get_share());
+    }
+    return handle;
+}
+
+static void curl_release_handle(CURL *handle)
+{
+    /// cookies and options must not leak into the next request, live connections are kept
+    curl_easy_setopt(handle, CURLOPT_COOKIELIST, "ALL");
+    curl_easy_reset(handle);
+    {
+        std::lock_guard<std::mutex> guard(curl_pool.lock);
+        if(curl_pool.idle.size() < global->curlPoolSize)
+        {
+            curl_pool.idle.emplace_back(handle, time(nullptr));
+            return;
+        }
+    }
+    curl_easy_cleanup(handle);
+}
+
 static int writer(char *data, size_t size, size_t nmemb, std::string *writerData)
 {
     if(writerData == nullptr)
@@ -58,6 +243,18 @@ static int writer(char *data, size_t size, size_t nmemb, std::string *writerData
     return static_cast<int>(size * nmemb);
 }
 
+static int limited_writer(char *data, size_t size, size_t nmemb, curl_write_data *writerData)
+{
+    if(writerData == nullptr || writerData->content == nullptr)
+        return 0;
+
+    if(writerData->size_limit && writerData->content->size() + size * nmemb > static_cast<size_t>(writerData->size_limit))
+        return 0;
+    writerData->content->append(data, size*nmemb);
+
+    return static_cast<int>(size * nmemb);
+}
+
 static int dummy_writer(char *, size_t size, size_t nmemb, void *)
 {
     /// dummy writer, do not save anything
@@ -123,7 +320,7 @@ static int logger(CURL *handle, curl_infotype type, char *data, size_t size, voi
 static inline void curl_set_common_options(CURL *curl_handle, const char *url, curl_progress_data *data)
 {
     curl_easy_setopt(curl_handle, CURLOPT_URL, url);
-    curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, global.logLevel == LOG_LEVEL_VERBOSE ? 1L : 0L);
+    curl_easy_setopt(curl_handle, CURLOPT_VERBOSE, global->logLevel == LOG_LEVEL_VERBOSE ? 1L : 0L);
     curl_easy_setopt(curl_handle, CURLOPT_DEBUGFUNCTION, logger);
     curl_easy_setopt(curl_handle, CURLOPT_NOPROGRESS, 0L);
     curl_easy_setopt(curl_handle, CURLOPT_NOSIGNAL, 1L);
@@ -133,6 +330,8 @@ static inline void curl_set_common_options(CURL *curl_handle, const char *url, c
     curl_easy_setopt(curl_handle, CURLOPT_SSL_VERIFYHOST, 0L);
     curl_easy_setopt(curl_handle, CURLOPT_TIMEOUT, 15L);
     curl_easy_setopt(curl_handle, CURLOPT_COOKIEFILE, "");
+    /// an empty string offers every encoding this libcurl can decode
+    curl_easy_setopt(curl_handle, CURLOPT_ACCEPT_ENCODING, "");
     if(data)
     {
         if(data->size_limit)
@@ -142,51 +341,57 @@ static inline void curl_set_common_options(CURL *curl_handle, const char *url, c
     }
 }
 
-//static std::string curlGet(const std::string &url, const std::string &proxy, std::string &response_headers, CURLcode &return_code, const string_map &request_headers)
-static int curlGet(const FetchArgument &argument, FetchResult &result)
+/// per-transfer state that has to outlive the option setup
+struct CurlTransfer
 {
-    CURL *curl_handle;
-    std::string *data = result.content, new_url = argument.url;
+    std::string url;
     curl_slist *header_list = nullptr;
-    defer(curl_slist_free_all(header_list);)
-    long retVal;
+    curl_progress_data limit;
+    curl_write_data body;
 
-    curl_init();
+    CurlTransfer() = default;
+    CurlTransfer(const CurlTransfer&) = delete;
+    CurlTransfer& operator=(const CurlTransfer&) = delete;
+    ~CurlTransfer() { curl_slist_free_all(header_list); }
+};
 
-    curl_handle = curl_easy_init();
+static void curl_prepare(CURL *curl_handle, const FetchArgument &argument, FetchResult &result, CurlTransfer &transfer)
+{
+    transfer.url = argument.url;
     if(!argument.proxy.empty())
     {
         if(startsWith(argument.proxy, "cors:"))
         {
-            header_list = curl_slist_append(header_list, "X-Requested-With: subconverter " VERSION);
-            new_url = argument.proxy.substr(5) + argument.url;
+            transfer.header_list = curl_slist_append(transfer.header_list, "X-Requested-With: subconverter " VERSION);
+            transfer.url = argument.proxy.substr(5) + argument.url;
         }
         else
             curl_easy_setopt(curl_handle, CURLOPT_PROXY, argument.proxy.data());
     }
-    curl_progress_data limit;
-    limit.size_limit = global.maxAllowedDownloadSize;
-    curl_set_common_options(curl_handle, new_url.data(), &limit);
-    header_list = curl_slist_append(header_list, "Content-Type: application/json;charset=utf-8");
+    transfer.limit.size_limit = global->maxAllowedDownloadSize;
+    curl_set_common_options(curl_handle, transfer.url.data(), &transfer.limit);
+    transfer.header_list = curl_slist_append(transfer.header_list, "Content-Type: application/json;charset=utf-8");
     if(argument.request_headers)
     {
         for(auto &x : *argument.request_headers)
         {
             auto header = x.first + ": " + x.second;
-            header_list = curl_slist_append(header_list, header.data());
+            transfer.header_list = curl_slist_append(transfer.header_list, header.data());
         }
-        if(!argument.request_headers->contains("User-Agent"))
+        if(argument.default_user_agent && !argument.request_headers->contains("User-Agent"))
             curl_easy_setopt(curl_handle, CURLOPT_USERAGENT, user_agent_str);
     }
-    header_list = curl_slist_append(header_list, "SubConverter-Request: 1");
-    header_list = curl_slist_append(header_list, "SubConverter-Version: " VERSION);
-    if(header_list)
-        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, header_list);
+    transfer.header_list = curl_slist_append(transfer.header_list, "SubConverter-Request: 1");
+    transfer.header_list = curl_slist_append(transfer.header_list, "SubConverter-Version: " VERSION);
+    if(transfer.header_list)
+        curl_easy_setopt(curl_handle, CURLOPT_HTTPHEADER, transfer.header_list);
 
     if(result.content)
     {
-        curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, writer);
-        curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, result.content);
+        transfer.body.content = result.content;
+        transfer.body.size_limit = global->maxAllowedDownloadSize;
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, limited_writer);
+        curl_easy_setopt(curl_handle, CURLOPT_WRITEDATA, &transfer.body);
     }
     else
         curl_easy_setopt(curl_handle, CURLOPT_WRITEFUNCTION, dummy_writer);
@@ -229,20 +434,14 @@ static int curlGet(const FetchArgument &argument, FetchResult &result)
     case HTTP_GET:
         break;
     }
+}
 
-    unsigned int fail_count = 0, max_fails = 1;
-    while(true)
-    {
-        retVal = curl_easy_perform(curl_handle);
-        if(retVal == CURLE_OK || max_fails <= fail_count || global.APIMode)
-            break;
-        else
-            fail_count++;
-    }
-
+static int curl_finish(CURL *curl_handle, CURLcode retVal, const FetchArgument &argument, FetchResult &result)
+{
     long code = 0;
     curl_easy_getinfo(curl_handle, CURLINFO_HTTP_CODE, &code);
     *result.status_code = code;
+    metricAdd(METRIC_UPSTREAM_TRANSFERS);
 
     if(result.cookies)
     {
@@ -261,18 +460,42 @@ static int curlGet(const FetchArgument &argument, FetchResult &result)
         curl_slist_free_all(cookies);
     }
 
-    curl_easy_cleanup(curl_handle);
+    curl_release_handle(curl_handle);
 
-    if(data && !argument.keep_resp_on_fail)
+    if(result.content && !argument.keep_resp_on_fail)
     {
         if(retVal != CURLE_OK || *result.status_code != 200)
-            data->clear();
-        data->shrink_to_fit();
+            result.content->clear();
+        result.content->shrink_to_fit();
     }
 
     return *result.status_code;
 }
 
+//static std::string curlGet(const std::string &url, const std::string &proxy, std::string &response_headers, CURLcode &return_code, const string_map &request_headers)
+static int curlGet(const FetchArgument &argument, FetchResult &result)
+{
+    CurlTransfer transfer;
+    CURLcode retVal;
+
+    curl_init();
+
+    CURL *curl_handle = curl_acquire_handle();
+    curl_prepare(curl_handle, argument, result, transfer);
+
+    unsigned int fail_count = 0, max_fails = 1;
+    while(true)
+    {
+        retVal = curl_easy_perform(curl_handle);
+        if(retVal == CURLE_OK || max_fails <= fail_count || global->APIMode)
+            break;
+        else
+            fail_count++;
+    }
+
+    return curl_finish(curl_handle, retVal, argument, result);
+}
+
 // data:[<mediatype>][;base64],<data>
 static std::string dataGet(const std::string &url)
 {
@@ -297,78 +520,443 @@ std::string buildSocks5ProxyString(const std::string &addr, int port, const std:
     return proxystr;
 }
 
-std::string webGet(const std::string &url, const std::string &proxy, unsigned int cache_ttl, std::string *response_headers, string_icase_map *request_headers)
+static std::string getCachePath(const std::string &url)
+{
+    md("cache");
+    return "cache/" + getMD5(url);
+}
+
+/// how the last cache lookup on this thread was answered, reported in request traces
+static thread_local const char *cache_result = "none";
+
+/// look for a cached copy within cache_ttl, memory first and then the cache directory
+static bool cacheLookup(const std::string &url, unsigned int cache_ttl, std::string &content, std::string *response_headers)
+{
+    if(memoryCacheGet(url, cache_ttl, content, response_headers)) // memory cache within TTL
+    {
+        writeLog(0, "CACHE HIT: '" + url + "', using memory cache.");
+        metricAdd(METRIC_CACHE_MEMORY_HIT);
+        cache_result = "memory_hit";
+        return true;
+    }
+    const std::string path = getCachePath(url), path_header = path + "_header";
+    struct stat result {};
+    if(stat(path.data(), &result) == 0) // cache exist
+    {
+        time_t mtime = result.st_mtime, now = time(nullptr); // get cache modified time and current time
+        if(difftime(now, mtime) <= cache_ttl) // within TTL
+        {
+            writeLog(0, "CACHE HIT: '" + url + "', using local cache.");
+            RWLock &lock = cache_locks[url];
+            lock.readLock();
+            defer(lock.readUnlock();)
+            if(response_headers)
+                *response_headers = fileGet(path_header, true);
+            content = fileGet(path, true);
+            memoryCachePut(url, content, response_headers, mtime);
+            metricAdd(METRIC_CACHE_DISK_HIT);
+            cache_result = "disk_hit";
+            return true;
+        }
+        writeLog(0, "CACHE MISS: '" + url + "', TTL timeout, creating new cache."); // out of TTL
+    }
+    else
+        writeLog(0, "CACHE NOT EXIST: '" + url + "', creating new cache.");
+    metricAdd(METRIC_CACHE_MISS);
+    cache_result = "miss";
+    return false;
+}
+
+static void cacheStore(const std::string &url, const std::string &content, const std::string *response_headers)
+{
+    const std::string path = getCachePath(url), path_header = path + "_header";
+    RWLock &lock = cache_locks[url];
+    lock.writeLock();
+    defer(lock.writeUnlock();)
+    fileWrite(path, content, true);
+    if(response_headers)
+        fileWrite(path_header, *response_headers, true);
+    memoryCachePut(url, content, response_headers, time(nullptr));
+}
+
+static void cacheFallback(const std::string &url, std::string &content, std::string *response_headers)
+{
+    const std::string path = getCachePath(url), path_header = path + "_header";
+    if(global->serveCacheOnFetchFail && memoryCacheGet(url, -1, content, response_headers))
+        writeLog(0, "Fetch failed. Serving cached content from memory.");
+    else if(fileExist(path) && global->serveCacheOnFetchFail) // failed, check if cache exist
+    {
+        writeLog(0, "Fetch failed. Serving cached content."); // cache exist, serving cache
+        RWLock &lock = cache_locks[url];
+        lock.readLock();
+        defer(lock.readUnlock();)
+        content = fileGet(path, true);
+        if(response_headers)
+            *response_headers = fileGet(path_header, true);
+    }
+    else
+        writeLog(0, "Fetch failed. No local cache available."); // cache not exist or not allow to serve cache, serving nothing
+}
+
+/// last value of a header in the captured response headers, later responses of a redirect chain win
+static std::string getHeaderValue(const std::string &headers, const std::string &name)
+{
+    std::string value;
+    string_array lines = split(headers, "\r\n");
+    for(std::string &x : lines)
+    {
+        if(x.size() > name.size() && x[name.size()] == ':' && toLower(x.substr(0, name.size())) == toLower(name))
+            value = trimWhitespace(x.substr(name.size() + 1), true, true);
+    }
+    return value;
+}
+
+/// copy request headers and add If-None-Match/If-Modified-Since from the cached response, if there is one.
+/// a fetch without request headers sends no User-Agent, so its revalidation must set default_user_agent to false
+static bool cacheConditionalHeaders(const std::string &url, const string_icase_map *request_headers, string_icase_map &conditional_headers)
+{
+    const std::string path = getCachePath(url), path_header = path + "_header";
+    if(!fileExist(path))
+        return false;
+    std::string headers;
+    {
+        RWLock &lock = cache_locks[url];
+        lock.readLock();
+        defer(lock.readUnlock();)
+        headers = fileGet(path_header, true);
+    }
+    std::string etag = getHeaderValue(headers, "ETag"), last_modified = getHeaderValue(headers, "Last-Modified");
+    if(etag.empty() && last_modified.empty())
+        return false;
+    if(request_headers)
+        conditional_headers = *request_headers;
+    if(!etag.empty())
+        conditional_headers["If-None-Match"] = etag;
+    if(!last_modified.empty())
+        conditional_headers["If-Modified-Since"] = last_modified;
+    return true;
+}
+
+/// upstream answered 304, serve the stale copy and restart its TTL
+static bool cacheRevalidate(const std::string &url, std::string &content, std::string &response_headers)
+{
+    const std::string path = getCachePath(url), path_header = path + "_header";
+    time_t now = time(nullptr);
+    if(memoryCacheGet(url, -1, content, &response_headers))
+        memoryCacheTouch(url, now);
+    else if(fileExist(path))
+    {
+        RWLock &lock = cache_locks[url];
+        lock.readLock();
+        defer(lock.readUnlock();)
+        content = fileGet(path, true);
+        response_headers = fileGet(path_header, true);
+        memoryCachePut(url, content, &response_headers, now);
+    }
+    else
+        return false;
+    {
+        RWLock &lock = cache_locks[url];
+        lock.writeLock();
+        defer(lock.writeUnlock();)
+        utime(path.data(), nullptr);
+    }
+    writeLog(0, "CACHE REVALIDATED: '" + url + "', upstream not modified.");
+    metricAdd(METRIC_CACHE_REVALIDATED);
+    cache_result = "revalidated";
+    return true;
+}
+
+static void cacheUpdate(const std::string &url, int &status_code, std::string &content, std::string &response_headers)
+{
+    if(status_code == 200) // success, save new cache
+        cacheStore(url, content, &response_headers);
+    else if(status_code == 304 && cacheRevalidate(url, content, response_headers))
+        status_code = 200;
+    else
+        cacheFallback(url, content, &response_headers);
+}
+
+static std::string cachedWebGet(const std::string &url, const std::string &proxy, unsigned int cache_ttl, std::string *response_headers, string_icase_map *request_headers, int &status_code)
 {
     int return_code = 0;
+    std::string content, headers;
+
+    // cache system
+    if(cache_ttl > 0 && cacheLookup(url, cache_ttl, content, response_headers))
+    {
+        status_code = 200;
+        return content;
+    }
+    string_icase_map conditional_headers;
+    bool revalidate = cache_ttl > 0 && cacheConditionalHeaders(url, request_headers, conditional_headers);
+
+    /// headers are always captured when caching, they carry the validators for the next revalidation
+    FetchArgument argument {HTTP_GET, url, proxy, nullptr, revalidate ? &conditional_headers : request_headers, nullptr, cache_ttl, false, request_headers != nullptr};
+    FetchResult fetch_res {&return_code, &content, cache_ttl > 0 ? &headers : response_headers, nullptr};
+
+    //return curlGet(url, proxy, response_headers, return_code);
+    curlGet(argument, fetch_res);
+    if(cache_ttl > 0)
+    {
+        cacheUpdate(url, return_code, content, headers);
+        if(response_headers)
+            *response_headers = std::move(headers);
+    }
+    status_code = return_code;
+    return content;
+}
+
+/// concurrent GETs with the same url, proxy and headers share a single transfer, whether from webGet() or a webGetMulti() batch
+struct InflightResult
+{
     std::string content;
+    std::string headers;
+    int status_code = 0;
+};
 
-    FetchArgument argument {HTTP_GET, url, proxy, nullptr, request_headers, nullptr, cache_ttl};
-    FetchResult fetch_res {&return_code, &content, response_headers, nullptr};
+static std::mutex inflight_lock;
+static std::unordered_map<std::string, std::shared_future<InflightResult>> inflight_fetches;
 
+static std::string inflightKey(const std::string &url, const std::string &proxy, bool with_headers, const string_icase_map *request_headers)
+{
+    std::string key = url;
+    key += '\n';
+    key += proxy;
+    key += with_headers ? "\n1" : "\n0";
+    if(request_headers)
+    {
+        for(auto &x : *request_headers)
+        {
+            key += '\n';
+            key += x.first;
+            key += ": ";
+            key += x.second;
+        }
+    }
+    return key;
+}
+
+std::string webGet(const std::string &url, const std::string &proxy, unsigned int cache_ttl, std::string *response_headers, string_icase_map *request_headers)
+{
     if (startsWith(url, "data:"))
         return dataGet(url);
-    // cache system
-    if(cache_ttl > 0)
+
+    StageTimer timer(METRIC_STAGE_FETCH);
+    RequestTracePtr trace = traceCurrent();
+    auto start = std::chrono::steady_clock::now();
+    std::string key = inflightKey(url, proxy, response_headers, request_headers);
+
+    std::promise<InflightResult> promise;
+    std::shared_future<InflightResult> future;
+    bool leader = false;
     {
-        md("cache");
-        const std::string url_md5 = getMD5(url);
-        const std::string path = "cache/" + url_md5, path_header = path + "_header";
-        struct stat result {};
-        if(stat(path.data(), &result) == 0) // cache exist
+        std::lock_guard<std::mutex> guard(inflight_lock);
+        auto iter = inflight_fetches.find(key);
+        if(iter != inflight_fetches.end())
+            future = iter->second;
+        else
         {
-            time_t mtime = result.st_mtime, now = time(nullptr); // get cache modified time and current time
-            if(difftime(now, mtime) <= cache_ttl) // within TTL
+            future = promise.get_future().share();
+            inflight_fetches.emplace(key, future);
+            leader = true;
+        }
+    }
+    if(!leader)
+    {
+        writeLog(0, "FETCH JOINED: '" + url + "', waiting for the in-flight transfer.");
+        const InflightResult &shared = future.get();
+        if(response_headers)
+            *response_headers = shared.headers;
+        if(trace)
+            trace->addFetch({url, "joined", shared.content.size(), std::chrono::steady_clock::now() - start});
+        return shared.content;
+    }
+
+    InflightResult result;
+    cache_result = "none";
+    try
+    {
+        result.content = cachedWebGet(url, proxy, cache_ttl, response_headers ? &result.headers : nullptr, request_headers, result.status_code);
+    }
+    catch(...)
+    {
+        promise.set_exception(std::current_exception());
+        std::lock_guard<std::mutex> guard(inflight_lock);
+        inflight_fetches.erase(key);
+        throw;
+    }
+    if(response_headers)
+        *response_headers = result.headers;
+    if(trace)
+        trace->addFetch({url, cache_result, result.content.size(), std::chrono::steady_clock::now() - start});
+    std::string content = result.content;
+    promise.set_value(std::move(result));
+    std::lock_guard<std::mutex> guard(inflight_lock);
+    inflight_fetches.erase(key);
+    return content;
+}
+
+void webGetMulti(std::vector<FetchTask> &tasks)
+{
+    StageTimer timer(METRIC_STAGE_FETCH);
+    RequestTracePtr trace = traceCurrent();
+    auto start = std::chrono::steady_clock::now();
+    struct MultiTransfer
+    {
+        FetchTask &task;
+        string_icase_map conditional_headers;
+        bool revalidate;
+        FetchArgument argument;
+        FetchResult result;
+        CurlTransfer transfer;
+        CURL *handle = nullptr;
+        unsigned int fail_count = 0;
+        std::chrono::steady_clock::time_point finish;
+        std::string key;
+        std::promise<InflightResult> promise;
+        bool resolved = false;
+
+        explicit MultiTransfer(FetchTask &x) : task(x), revalidate(x.cache_ttl > 0 && cacheConditionalHeaders(x.url, x.request_headers, conditional_headers)),
+            argument{HTTP_GET, x.url, x.proxy, nullptr, revalidate ? &conditional_headers : x.request_headers, nullptr, x.cache_ttl, false, x.request_headers != nullptr}, result{&x.status_code, &x.content, &x.response_headers, nullptr} {}
+    };
+    /// a task whose url is already being fetched, by another request or earlier in this batch
+    struct JoinedTask
+    {
+        FetchTask &task;
+        std::shared_future<InflightResult> future;
+    };
+    std::list<MultiTransfer> transfers;
+    std::vector<JoinedTask> joined;
+    /// keys still registered when leaving early must not stay behind, later fetches would join a dead transfer
+    defer(for(MultiTransfer &x : transfers) { if(!x.resolved) { std::lock_guard<std::mutex> guard(inflight_lock); inflight_fetches.erase(x.key); } })
+
+    for(FetchTask &x : tasks)
+    {
+        x.status_code = 0;
+        x.content.clear();
+        x.response_headers.clear();
+        if(startsWith(x.url, "data:"))
+        {
+            x.content = dataGet(x.url);
+            x.status_code = 200;
+            continue;
+        }
+        if(x.cache_ttl > 0 && cacheLookup(x.url, x.cache_ttl, x.content, &x.response_headers))
+        {
+            x.status_code = 200;
+            if(trace)
+                trace->addFetch({x.url, cache_result, x.content.size(), std::chrono::steady_clock::now() - start});
+            continue;
+        }
+        std::string key = inflightKey(x.url, x.proxy, true, x.request_headers);
+        std::promise<InflightResult> promise;
+        {
+            std::lock_guard<std::mutex> guard(inflight_lock);
+            auto iter = inflight_fetches.find(key);
+            if(iter != inflight_fetches.end())
             {
-                writeLog(0, "CACHE HIT: '" + url + "', using local cache.");
-                //guarded_mutex guard(cache_rw_lock);
-                cache_rw_lock.readLock();
-                defer(cache_rw_lock.readUnlock();)
-                if(response_headers)
-                    *response_headers = fileGet(path_header, true);
-                return fileGet(path, true);
+                joined.push_back({x, iter->second});
+                continue;
             }
-            writeLog(0, "CACHE MISS: '" + url + "', TTL timeout, creating new cache."); // out of TTL
+            inflight_fetches.emplace(key, promise.get_future().share());
         }
-        else
-            writeLog(0, "CACHE NOT EXIST: '" + url + "', creating new cache.");
-        //content = curlGet(url, proxy, response_headers, return_code); // try to fetch data
-        curlGet(argument, fetch_res);
-        if(return_code == 200) // success, save new cache
+        MultiTransfer &transfer = transfers.emplace_back(x);
+        transfer.key = std::move(key);
+        transfer.promise = std::move(promise);
+    }
+
+    if(!transfers.empty())
+    {
+        curl_init();
+        CURLM *multi_handle = curl_multi_init();
+        curl_multi_setopt(multi_handle, CURLMOPT_MAX_TOTAL_CONNECTIONS, static_cast<long>(global->maxParallelFetches));
+        curl_multi_setopt(multi_handle, CURLMOPT_MAX_HOST_CONNECTIONS, static_cast<long>(global->maxHostFetches));
+        for(MultiTransfer &x : transfers)
         {
-            //guarded_mutex guard(cache_rw_lock);
-            cache_rw_lock.writeLock();
-            defer(cache_rw_lock.writeUnlock();)
-            fileWrite(path, content, true);
-            if(response_headers)
-                fileWrite(path_header, *response_headers, true);
+            x.handle = curl_acquire_handle();
+            curl_prepare(x.handle, x.argument, x.result, x.transfer);
+            curl_easy_setopt(x.handle, CURLOPT_PRIVATE, &x);
+            curl_multi_add_handle(multi_handle, x.handle);
         }
-        else
+
+        /// transfers beyond the connection limits are queued by curl itself
+        size_t remaining = transfers.size();
+        while(remaining)
         {
-            if(fileExist(path) && global.serveCacheOnFetchFail) // failed, check if cache exist
+            int running = 0, queued = 0;
+            if(curl_multi_perform(multi_handle, &running) != CURLM_OK)
+                break;
+            CURLMsg *message;
+            while((message = curl_multi_info_read(multi_handle, &queued)))
             {
-                writeLog(0, "Fetch failed. Serving cached content."); // cache exist, serving cache
-                //guarded_mutex guard(cache_rw_lock);
-                cache_rw_lock.readLock();
-                defer(cache_rw_lock.readUnlock();)
-                content = fileGet(path, true);
-                if(response_headers)
-                    *response_headers = fileGet(path_header, true);
+                if(message->msg != CURLMSG_DONE)
+                    continue;
+                MultiTransfer *transfer = nullptr;
+                CURLcode retVal = message->data.result;
+                curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &transfer);
+                curl_multi_remove_handle(multi_handle, transfer->handle);
+                if(retVal != CURLE_OK && transfer->fail_count < 1 && !global->APIMode) // retry once, same as curlGet
+                {
+                    transfer->fail_count++;
+                    curl_multi_add_handle(multi_handle, transfer->handle);
+                    continue;
+                }
+                curl_finish(transfer->handle, retVal, transfer->argument, transfer->result);
+                transfer->handle = nullptr;
+                transfer->finish = std::chrono::steady_clock::now();
+                remaining--;
             }
-            else
-                writeLog(0, "Fetch failed. No local cache available."); // cache not exist or not allow to serve cache, serving nothing
+            if(remaining && curl_multi_wait(multi_handle, nullptr, 0, 1000, nullptr) != CURLM_OK)
+                break;
         }
-        return content;
+        for(MultiTransfer &x : transfers)
+        {
+            if(x.handle) // multi interface failed, give up on unfinished transfers
+            {
+                curl_multi_remove_handle(multi_handle, x.handle);
+                curl_finish(x.handle, CURLE_FAILED_INIT, x.argument, x.result);
+                x.handle = nullptr;
+                x.finish = std::chrono::steady_clock::now();
+            }
+            cache_result = x.task.cache_ttl > 0 ? "miss" : "none";
+            if(x.task.cache_ttl > 0)
+                cacheUpdate(x.task.url, x.task.status_code, x.task.content, x.task.response_headers);
+            if(trace)
+                trace->addFetch({x.task.url, cache_result, x.task.content.size(), x.finish - start});
+            /// every transfer of this batch is resolved before any joined task is waited on, so batches never wait on each other
+            x.promise.set_value({x.task.content, x.task.response_headers, x.task.status_code});
+            x.resolved = true;
+            std::lock_guard<std::mutex> guard(inflight_lock);
+            inflight_fetches.erase(x.key);
+        }
+        curl_multi_cleanup(multi_handle);
+    }
+
+    for(JoinedTask &x : joined)
+    {
+        writeLog(0, "FETCH JOINED: '" + x.task.url + "', waiting for the in-flight transfer.");
+        try
+        {
+            const InflightResult &shared = x.future.get();
+            x.task.content = shared.content;
+            x.task.response_headers = shared.headers;
+            x.task.status_code = shared.status_code;
+        }
+        catch(...)
+        {
+            /// the leading transfer failed, the task is left empty like any other failed fetch
+        }
+        if(trace)
+            trace->addFetch({x.task.url, "joined", x.task.content.size(), std::chrono::steady_clock::now() - start});
     }
-    //return curlGet(url, proxy, response_headers, return_code);
-    curlGet(argument, fetch_res);
-    return content;
 }
 
 void flushCache()
 {
-    //guarded_mutex guard(cache_rw_lock);
-    cache_rw_lock.writeLock();
-    defer(cache_rw_lock.writeUnlock();)
+    cache_locks.writeLockAll();
+    defer(cache_locks.writeUnlockAll();)
+    memoryCacheClear();
     operateFiles("cache", [](const std::string &file){ remove(("cache/" + file).data()); return 0; });
 }
 
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <map>
+#include <vector>
 
 #include "utils/map_extra.h"
 #include "utils/string.h"
@@ -25,6 +26,8 @@ struct FetchArgument
     std::string *cookies = nullptr;
     const unsigned int cache_ttl = 0;
     const bool keep_resp_on_fail = false;
+    /// send the default User-Agent when request_headers has none, off for requests the caller made without headers
+    const bool default_user_agent = true;
 };
 
 struct FetchResult
@@ -35,7 +38,20 @@ struct FetchResult
     std::string *cookies = nullptr;
 };
 
+/// one GET of a webGetMulti() batch, results are written back into the task
+struct FetchTask
+{
+    std::string url;
+    std::string proxy;
+    unsigned int cache_ttl = 0;
+    const string_icase_map *request_headers = nullptr;
+    std::string content;
+    std::string response_headers;
+    int status_code = 0;
+};
+
 int webGet(const FetchArgument& argument, FetchResult &result);
+void webGetMulti(std::vector<FetchTask> &tasks);
 std::string webGet(const std::string &url, const std::string &proxy = "", unsigned int cache_ttl = 0, std::string *response_headers = nullptr, string_icase_map *request_headers = nullptr);
 void flushCache();
 int webPost(const std::string &url, const std::string &data, const std::string &proxy, const string_icase_map &request_headers, std::string *retData);
@@ -16,6 +16,7 @@
 #include "utils/defer.h"
 #include "utils/file_extra.h"
 #include "utils/logger.h"
+#include "utils/metrics.h"
 #include "utils/network.h"
 #include "utils/rapidjson_extra.h"
 #include "utils/system.h"
@@ -58,28 +59,28 @@ void setcd(std::string &file)
     chdir(path.data());
 }
 
-void chkArg(int argc, char *argv[])
+void chkArg(int argc, char *argv[], Settings &conf)
 {
     for(int i = 1; i < argc; i++)
     {
         if(strcmp(argv[i], "-cfw") == 0)
         {
-            global.CFWChildProcess = true;
-            global.updateRulesetOnRequest = true;
+            conf.CFWChildProcess = true;
+            conf.updateRulesetOnRequest = true;
         }
         else if(strcmp(argv[i], "-f") == 0 || strcmp(argv[i], "--file") == 0)
         {
             if(i < argc - 1)
-                global.prefPath.assign(argv[++i]);
+                conf.prefPath.assign(argv[++i]);
         }
         else if(strcmp(argv[i], "-g") == 0 || strcmp(argv[i], "--gen") == 0)
         {
-            global.generatorMode = true;
+            conf.generatorMode = true;
         }
         else if(strcmp(argv[i], "--artifact") == 0)
         {
             if(i < argc - 1)
-                global.generateProfiles.assign(argv[++i]);
+                conf.generateProfiles.assign(argv[++i]);
         }
         else if(strcmp(argv[i], "-l") == 0 || strcmp(argv[i], "--log") == 0)
         {
@@ -109,7 +110,8 @@ void signal_handler(int sig)
 
 void cron_tick_caller()
 {
-    if(global.enableCron)
+    SettingsScope scope(global.latest());
+    if(global->enableCron)
         cron_tick();
 }
 
@@ -119,27 +121,30 @@ int main(int argc, char *argv[])
     std::string prgpath = argv[0];
     setcd(prgpath); //first switch to program directory
 #endif // _DEBUG
-    if(fileExist("pref.toml"))
-        global.prefPath = "pref.toml";
-    else if(fileExist("pref.yml"))
-        global.prefPath = "pref.yml";
-    else if(!fileExist("pref.ini"))
+    global.update([&](Settings &conf)
     {
-        if(fileExist("pref.example.toml"))
+        if(fileExist("pref.toml"))
+            conf.prefPath = "pref.toml";
+        else if(fileExist("pref.yml"))
+            conf.prefPath = "pref.yml";
+        else if(!fileExist("pref.ini"))
         {
-            fileCopy("pref.example.toml", "pref.toml");
-            global.prefPath = "pref.toml";
-        }
-        else if(fileExist("pref.example.yml"))
-        {
-            fileCopy("pref.example.yml", "pref.yml");
-            global.prefPath = "pref.yml";
+            if(fileExist("pref.example.toml"))
+            {
+                fileCopy("pref.example.toml", "pref.toml");
+                conf.prefPath = "pref.toml";
+            }
+            else if(fileExist("pref.example.yml"))
+            {
+                fileCopy("pref.example.yml", "pref.yml");
+                conf.prefPath = "pref.yml";
+            }
+            else if(fileExist("pref.example.ini"))
+                fileCopy("pref.example.ini", "pref.ini");
         }
-        else if(fileExist("pref.example.ini"))
-            fileCopy("pref.example.ini", "pref.ini");
-    }
-    chkArg(argc, argv);
-    setcd(global.prefPath); //then switch to pref directory
+        chkArg(argc, argv, conf);
+        setcd(conf.prefPath); //then switch to pref directory
+    });
     writeLog(0, "SubConverter " VERSION " starting up..", LOG_LEVEL_INFO);
 #ifdef _WIN32
     WSADATA wsaData;
@@ -164,17 +169,20 @@ int main(int argc, char *argv[])
     SetConsoleTitle("SubConverter " VERSION);
     readConf();
     //vfs::vfs_read("vfs.ini");
-    if(!global.updateRulesetOnRequest)
-        refreshRulesets(global.customRulesets, global.rulesetsContent);
+    if(!global->updateRulesetOnRequest)
+        refreshGlobalRulesets();
 
     std::string env_api_mode = getEnv("API_MODE"), env_managed_prefix = getEnv("MANAGED_PREFIX"), env_token = getEnv("API_TOKEN");
-    global.APIMode = tribool().parse(toLower(env_api_mode)).get(global.APIMode);
-    if(!env_managed_prefix.empty())
-        global.managedConfigPrefix = env_managed_prefix;
-    if(!env_token.empty())
-        global.accessToken = env_token;
+    global.update([&](Settings &conf)
+    {
+        conf.APIMode = tribool().parse(toLower(env_api_mode)).get(conf.APIMode);
+        if(!env_managed_prefix.empty())
+            conf.managedConfigPrefix = env_managed_prefix;
+        if(!env_token.empty())
+            conf.accessToken = env_token;
+    });
 
-    if(global.generatorMode)
+    if(global->generatorMode)
         return simpleGenerator();
 
     /*
@@ -191,42 +199,42 @@ int main(int argc, char *argv[])
 
     webServer.append_response("GET", "/refreshrules", "text/plain", [](RESPONSE_CALLBACK_ARGS) -> std::string
     {
-        if(!global.accessToken.empty())
+        if(!global->accessToken.empty())
         {
             std::string token = getUrlArg(request.argument, "token");
-            if(token != global.accessToken)
+            if(token != global->accessToken)
             {
                 response.status_code = 403;
                 return "Forbidden\n";
             }
         }
-        refreshRulesets(global.customRulesets, global.rulesetsContent);
+        refreshGlobalRulesets();
         return "done\n";
     });
 
     webServer.append_response("GET", "/readconf", "text/plain", [](RESPONSE_CALLBACK_ARGS) -> std::string
     {
-        if(!global.accessToken.empty())
+        if(!global->accessToken.empty())
         {
             std::string token = getUrlArg(request.argument, "token");
-            if(token != global.accessToken)
+            if(token != global->accessToken)
             {
                 response.status_code = 403;
                 return "Forbidden\n";
             }
         }
         readConf();
-        if(!global.updateRulesetOnRequest)
-            refreshRulesets(global.customRulesets, global.rulesetsContent);
+        if(!global->updateRulesetOnRequest)
+            refreshGlobalRulesets();
         return "done\n";
     });
 
     webServer.append_response("POST", "/updateconf", "text/plain", [](RESPONSE_CALLBACK_ARGS) -> std::string
     {
-        if(!global.accessToken.empty())
+        if(!global->accessToken.empty())
         {
             std::string token = getUrlArg(request.argument, "token");
-            if(token != global.accessToken)
+            if(token != global->accessToken)
             {
                 response.status_code = 403;
                 return "Forbidden\n";
@@ -235,7 +243,7 @@ int main(int argc, char *argv[])
         std::string type = getUrlArg(request.argument, "type");
         if(type == "form" || type == "direct")
         {
-            fileWrite(global.prefPath, request.postdata, true);
+            fileWrite(global->prefPath, request.postdata, true);
         }
         else
         {
@@ -244,23 +252,39 @@ int main(int argc, char *argv[])
         }
 
         readConf();
-        if(!global.updateRulesetOnRequest)
-            refreshRulesets(global.customRulesets, global.rulesetsContent);
+        if(!global->updateRulesetOnRequest)
+            refreshGlobalRulesets();
         return "done\n";
     });
 
+    webServer.append_response("GET", "/metrics", "text/plain; version=0.0.4", [](RESPONSE_CALLBACK_ARGS) -> std::string
+    {
+        if(!global->accessToken.empty())
+        {
+            std::string token = getUrlArg(request.argument, "token");
+            if(token != global->accessToken)
+            {
+                response.status_code = 403;
+                return "Forbidden\n";
+            }
+        }
+        return metricsRender();
+    });
+
     webServer.append_response("GET", "/flushcache", "text/plain", [](RESPONSE_CALLBACK_ARGS) -> std::string
     {
-        if(getUrlArg(request.argument, "token") != global.accessToken)
+        if(getUrlArg(request.argument, "token") != global->accessToken)
         {
             response.status_code = 403;
             return "Forbidden";
         }
         flushCache();
+        flushResponseCache();
+        flushRuleCache();
         return "done";
     });
 
-    webServer.append_response("GET", "/sub", "text/plain;charset=utf-8", subconverter);
+    webServer.append_response("GET", "/sub", "text/plain;charset=utf-8", subconverter, RESPONSE_FLAG_ETAG | RESPONSE_FLAG_COMPRESS);
 
     webServer.append_response("HEAD", "/sub", "text/plain", subconverter);
 
@@ -268,13 +292,13 @@ int main(int argc, char *argv[])
 
     webServer.append_response("GET", "/surge2clash", "text/plain;charset=utf-8", surgeConfToClash);
 
-    webServer.append_response("GET", "/getruleset", "text/plain;charset=utf-8", getRuleset);
+    webServer.append_response("GET", "/getruleset", "text/plain;charset=utf-8", getRuleset, RESPONSE_FLAG_ETAG | RESPONSE_FLAG_COMPRESS);
 
-    webServer.append_response("GET", "/getprofile", "text/plain;charset=utf-8", getProfile);
+    webServer.append_response("GET", "/getprofile", "text/plain;charset=utf-8", getProfile, RESPONSE_FLAG_ETAG);
 
-    webServer.append_response("GET", "/render", "text/plain;charset=utf-8", renderTemplate);
+    webServer.append_response("GET", "/render", "text/plain;charset=utf-8", renderTemplate, RESPONSE_FLAG_ETAG | RESPONSE_FLAG_COMPRESS);
 
-    if(!global.APIMode)
+    if(!global->APIMode)
     {
         webServer.append_response("GET", "/get", "text/plain;charset=utf-8", [](RESPONSE_CALLBACK_ARGS) -> std::string
         {
@@ -294,10 +318,12 @@ int main(int argc, char *argv[])
 
     std::string env_port = getEnv("PORT");
     if(!env_port.empty())
-        global.listenPort = to_int(env_port, global.listenPort);
-    listener_args args = {global.listenAddress, global.listenPort, global.maxPendingConns, global.maxConcurThreads, cron_tick_caller, 200};
+        global.update([&](Settings &conf){ conf.listenPort = to_int(env_port, conf.listenPort); });
+    /// every request works with the settings published when it arrived, even if a reload lands meanwhile
+    webServer.request_scope = [](){ return std::make_shared<SettingsScope>(global.latest()); };
+    listener_args args = {global->listenAddress, global->listenPort, global->maxPendingConns, global->maxConcurThreads, cron_tick_caller, 200};
     //std::cout<<"Serving HTTP @ http://"<<listen_address<<":"<<listen_port<<std::endl;
-    writeLog(0, "Startup completed. Serving HTTP @ http://" + global.listenAddress + ":" + std::to_string(global.listenPort), LOG_LEVEL_INFO);
+    writeLog(0, "Startup completed. Serving HTTP @ http://" + global->listenAddress + ":" + std::to_string(global->listenPort), LOG_LEVEL_INFO);
     webServer.start_web_server_multi(&args);
 
 #ifdef _WIN32
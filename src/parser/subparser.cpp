@@ -2600,7 +2600,6 @@ void explode(const std::string &link, Proxy &node)
 
 void explodeSub(std::string sub, std::vector<Proxy> &nodes)
 {
-    std::stringstream strstream;
     std::string strLink;
     bool processed = false;
 
@@ -2647,13 +2646,13 @@ void explodeSub(std::string sub, std::vector<Proxy> &nodes)
             if(explodeSurge(sub, nodes))
                 return;
         }
-        strstream << sub;
-        char delimiter = count(sub.begin(), sub.end(), '\n') < 1 ? count(sub.begin(), sub.end(), '\r') < 1 ? ' ' : '\r' : '\n';
-        while(getline(strstream, strLink, delimiter))
+        char delimiter = sub.find('\n') == std::string::npos ? sub.find('\r') == std::string::npos ? ' ' : '\r' : '\n';
+        LineReader reader(sub, delimiter);
+        std::string_view line;
+        while(reader.next(line))
         {
             Proxy node;
-            if(strLink.rfind('\r') != std::string::npos)
-                strLink.erase(strLink.size() - 1);
+            strLink.assign(line);
             explode(strLink, node);
             if(strLink.empty() || node.Type == ProxyType::Unknown)
             {
@@ -3,6 +3,8 @@
 
 #include <string>
 
+#include <yaml-cpp/yaml.h>
+
 #include "config/proxy.h"
 
 enum class ConfType
@@ -96,6 +98,8 @@ void explodeAnyTLS(std::string anytls, Proxy &node);
 /// Parse a link
 void explode(const std::string &link, Proxy &node);
 void explodeSSD(std::string link, std::vector<Proxy> &nodes);
+void explodeClash(YAML::Node yamlnode, std::vector<Proxy> &nodes);
+bool explodeSurge(std::string surge, std::vector<Proxy> &nodes);
 void explodeSub(std::string sub, std::vector<Proxy> &nodes);
 int explodeConf(const std::string &filepath, std::vector<Proxy> &nodes);
 int explodeConfContent(const std::string &content, std::vector<Proxy> &nodes);
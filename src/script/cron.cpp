@@ -35,7 +35,7 @@ int timeout_checker(JSRuntime *rt, void *opaque)
 void refresh_schedule()
 {
     cron.clear_schedules();
-    for(const CronTaskConfig &x : global.cronTasks)
+    for(const CronTaskConfig &x : global->cronTasks)
     {
         cron.add_schedule(x.Name, x.CronExp, [=](auto &)
         {
@@ -46,8 +46,8 @@ void refresh_schedule()
                 script_runtime_init(runtime);
                 script_context_init(context);
                 defer(script_cleanup(context);)
-                std::string proxy = parseProxy(global.proxyConfig);
-                std::string script = fetchFile(x.Path, proxy, global.cacheConfig);
+                std::string proxy = parseProxy(global->proxyConfig);
+                std::string script = fetchFile(x.Path, proxy, global->cacheConfig);
                 if(script.empty())
                 {
                     writeLog(0, "Script '" + x.Name + "' run failed: file is empty or not exist!", LOG_LEVEL_WARNING);
@@ -78,7 +78,7 @@ std::string list_cron_schedule(RESPONSE_CALLBACK_ARGS)
     rapidjson::StringBuffer sb;
     rapidjson::Writer<rapidjson::StringBuffer> writer(sb);
     writer.StartObject();
-    if(token != global.accessToken)
+    if(token != global->accessToken)
     {
         response.status_code = 403;
         writer.Key("code");
@@ -92,7 +92,7 @@ std::string list_cron_schedule(RESPONSE_CALLBACK_ARGS)
     writer.Int(200);
     writer.Key("tasks");
     writer.StartArray();
-    for(const CronTaskConfig &x : global.cronTasks)
+    for(const CronTaskConfig &x : global->cronTasks)
     {
         writer.StartObject();
         writer.Key("name");
@@ -382,7 +382,7 @@ static std::string qjs_getUrlArg(const std::string &url, const std::string &requ
 
 std::string getGeoIP(const std::string &address, const std::string &proxy)
 {
-    return fetchFile("https://api.ip.sb/geoip/" + address, parseProxy(proxy), global.cacheConfig);
+    return fetchFile("https://api.ip.sb/geoip/" + address, parseProxy(proxy), global->cacheConfig);
 }
 
 void script_runtime_init(qjs::Runtime &runtime)
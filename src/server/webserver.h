@@ -4,6 +4,8 @@
 #include <string>
 #include <map>
 #include <atomic>
+#include <functional>
+#include <memory>
 #include <curl/curlver.h>
 
 #include "utils/map_extra.h"
@@ -19,17 +21,31 @@ struct Request
     std::string postdata;
 };
 
+/// receives one chunk of a streamed body, returns false once the client is gone
+using content_sink = std::function<bool(const std::string &chunk)>;
+/// writes a body to the sink piece by piece after the handler has returned
+using content_provider = std::function<bool(const content_sink &sink)>;
+
 struct Response
 {
     int status_code = 200;
     std::string content_type;
     string_icase_map headers;
+    content_provider provider; /// when set, the body is sent chunked from here instead of the returned string
 };
 
 using response_callback = std::string (*)(Request&, Response&); //process arguments and POST data and return served-content
 
 #define RESPONSE_CALLBACK_ARGS Request &request, Response &response
 
+/// optional behaviours of a route, combined as bit flags
+enum response_flag
+{
+    RESPONSE_FLAG_NONE = 0,
+    RESPONSE_FLAG_ETAG = 1 << 0, /// emit a strong ETag of the body and answer If-None-Match with 304
+    RESPONSE_FLAG_COMPRESS = 1 << 1, /// compress the body with the best encoding the client accepts
+};
+
 struct listener_args
 {
     std::string listen_address;
@@ -46,6 +62,7 @@ struct responseRoute
     std::string path;
     std::string content_type;
     response_callback rc {};
+    int flags = RESPONSE_FLAG_NONE;
 };
 
 class WebServer
@@ -54,23 +71,23 @@ public:
     std::string user_agent_str = "subconverter/" VERSION " cURL/" LIBCURL_VERSION;
     std::atomic_bool SERVER_EXIT_FLAG{false};
 
-    // file server
-    bool serve_file = false;
-    std::string serve_file_root;
-
     // basic authentication
     bool require_auth = false;
     std::string auth_user, auth_password, auth_realm = "Please enter username and password:";
 
+    // called on the worker thread before a route is handled, what it returns is held until the response is sent
+    std::function<std::shared_ptr<void>()> request_scope;
+
     void stop_web_server();
 
-    void append_response(const std::string &method, const std::string &uri, const std::string &content_type, response_callback response)
+    void append_response(const std::string &method, const std::string &uri, const std::string &content_type, response_callback response, int flags = RESPONSE_FLAG_NONE)
     {
         responseRoute rr;
         rr.method = method;
         rr.path = uri;
         rr.content_type = content_type;
         rr.rc = response;
+        rr.flags = flags;
         responses.emplace_back(std::move(rr));
     }
 
@@ -1,12 +1,29 @@
 #include <string>
+#include <algorithm>
+#include <list>
+#include <mutex>
+#include <unordered_map>
 #ifdef MALLOC_TRIM
 #include <malloc.h>
 #endif // MALLOC_TRIM
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif // HAVE_ZLIB
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif // HAVE_BROTLI
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif // HAVE_ZSTD
 #define CPPHTTPLIB_REQUEST_URI_MAX_LENGTH 16384
 #include "httplib.h"
 
+#include "handler/settings.h"
 #include "utils/base64/base64.h"
+#include "utils/defer.h"
 #include "utils/logger.h"
+#include "utils/md5/md5_interface.h"
+#include "utils/metrics.h"
 #include "utils/string_hash.h"
 #include "utils/stl_extra.h"
 #include "utils/urlencode.h"
@@ -26,15 +43,232 @@ static inline bool is_request_header_blacklisted(const std::string &header)
     return false;
 }
 
+/// If-None-Match may hold a list of tags, weak tags are compared by their opaque part
+static bool etag_match(const std::string &if_none_match, const std::string &etag)
+{
+    for (auto &x : split(if_none_match, ","))
+    {
+        std::string tag = trimWhitespace(x, true, true);
+        if (startsWith(tag, "W/"))
+            tag.erase(0, 2);
+        if (tag == "*" || tag == etag)
+            return true;
+    }
+    return false;
+}
+
+/// ordered by server preference, a later encoding wins when the client gives equal q-values
+enum class content_encoding
+{
+    identity,
+    gzip,
+    br,
+    zstd
+};
+
+static const char *encoding_name(content_encoding encoding)
+{
+    switch (encoding)
+    {
+        case content_encoding::gzip:
+            return "gzip";
+        case content_encoding::br:
+            return "br";
+        case content_encoding::zstd:
+            return "zstd";
+        default:
+            return "identity";
+    }
+}
+
+static content_encoding negotiate_encoding(const std::string &accept_encoding)
+{
+    content_encoding best = content_encoding::identity;
+    double best_q = 0.0;
+    for (auto &x : split(accept_encoding, ","))
+    {
+        std::string coding = trimWhitespace(x, true, true);
+        double q = 1.0;
+        auto pos = coding.find(';');
+        if (pos != std::string::npos)
+        {
+            std::string param = trimWhitespace(coding.substr(pos + 1), true, true);
+            coding = trimWhitespace(coding.substr(0, pos), true, true);
+            if (startsWith(param, "q="))
+                q = to_number<double>(param.substr(2), 0.0);
+        }
+        content_encoding encoding;
+        switch (hash_(toLower(coding)))
+        {
+#ifdef HAVE_ZLIB
+            case "gzip"_hash:
+                encoding = content_encoding::gzip;
+                break;
+#endif // HAVE_ZLIB
+#ifdef HAVE_BROTLI
+            case "br"_hash:
+                encoding = content_encoding::br;
+                break;
+#endif // HAVE_BROTLI
+#ifdef HAVE_ZSTD
+            case "zstd"_hash:
+                encoding = content_encoding::zstd;
+                break;
+#endif // HAVE_ZSTD
+            default:
+                continue;
+        }
+        if (q > 0.0 && (q > best_q || (q == best_q && encoding > best)))
+        {
+            best = encoding;
+            best_q = q;
+        }
+    }
+    return best;
+}
+
+static bool compress_body(const std::string &data, std::string &out, content_encoding encoding, int level)
+{
+    switch (encoding)
+    {
+#ifdef HAVE_ZLIB
+        case content_encoding::gzip:
+        {
+            z_stream strm {};
+            if (deflateInit2(&strm, std::clamp(level, 1, 9), Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+                return false;
+            out.resize(deflateBound(&strm, data.size()));
+            strm.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.data()));
+            strm.avail_in = data.size();
+            strm.next_out = reinterpret_cast<Bytef *>(out.data());
+            strm.avail_out = out.size();
+            int ret = deflate(&strm, Z_FINISH);
+            out.resize(strm.total_out);
+            deflateEnd(&strm);
+            return ret == Z_STREAM_END;
+        }
+#endif // HAVE_ZLIB
+#ifdef HAVE_BROTLI
+        case content_encoding::br:
+        {
+            size_t size = BrotliEncoderMaxCompressedSize(data.size());
+            if (!size)
+                return false;
+            out.resize(size);
+            if (!BrotliEncoderCompress(std::clamp(level, 0, BROTLI_MAX_QUALITY), BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, data.size(), reinterpret_cast<const uint8_t *>(data.data()), &size, reinterpret_cast<uint8_t *>(out.data())))
+                return false;
+            out.resize(size);
+            return true;
+        }
+#endif // HAVE_BROTLI
+#ifdef HAVE_ZSTD
+        case content_encoding::zstd:
+        {
+            out.resize(ZSTD_compressBound(data.size()));
+            size_t size = ZSTD_compress(out.data(), out.size(), data.data(), data.size(), std::clamp(level, 1, ZSTD_maxCLevel()));
+            if (ZSTD_isError(size))
+                return false;
+            out.resize(size);
+            return true;
+        }
+#endif // HAVE_ZSTD
+        default:
+            return false;
+    }
+}
+
+/// compressed bodies keyed by body digest, encoding and level, so repeated outputs are only compressed once
+struct CompressedCache
+{
+    std::mutex lock;
+    std::list<std::pair<std::string, std::string>> entries;
+    std::unordered_map<std::string, decltype(entries)::iterator> index;
+    size_t size = 0;
+};
+
+static CompressedCache compressed_cache;
+
+static bool compress_cached(const std::string &digest, const std::string &data, std::string &out, content_encoding encoding, int level, size_t cache_size)
+{
+    std::string key = digest + ":" + encoding_name(encoding) + ":" + std::to_string(level);
+    if (cache_size)
+    {
+        std::lock_guard<std::mutex> lock(compressed_cache.lock);
+        auto iter = compressed_cache.index.find(key);
+        if (iter != compressed_cache.index.end())
+        {
+            compressed_cache.entries.splice(compressed_cache.entries.begin(), compressed_cache.entries, iter->second);
+            out = iter->second->second;
+            return true;
+        }
+    }
+    if (!compress_body(data, out, encoding, level))
+        return false;
+    if (!cache_size || out.size() > cache_size)
+        return true;
+    std::lock_guard<std::mutex> lock(compressed_cache.lock);
+    if (compressed_cache.index.find(key) != compressed_cache.index.end())
+        return true;
+    compressed_cache.entries.emplace_front(key, out);
+    compressed_cache.index.emplace(key, compressed_cache.entries.begin());
+    compressed_cache.size += out.size();
+    while (compressed_cache.size > cache_size)
+    {
+        auto &last = compressed_cache.entries.back();
+        compressed_cache.size -= last.second.size();
+        compressed_cache.index.erase(last.first);
+        compressed_cache.entries.pop_back();
+    }
+    return true;
+}
+
+/// same as httplib::Response::set_content but takes over the body instead of copying it
+static void set_body(httplib::Response &response, std::string &&body, const std::string &content_type)
+{
+    response.body = std::move(body);
+    auto range = response.headers.equal_range("Content-Type");
+    response.headers.erase(range.first, range.second);
+    response.set_header("Content-Type", content_type);
+}
+
+/// httplib's thread pool, also counting the connections still waiting for a worker
+class CountingTaskQueue : public httplib::TaskQueue
+{
+public:
+    explicit CountingTaskQueue(size_t n) : pool(n) {}
+
+    void enqueue(std::function<void()> fn) override
+    {
+        metricGaugeAdd(METRIC_QUEUED_REQUESTS, 1);
+        pool.enqueue([fn = std::move(fn)]()
+        {
+            metricGaugeAdd(METRIC_QUEUED_REQUESTS, -1);
+            fn();
+        });
+    }
+
+    void shutdown() override
+    {
+        pool.shutdown();
+    }
+
+private:
+    httplib::ThreadPool pool;
+};
+
 void WebServer::stop_web_server()
 {
     SERVER_EXIT_FLAG = true;
 }
 
-static httplib::Server::Handler makeHandler(const responseRoute &rr)
+static httplib::Server::Handler makeHandler(const responseRoute &rr, const WebServer *server)
 {
-    return [rr](const httplib::Request &request, httplib::Response &response)
+    return [rr, server](const httplib::Request &request, httplib::Response &response)
     {
+        metricAdd(METRIC_REQUESTS);
+        metricGaugeAdd(METRIC_INFLIGHT_REQUESTS, 1);
+        defer(metricGaugeAdd(METRIC_INFLIGHT_REQUESTS, -1);)
+        std::shared_ptr<void> scope = server->request_scope ? server->request_scope() : nullptr;
         Request req;
         Response resp;
         req.method = request.method;
@@ -76,7 +310,61 @@ static httplib::Server::Handler makeHandler(const responseRoute &rr)
         {
             content_type = rr.content_type;
         }
-        response.set_content(result, content_type);
+        if (resp.provider)
+        {
+            // streamed bodies are never held whole, so they get neither an ETag nor a content encoding
+            response.set_chunked_content_provider(content_type, [provider = std::move(resp.provider), scope](size_t, httplib::DataSink &sink)
+            {
+                if (!provider([&sink](const std::string &chunk)
+                {
+                    metricAdd(METRIC_RESPONSE_BYTES, chunk.size());
+                    return sink.write(chunk.data(), chunk.size());
+                }))
+                    return false;
+                sink.done();
+                return true;
+            });
+            return;
+        }
+        // HEAD shares the GET route but its handler returns no body, a tag or encoding made from that would not match GET
+        if (request.method == "HEAD")
+        {
+            set_body(response, std::move(result), content_type);
+            return;
+        }
+        // accept-encoding is kept away from the handlers, so negotiation happens here, binary bodies come compressed already
+        auto encoding = content_encoding::identity;
+        std::string digest;
+        if ((rr.flags & RESPONSE_FLAG_COMPRESS) && resp.status_code == 200 && content_type != "application/octet-stream")
+        {
+            response.set_header("Vary", "Accept-Encoding");
+            if (global->compressLevel > 0 && result.size() >= global->compressMinSize)
+                encoding = negotiate_encoding(request.get_header_value("Accept-Encoding"));
+        }
+        if ((rr.flags & RESPONSE_FLAG_ETAG) && resp.status_code == 200)
+        {
+            digest = getMD5(result);
+            auto etag = "\"" + digest + (encoding == content_encoding::identity ? "" : std::string("-") + encoding_name(encoding)) + "\"";
+            response.set_header("ETag", etag);
+            if (request.has_header("If-None-Match") && etag_match(request.get_header_value("If-None-Match"), etag))
+            {
+                response.status = 304;
+                return;
+            }
+        }
+        if (encoding != content_encoding::identity)
+        {
+            std::string compressed;
+            if (digest.empty())
+                digest = getMD5(result);
+            if (compress_cached(digest, result, compressed, encoding, global->compressLevel, global->compressCacheSize))
+            {
+                response.set_header("Content-Encoding", encoding_name(encoding));
+                result = std::move(compressed);
+            }
+        }
+        metricAdd(METRIC_RESPONSE_BYTES, result.size());
+        set_body(response, std::move(result), content_type);
     };
 }
 
@@ -100,19 +388,19 @@ int WebServer::start_web_server_multi(listener_args *args)
         switch (hash_(x.method))
         {
             case "GET"_hash: case "HEAD"_hash:
-                server.Get(x.path, makeHandler(x));
+                server.Get(x.path, makeHandler(x, this));
                 break;
             case "POST"_hash:
-                server.Post(x.path, makeHandler(x));
+                server.Post(x.path, makeHandler(x, this));
                 break;
             case "PUT"_hash:
-                server.Put(x.path, makeHandler(x));
+                server.Put(x.path, makeHandler(x, this));
                 break;
             case "DELETE"_hash:
-                server.Delete(x.path, makeHandler(x));
+                server.Delete(x.path, makeHandler(x, this));
                 break;
             case "PATCH"_hash:
-                server.Patch(x.path, makeHandler(x));
+                server.Patch(x.path, makeHandler(x, this));
                 break;
         }
     }
@@ -216,12 +504,12 @@ int WebServer::start_web_server_multi(listener_args *args)
             res.status = 500;
         }
     });
-    if (serve_file)
+    if (!global->serveFileRoot.empty())
     {
-        server.set_mount_point("/", serve_file_root);
+        server.set_mount_point("/", global->serveFileRoot);
     }
     server.new_task_queue = [args] {
-        return new httplib::ThreadPool(args->max_workers);
+        return new CountingTaskQueue(args->max_workers);
     };
     server.bind_to_port(args->listen_address, args->port, 0);
 
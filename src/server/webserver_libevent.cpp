@@ -13,6 +13,7 @@
 #include <pthread.h>
 #include <thread>
 
+#include "handler/settings.h"
 #include "utils/base64/base64.h"
 #include "utils/file_extra.h"
 #include "utils/logger.h"
@@ -87,9 +88,9 @@ std::string checkMIMEType(const std::string &filename)
     return "application/octet-stream";
 }
 
-int serveFile(WebServer *server, const std::string &filename, std::string &content_type, std::string &return_data)
+int serveFile(const std::string &filename, std::string &content_type, std::string &return_data)
 {
-    std::string realname = server->serve_file_root + filename;
+    std::string realname = global->serveFileRoot + filename;
     if(filename == "/")
         realname += "index.html";
     if(!fileExist(realname))
@@ -144,6 +145,7 @@ static int process_request(WebServer *server, Request &request, Response &respon
         if(x.method == request.method && x.path == request.url)
         {
             response_callback &rc = x.rc;
+            std::shared_ptr<void> scope = server->request_scope ? server->request_scope() : nullptr;
             try
             {
                 return_data = rc(request, response);
@@ -178,9 +180,9 @@ static int process_request(WebServer *server, Request &request, Response &respon
         return 2;
     }
 
-    if(server->serve_file)
+    if(!global->serveFileRoot.empty())
     {
-        if(request.method == "GET" && serveFile(server, request.url, response.content_type, return_data) == 0)
+        if(request.method == "GET" && serveFile(request.url, response.content_type, return_data) == 0)
             return 0;
     }
 
@@ -0,0 +1,144 @@
+#include "handler/settings.h"
+#include "executor.h"
+#include "metrics.h"
+
+/// the executor and queue index of the worker running on this thread
+static thread_local Executor *current_executor = nullptr;
+static thread_local size_t current_queue = 0;
+
+Executor::Executor(size_t threads_count)
+{
+    if(!threads_count)
+        threads_count = 1;
+    for(size_t i = 0; i < threads_count; i++)
+        queues.emplace_back(std::make_unique<Queue>());
+    for(size_t i = 0; i < threads_count; i++)
+        threads.emplace_back(&Executor::work, this, i);
+}
+
+Executor::~Executor()
+{
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+        stopping = true;
+    }
+    idle_cv.notify_all();
+    for(auto &x : threads)
+        x.join();
+}
+
+void Executor::post(Task task)
+{
+    Task wrapped = [task = std::move(task), trace = traceCurrent(), settings = global.current()]()
+    {
+        TraceScope trace_scope(trace);
+        SettingsScope settings_scope(settings);
+        task();
+    };
+    /// tasks posted by a worker stay on its own queue, others are spread over all queues
+    size_t index = current_executor == this ? current_queue : next_queue++ % queues.size();
+    {
+        std::lock_guard<std::mutex> guard(queues[index]->lock);
+        queues[index]->tasks.emplace_back(std::move(wrapped));
+    }
+    pending++;
+    metricGaugeAdd(METRIC_EXECUTOR_QUEUED, 1);
+    {
+        std::lock_guard<std::mutex> guard(idle_lock);
+    }
+    idle_cv.notify_one();
+}
+
+bool Executor::pop(size_t self, Task &task)
+{
+    /// newest task from the own queue first, then the oldest task of another queue
+    {
+        Queue &own = *queues[self];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if(!own.tasks.empty())
+        {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            pending--;
+            metricGaugeAdd(METRIC_EXECUTOR_QUEUED, -1);
+            return true;
+        }
+    }
+    for(size_t i = 1; i < queues.size(); i++)
+    {
+        Queue &other = *queues[(self + i) % queues.size()];
+        std::lock_guard<std::mutex> guard(other.lock);
+        if(!other.tasks.empty())
+        {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            pending--;
+            metricGaugeAdd(METRIC_EXECUTOR_QUEUED, -1);
+            metricAdd(METRIC_EXECUTOR_STEALS);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Executor::work(size_t self)
+{
+    current_executor = this;
+    current_queue = self;
+    Task task;
+    while(true)
+    {
+        if(pop(self, task))
+        {
+            metricGaugeAdd(METRIC_EXECUTOR_ACTIVE, 1);
+            task();
+            task = nullptr;
+            metricGaugeAdd(METRIC_EXECUTOR_ACTIVE, -1);
+            metricAdd(METRIC_EXECUTOR_TASKS);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(idle_lock);
+        idle_cv.wait(lock, [this](){ return stopping || pending > 0; });
+        if(stopping && pending <= 0)
+            return;
+    }
+}
+
+void Executor::parallelFor(size_t count, size_t max_parallel, const std::function<void(size_t)> &func)
+{
+    if(!count)
+        return;
+    /// helpers that only get to run after everything is done find no index left and leave without touching func
+    struct State
+    {
+        std::atomic_size_t next {0};
+        size_t count = 0;
+        const std::function<void(size_t)> *func = nullptr;
+        std::mutex lock;
+        std::condition_variable done;
+        size_t running = 0;
+    };
+    auto state = std::make_shared<State>();
+    state->count = count;
+    state->func = &func;
+    auto run = [](State &state)
+    {
+        {
+            std::lock_guard<std::mutex> guard(state.lock);
+            state.running++;
+        }
+        size_t index;
+        while((index = state.next++) < state.count)
+            (*state.func)(index);
+        std::lock_guard<std::mutex> guard(state.lock);
+        if(--state.running == 0)
+            state.done.notify_all();
+    };
+
+    size_t helpers = std::min(max_parallel ? max_parallel : count, count) - 1;
+    for(size_t i = 0; i < helpers; i++)
+        post([state, run](){ run(*state); });
+    run(*state);
+    std::unique_lock<std::mutex> lock(state->lock);
+    state->done.wait(lock, [&](){ return state->running == 0 && state->next >= state->count; });
+}
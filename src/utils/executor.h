@@ -0,0 +1,63 @@
+#ifndef EXECUTOR_H_INCLUDED
+#define EXECUTOR_H_INCLUDED
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/// a fixed set of worker threads, each with its own task queue, idle workers steal from the others
+class Executor
+{
+public:
+    using Task = std::function<void()>;
+
+    explicit Executor(size_t threads);
+    ~Executor();
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    size_t size() const { return threads.size(); }
+
+    /// queues a task, the request trace and settings snapshot of the calling thread go along with it
+    void post(Task task);
+
+    template <typename F>
+    auto submit(F &&func) -> std::future<decltype(func())>
+    {
+        using R = decltype(func());
+        auto task = std::make_shared<std::packaged_task<R()>>(std::forward<F>(func));
+        std::future<R> result = task->get_future();
+        post([task](){ (*task)(); });
+        return result;
+    }
+
+    /// calls func(0) to func(count - 1) with up to max_parallel of them at once, the calling thread takes part
+    /// so this never waits for a free worker, and returns once every call has finished
+    void parallelFor(size_t count, size_t max_parallel, const std::function<void(size_t)> &func);
+
+private:
+    struct Queue
+    {
+        std::mutex lock;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> threads;
+    std::mutex idle_lock;
+    std::condition_variable idle_cv;
+    std::atomic<int64_t> pending {0};
+    std::atomic<size_t> next_queue {0};
+    bool stopping = false;
+
+    bool pop(size_t self, Task &task);
+    void work(size_t self);
+};
+
+#endif // EXECUTOR_H_INCLUDED
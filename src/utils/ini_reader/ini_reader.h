@@ -226,10 +226,9 @@ public:
 
         bool inExcludedSection = false, inDirectSaveSection = false, inIsolatedSection = false;
         std::string strLine, thisSection, curSection, itemName, itemVal;
+        std::string_view line;
         string_multimap itemGroup;
         string_array read_sections;
-        std::stringstream strStrm;
-        char delimiter = getLineBreak(content);
 
         erase_all(); //first erase all data
         if(do_utf8_to_gbk && isStrUTF8(content))
@@ -243,12 +242,12 @@ public:
             inDirectSaveSection = chk_direct_save(curSection); //check if this section requires direct-save
             inIsolatedSection = true;
         }
-        strStrm<<content;
+        LineReader reader(content);
         last_error_index = 0; //reset error index
-        while(getline(strStrm, strLine, delimiter)) //get one line of content
+        while(reader.next(line)) //get one line of content
         {
             last_error_index++;
-            strLine = trimWhitespace(strLine);
+            strLine.assign(trimWhitespaceView(line));
             string_size lineSize = strLine.size(), pos_equal = strLine.find('=');
             if((!lineSize || strLine[0] == ';' || strLine[0] == '#' || (lineSize >= 2 && strLine[0] == '/' && strLine[1] == '/')) && !inDirectSaveSection) //empty lines and comments are ignored
                 continue;
@@ -1,78 +1,97 @@
 #ifndef LOCK_H_INCLUDED
 #define LOCK_H_INCLUDED
 
-#include <atomic>
+#include <array>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
 #include <thread>
 
+/// reader-writer lock, waiting threads sleep instead of spinning. the thread holding the write lock may also
+/// take read locks, those are no-ops. with writeFirst, new readers wait while a writer is queued
 class RWLock
 {
-    static constexpr int WRITE_LOCK_STATUS = -1;
-    static constexpr int FREE_STATUS = 0;
 private:
-    const std::thread::id NULL_THREAD;
     const bool WRITE_FIRST;
+    std::mutex m_mutex;
+    std::condition_variable m_readCV, m_writeCV;
     std::thread::id m_write_thread_id;
-    std::atomic_int m_lockCount;
-    std::atomic_uint m_writeWaitCount;
+    int m_readCount = 0;
+    unsigned int m_writeWaitCount = 0;
+    bool m_writing = false;
+
+    bool ownsWrite() const { return m_writing && m_write_thread_id == std::this_thread::get_id(); }
 public:
     RWLock(const RWLock&) = delete;
     RWLock& operator=(const RWLock&) = delete;
-    explicit RWLock(bool writeFirst = true): WRITE_FIRST(writeFirst), m_write_thread_id(), m_lockCount(0), m_writeWaitCount(0) {}
+    explicit RWLock(bool writeFirst = true): WRITE_FIRST(writeFirst) {}
     virtual ~RWLock() = default;
-    int readLock()
+    void readLock()
     {
-        if (std::this_thread::get_id() != m_write_thread_id)
-        {
-            int count;
-            if (WRITE_FIRST)
-            {
-                do
-                {
-                    while ((count = m_lockCount) == WRITE_LOCK_STATUS || m_writeWaitCount > 0);
-                }
-                while (!m_lockCount.compare_exchange_weak(count, count + 1));
-            }
-            else
-            {
-                do
-                {
-                    while ((count = m_lockCount) == WRITE_LOCK_STATUS);
-                }
-                while (!m_lockCount.compare_exchange_weak(count, count + 1));
-            }
-        }
-        return m_lockCount;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (ownsWrite())
+            return;
+        m_readCV.wait(lock, [this]{ return !m_writing && !(WRITE_FIRST && m_writeWaitCount > 0); });
+        ++m_readCount;
     }
-    int readUnlock()
+    void readUnlock()
     {
-        if (std::this_thread::get_id() != m_write_thread_id)
-            --m_lockCount;
-        return m_lockCount;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (ownsWrite())
+            return;
+        if (--m_readCount == 0 && m_writeWaitCount > 0)
+            m_writeCV.notify_one();
     }
-    int writeLock()
+    void writeLock()
     {
-        if (std::this_thread::get_id() != m_write_thread_id)
-        {
-            ++m_writeWaitCount;
-            for (int zero = FREE_STATUS; !m_lockCount.compare_exchange_weak(zero, WRITE_LOCK_STATUS); zero = FREE_STATUS);
-            --m_writeWaitCount;
-            m_write_thread_id = std::this_thread::get_id();
-        }
-        return m_lockCount;
+        std::unique_lock<std::mutex> lock(m_mutex);
+        if (ownsWrite())
+            return;
+        ++m_writeWaitCount;
+        m_writeCV.wait(lock, [this]{ return !m_writing && m_readCount == 0; });
+        --m_writeWaitCount;
+        m_writing = true;
+        m_write_thread_id = std::this_thread::get_id();
     }
-    int writeUnlock()
+    void writeUnlock()
     {
-        if (std::this_thread::get_id() != m_write_thread_id)
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!ownsWrite())
         {
             throw std::runtime_error("writeLock/Unlock mismatch");
         }
-        if (WRITE_LOCK_STATUS != m_lockCount)
-        {
-            throw std::runtime_error("RWLock internal error");
-        }
-        m_write_thread_id = NULL_THREAD;
-        m_lockCount.store(FREE_STATUS);
-        return m_lockCount;
+        m_writing = false;
+        m_write_thread_id = std::thread::id();
+        if (m_writeWaitCount > 0)
+            m_writeCV.notify_one();
+        if (!WRITE_FIRST || m_writeWaitCount == 0)
+            m_readCV.notify_all();
+    }
+};
+
+/// a fixed set of RWLocks picked by key, so unrelated keys rarely share a lock
+template <size_t N>
+class StripedRWLock
+{
+private:
+    std::array<RWLock, N> m_locks;
+public:
+    RWLock &operator[](const std::string &key)
+    {
+        return m_locks[std::hash<std::string>()(key) % N];
+    }
+    /// every stripe, always taken in the same order
+    void writeLockAll()
+    {
+        for (RWLock &x : m_locks)
+            x.writeLock();
+    }
+    void writeUnlockAll()
+    {
+        for (RWLock &x : m_locks)
+            x.writeUnlock();
     }
 };
 
@@ -1,13 +1,13 @@
 #include <string>
 #include <iostream>
+#include <atomic>
+#include <mutex>
 #include <thread>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <unistd.h>
 
 #include "handler/settings.h"
-#include "defer.h"
-#include "lock.h"
 #include "logger.h"
 
 std::string getTime(int type)
@@ -38,23 +38,11 @@ std::string getTime(int type)
     return {tmpbuf};
 }
 
-static std::string get_thread_name()
+static const std::string &get_thread_name()
 {
     static std::atomic_int counter = 0;
-    static std::map<std::thread::id, std::string> thread_names;
-    static RWLock lock;
-    std::thread::id id = std::this_thread::get_id();
-    lock.readLock();
-    if (thread_names.find(id) != thread_names.end())
-    {
-        defer(lock.readUnlock();)
-        return thread_names[id];
-    }
-    lock.readUnlock();
-    lock.writeLock();
-    std::string name = "Thread-" + std::to_string(++counter);
-    thread_names[id] = name;
-    lock.writeUnlock();
+    /// named on first use, each thread only ever reads its own
+    thread_local const std::string name = "Thread-" + std::to_string(++counter);
     return name;
 }
 
@@ -62,7 +50,7 @@ std::mutex log_mutex;
 
 void writeLog(int type, const std::string &content, int level)
 {
-    if(level > global.logLevel)
+    if(level > global->logLevel)
         return;
     std::lock_guard<std::mutex> lock(log_mutex);
     const char *levels[] = {"[FATL]", "[ERRO]", "[WARN]", "[INFO]", "[DEBG]", "[VERB]"};
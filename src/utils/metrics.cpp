@@ -0,0 +1,196 @@
+#include <string>
+#include <atomic>
+#include <cstdio>
+
+#include "metrics.h"
+
+/// upper bounds of the latency histogram buckets in seconds, +Inf is implied
+static const double stage_buckets[] = {0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1, 2.5, 5, 10, 30};
+static constexpr size_t stage_bucket_count = sizeof(stage_buckets) / sizeof(stage_buckets[0]);
+static const char *stage_names[METRIC_STAGE_COUNT] = {"fetch", "parse", "filter", "preprocess", "render", "export", "ruleset"};
+
+struct StageHistogram
+{
+    std::atomic<uint64_t> buckets[stage_bucket_count + 1] {};
+    std::atomic<uint64_t> count {0};
+    std::atomic<uint64_t> sum_ns {0};
+};
+
+static StageHistogram stage_histograms[METRIC_STAGE_COUNT];
+static std::atomic<uint64_t> counters[METRIC_COUNTER_COUNT] {};
+static std::atomic<int64_t> gauges[METRIC_GAUGE_COUNT] {};
+static thread_local StageTimer *current_timer = nullptr;
+static thread_local RequestTracePtr current_trace;
+
+const char *metricStageName(metric_stage stage)
+{
+    return stage_names[stage];
+}
+
+void RequestTrace::addStage(metric_stage stage, duration elapsed)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    stages[stage] += elapsed;
+}
+
+void RequestTrace::addFetch(Fetch fetch)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    fetches.emplace_back(std::move(fetch));
+}
+
+void RequestTrace::addFilter(int group_id, size_t before, size_t after)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    filters.push_back({group_id, before, after});
+}
+
+void RequestTrace::addRule(std::vector<Rule> &rules, size_t index, const std::string &rule, duration elapsed)
+{
+    std::lock_guard<std::mutex> guard(lock);
+    if(rules.size() <= index)
+        rules.resize(index + 1);
+    Rule &entry = rules[index];
+    if(entry.rule.empty())
+        entry.rule = rule;
+    entry.calls++;
+    entry.elapsed += elapsed;
+}
+
+RequestTracePtr traceCurrent()
+{
+    return current_trace;
+}
+
+TraceScope::TraceScope(RequestTracePtr trace) : previous(std::move(current_trace))
+{
+    current_trace = std::move(trace);
+}
+
+TraceScope::~TraceScope()
+{
+    current_trace = std::move(previous);
+}
+
+void metricAdd(metric_counter counter, uint64_t value)
+{
+    counters[counter].fetch_add(value, std::memory_order_relaxed);
+}
+
+void metricGaugeAdd(metric_gauge gauge, int64_t delta)
+{
+    gauges[gauge].fetch_add(delta, std::memory_order_relaxed);
+}
+
+void metricObserve(metric_stage stage, std::chrono::steady_clock::duration duration)
+{
+    auto &histogram = stage_histograms[stage];
+    double seconds = std::chrono::duration<double>(duration).count();
+    size_t index = 0;
+    while(index < stage_bucket_count && seconds > stage_buckets[index])
+        index++;
+    histogram.buckets[index].fetch_add(1, std::memory_order_relaxed);
+    histogram.count.fetch_add(1, std::memory_order_relaxed);
+    histogram.sum_ns.fetch_add(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count(), std::memory_order_relaxed);
+}
+
+StageTimer::StageTimer(metric_stage stage) : stage(stage), start(std::chrono::steady_clock::now()), parent(current_timer)
+{
+    current_timer = this;
+}
+
+StageTimer::~StageTimer()
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    current_timer = parent;
+    if(parent)
+        parent->nested += elapsed;
+    metricObserve(stage, elapsed - nested);
+    if(current_trace)
+        current_trace->addStage(stage, elapsed - nested);
+}
+
+static void appendMetric(std::string &output, const char *name, const std::string &labels, double value)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "%.9g", value);
+    output += name;
+    if(!labels.empty())
+        output += "{" + labels + "}";
+    output += " ";
+    output += buffer;
+    output += "\n";
+}
+
+static void appendHeader(std::string &output, const char *name, const char *type, const char *help)
+{
+    output += "# HELP ";
+    output += name;
+    output += " ";
+    output += help;
+    output += "\n# TYPE ";
+    output += name;
+    output += " ";
+    output += type;
+    output += "\n";
+}
+
+std::string metricsRender()
+{
+    std::string output;
+    auto counter = [](metric_counter x){ return static_cast<double>(counters[x].load(std::memory_order_relaxed)); };
+
+    appendHeader(output, "subconverter_stage_duration_seconds", "histogram", "Time spent in each processing stage, excluding nested stages.");
+    for(int i = 0; i < METRIC_STAGE_COUNT; i++)
+    {
+        auto &histogram = stage_histograms[i];
+        std::string stage = std::string("stage=\"") + stage_names[i] + "\"";
+        uint64_t cumulative = 0;
+        char le[32];
+        for(size_t j = 0; j <= stage_bucket_count; j++)
+        {
+            cumulative += histogram.buckets[j].load(std::memory_order_relaxed);
+            if(j < stage_bucket_count)
+                snprintf(le, sizeof(le), "%g", stage_buckets[j]);
+            else
+                snprintf(le, sizeof(le), "+Inf");
+            appendMetric(output, "subconverter_stage_duration_seconds_bucket", stage + ",le=\"" + le + "\"", static_cast<double>(cumulative));
+        }
+        appendMetric(output, "subconverter_stage_duration_seconds_sum", stage, histogram.sum_ns.load(std::memory_order_relaxed) / 1e9);
+        appendMetric(output, "subconverter_stage_duration_seconds_count", stage, static_cast<double>(histogram.count.load(std::memory_order_relaxed)));
+    }
+
+    appendHeader(output, "subconverter_requests_total", "counter", "HTTP requests handled.");
+    appendMetric(output, "subconverter_requests_total", "", counter(METRIC_REQUESTS));
+    appendHeader(output, "subconverter_response_bytes_total", "counter", "Response body bytes sent, after compression.");
+    appendMetric(output, "subconverter_response_bytes_total", "", counter(METRIC_RESPONSE_BYTES));
+    appendHeader(output, "subconverter_upstream_transfers_total", "counter", "Transfers made to upstream servers.");
+    appendMetric(output, "subconverter_upstream_transfers_total", "", counter(METRIC_UPSTREAM_TRANSFERS));
+
+    appendHeader(output, "subconverter_fetch_cache_total", "counter", "Cached fetch lookups by result.");
+    appendMetric(output, "subconverter_fetch_cache_total", "result=\"memory_hit\"", counter(METRIC_CACHE_MEMORY_HIT));
+    appendMetric(output, "subconverter_fetch_cache_total", "result=\"disk_hit\"", counter(METRIC_CACHE_DISK_HIT));
+    appendMetric(output, "subconverter_fetch_cache_total", "result=\"revalidated\"", counter(METRIC_CACHE_REVALIDATED));
+    appendMetric(output, "subconverter_fetch_cache_total", "result=\"miss\"", counter(METRIC_CACHE_MISS));
+    double hits = counter(METRIC_CACHE_MEMORY_HIT) + counter(METRIC_CACHE_DISK_HIT), lookups = hits + counter(METRIC_CACHE_MISS);
+    appendHeader(output, "subconverter_fetch_cache_hit_ratio", "gauge", "Share of cached fetch lookups served without an upstream transfer.");
+    appendMetric(output, "subconverter_fetch_cache_hit_ratio", "", lookups > 0 ? hits / lookups : 0);
+    appendHeader(output, "subconverter_rule_cache_total", "counter", "Rendered ruleset lookups by result.");
+    appendMetric(output, "subconverter_rule_cache_total", "result=\"hit\"", counter(METRIC_RULE_CACHE_HIT));
+    appendMetric(output, "subconverter_rule_cache_total", "result=\"miss\"", counter(METRIC_RULE_CACHE_MISS));
+
+    appendHeader(output, "subconverter_inflight_requests", "gauge", "HTTP requests being handled.");
+    appendMetric(output, "subconverter_inflight_requests", "", static_cast<double>(gauges[METRIC_INFLIGHT_REQUESTS].load(std::memory_order_relaxed)));
+    appendHeader(output, "subconverter_queued_requests", "gauge", "Accepted connections waiting for a worker thread.");
+    appendMetric(output, "subconverter_queued_requests", "", static_cast<double>(gauges[METRIC_QUEUED_REQUESTS].load(std::memory_order_relaxed)));
+
+    appendHeader(output, "subconverter_executor_queued_tasks", "gauge", "Tasks waiting in the executor queues.");
+    appendMetric(output, "subconverter_executor_queued_tasks", "", static_cast<double>(gauges[METRIC_EXECUTOR_QUEUED].load(std::memory_order_relaxed)));
+    appendHeader(output, "subconverter_executor_active_tasks", "gauge", "Tasks being run by executor workers.");
+    appendMetric(output, "subconverter_executor_active_tasks", "", static_cast<double>(gauges[METRIC_EXECUTOR_ACTIVE].load(std::memory_order_relaxed)));
+    appendHeader(output, "subconverter_executor_tasks_total", "counter", "Tasks run by executor workers.");
+    appendMetric(output, "subconverter_executor_tasks_total", "", counter(METRIC_EXECUTOR_TASKS));
+    appendHeader(output, "subconverter_executor_steals_total", "counter", "Tasks an idle executor worker took from the queue of another.");
+    appendMetric(output, "subconverter_executor_steals_total", "", counter(METRIC_EXECUTOR_STEALS));
+    return output;
+}
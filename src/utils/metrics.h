@@ -0,0 +1,126 @@
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include <string>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+enum metric_stage
+{
+    METRIC_STAGE_FETCH,
+    METRIC_STAGE_PARSE,
+    METRIC_STAGE_FILTER,
+    METRIC_STAGE_PREPROCESS,
+    METRIC_STAGE_RENDER,
+    METRIC_STAGE_EXPORT,
+    METRIC_STAGE_RULESET,
+    METRIC_STAGE_COUNT
+};
+
+enum metric_counter
+{
+    METRIC_REQUESTS,
+    METRIC_RESPONSE_BYTES,
+    METRIC_UPSTREAM_TRANSFERS,
+    METRIC_CACHE_MEMORY_HIT,
+    METRIC_CACHE_DISK_HIT,
+    METRIC_CACHE_REVALIDATED,
+    METRIC_CACHE_MISS,
+    METRIC_RULE_CACHE_HIT,
+    METRIC_RULE_CACHE_MISS,
+    METRIC_EXECUTOR_TASKS,
+    METRIC_EXECUTOR_STEALS,
+    METRIC_COUNTER_COUNT
+};
+
+enum metric_gauge
+{
+    METRIC_INFLIGHT_REQUESTS,
+    METRIC_QUEUED_REQUESTS,
+    METRIC_EXECUTOR_QUEUED,
+    METRIC_EXECUTOR_ACTIVE,
+    METRIC_GAUGE_COUNT
+};
+
+/// per-request breakdown collected for a traced request, shared with the threads working on it
+struct RequestTrace
+{
+    using duration = std::chrono::steady_clock::duration;
+
+    struct Fetch
+    {
+        std::string url;
+        std::string cache;
+        size_t bytes = 0;
+        duration elapsed {};
+    };
+
+    struct Filter
+    {
+        int group_id = 0;
+        size_t before = 0, after = 0;
+    };
+
+    struct Rule
+    {
+        std::string rule;
+        uint64_t calls = 0;
+        duration elapsed {};
+    };
+
+    std::mutex lock;
+    duration stages[METRIC_STAGE_COUNT] {};
+    std::vector<Fetch> fetches;
+    std::vector<Filter> filters;
+    std::vector<Rule> rename_rules, emoji_rules;
+
+    void addStage(metric_stage stage, duration elapsed);
+    void addFetch(Fetch fetch);
+    void addFilter(int group_id, size_t before, size_t after);
+    void addRule(std::vector<Rule> &rules, size_t index, const std::string &rule, duration elapsed);
+};
+
+using RequestTracePtr = std::shared_ptr<RequestTrace>;
+
+/// the trace of the request the calling thread is working on, null when it is not traced
+RequestTracePtr traceCurrent();
+
+/// makes a trace current on this thread for its own lifetime
+class TraceScope
+{
+public:
+    explicit TraceScope(RequestTracePtr trace);
+    ~TraceScope();
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    RequestTracePtr previous;
+};
+
+const char *metricStageName(metric_stage stage);
+void metricAdd(metric_counter counter, uint64_t value = 1);
+void metricGaugeAdd(metric_gauge gauge, int64_t delta);
+void metricObserve(metric_stage stage, std::chrono::steady_clock::duration duration);
+std::string metricsRender();
+
+/// times a stage for its own lifetime, time spent in stage timers nested on the same thread is left out
+class StageTimer
+{
+public:
+    explicit StageTimer(metric_stage stage);
+    ~StageTimer();
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+private:
+    metric_stage stage;
+    std::chrono::steady_clock::time_point start;
+    std::chrono::steady_clock::duration nested {};
+    StageTimer *parent;
+};
+
+#endif // METRICS_H_INCLUDED
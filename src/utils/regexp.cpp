@@ -1,13 +1,19 @@
 #include <string>
 #include <cstdarg>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
 
 /*
 #ifdef USE_STD_REGEX
 #include <regex>
 #else
 */
-#include <jpcre2.hpp>
-using jp = jpcre2::select<char>;
+#define PCRE2_CODE_UNIT_WIDTH 8
+#include <pcre2.h>
 //#endif // USE_STD_REGEX
 
 #include "regexp.h"
@@ -131,38 +137,165 @@ int regGetMatch(const std::string &src, const std::string &match, size_t group_c
 
 #else
 */
+/// compiled patterns are shared by all threads, keyed by pattern and compile options
+using pcre2_code_ptr = RegexPattern;
+
+struct RegexCache
+{
+    using entry = std::pair<std::string, pcre2_code_ptr>;
+    std::mutex lock;
+    std::list<entry> lru;
+    std::unordered_map<std::string_view, std::list<entry>::iterator> index;
+    size_t capacity = 1024;
+    std::atomic_uint64_t hits{0}, misses{0};
+};
+
+static RegexCache &getRegexCache()
+{
+    static RegexCache cache;
+    return cache;
+}
+
+static pcre2_code_ptr compilePattern(const std::string &pattern, uint32_t options)
+{
+    int error_number;
+    PCRE2_SIZE error_offset;
+    pcre2_code *code = pcre2_compile(reinterpret_cast<PCRE2_SPTR>(pattern.data()), pattern.size(), options, &error_number, &error_offset, nullptr);
+    if(code == nullptr)
+        return nullptr;
+    pcre2_jit_compile(code, PCRE2_JIT_COMPLETE); /// failure is not fatal, interpreter will be used instead
+    return {code, pcre2_code_free};
+}
+
+static pcre2_code_ptr getPattern(const std::string &pattern, uint32_t options)
+{
+    RegexCache &cache = getRegexCache();
+    std::string key = pattern;
+    key.append(reinterpret_cast<const char*>(&options), sizeof(options));
+    {
+        std::lock_guard<std::mutex> guard(cache.lock);
+        auto iter = cache.index.find(key);
+        if(iter != cache.index.end())
+        {
+            cache.hits++;
+            cache.lru.splice(cache.lru.begin(), cache.lru, iter->second);
+            return iter->second->second;
+        }
+    }
+    cache.misses++;
+    /// invalid patterns are cached as nullptr so they are not compiled again
+    pcre2_code_ptr code = compilePattern(pattern, options);
+    std::lock_guard<std::mutex> guard(cache.lock);
+    if(!cache.capacity || cache.index.find(key) != cache.index.end())
+        return code;
+    cache.lru.emplace_front(std::move(key), code);
+    cache.index.emplace(cache.lru.front().first, cache.lru.begin());
+    while(cache.lru.size() > cache.capacity)
+    {
+        cache.index.erase(cache.lru.back().first);
+        cache.lru.pop_back();
+    }
+    return code;
+}
+
+/// match data is reused within each thread, growing when a pattern needs a larger ovector
+static pcre2_match_data *getMatchData(const pcre2_code *code)
+{
+    static thread_local std::unique_ptr<pcre2_match_data, decltype(&pcre2_match_data_free)> match_data(nullptr, pcre2_match_data_free);
+    uint32_t capture_count = 0;
+    pcre2_pattern_info(code, PCRE2_INFO_CAPTURECOUNT, &capture_count);
+    if(!match_data || pcre2_get_ovector_count(match_data.get()) < capture_count + 1)
+        match_data.reset(pcre2_match_data_create(std::max<uint32_t>(capture_count + 1, 16), nullptr));
+    return match_data.get();
+}
+
+static int matchPattern(const pcre2_code *code, const std::string &src, PCRE2_SIZE offset, uint32_t options, pcre2_match_data *match_data)
+{
+    int rc = pcre2_match(code, reinterpret_cast<PCRE2_SPTR>(src.data()), src.size(), offset, options, match_data, nullptr);
+    if(rc == PCRE2_ERROR_JIT_STACKLIMIT) /// default JIT stack is small, retry with the interpreter
+        rc = pcre2_match(code, reinterpret_cast<PCRE2_SPTR>(src.data()), src.size(), offset, options | PCRE2_NO_JIT, match_data, nullptr);
+    return rc;
+}
+
+void regSetCacheCapacity(size_t capacity)
+{
+    RegexCache &cache = getRegexCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    cache.capacity = capacity;
+    while(cache.lru.size() > cache.capacity)
+    {
+        cache.index.erase(cache.lru.back().first);
+        cache.lru.pop_back();
+    }
+}
+
+RegexCacheStats regGetCacheStats()
+{
+    RegexCache &cache = getRegexCache();
+    std::lock_guard<std::mutex> guard(cache.lock);
+    return {cache.hits, cache.misses, cache.lru.size(), cache.capacity};
+}
+
 bool regMatch(const std::string &src, const std::string &match)
 {
-    jp::Regex reg;
-    reg.setPattern(match).addModifier("m").addPcre2Option(PCRE2_ANCHORED|PCRE2_ENDANCHORED|PCRE2_UTF).compile();
+    pcre2_code_ptr reg = getPattern(match, PCRE2_MULTILINE|PCRE2_ANCHORED|PCRE2_ENDANCHORED|PCRE2_UTF);
     if(!reg)
         return false;
-    return reg.match(src, "g");
+    return matchPattern(reg.get(), src, 0, 0, getMatchData(reg.get())) >= 0;
 }
 
-bool regFind(const std::string &src, const std::string &match)
+RegexPattern regCompile(const std::string &match)
+{
+    return getPattern(match, PCRE2_MULTILINE|PCRE2_UTF|PCRE2_ALT_BSUX);
+}
+
+bool regFind(const std::string &src, const RegexPattern &reg)
 {
-    jp::Regex reg;
-    reg.setPattern(match).addModifier("m").addPcre2Option(PCRE2_UTF|PCRE2_ALT_BSUX).compile();
     if(!reg)
         return false;
-    return reg.match(src, "g");
+    return matchPattern(reg.get(), src, 0, 0, getMatchData(reg.get())) >= 0;
+}
+
+bool regFind(const std::string &src, const std::string &match)
+{
+    return regFind(src, regCompile(match));
 }
 
 std::string regReplace(const std::string &src, const std::string &match, const std::string &rep, bool global, bool multiline)
 {
-    jp::Regex reg;
-    reg.setPattern(match).addModifier(multiline ? "m" : "").addPcre2Option(PCRE2_UTF|PCRE2_MULTILINE|PCRE2_ALT_BSUX).compile();
+    return regReplace(src, regCompile(match), rep, global);
+}
+
+std::string regReplace(const std::string &src, const RegexPattern &reg, const std::string &rep, bool global)
+{
     if(!reg)
         return src;
-    return reg.replace(src, rep, global ? "gEx" : "Ex");
+    uint32_t options = PCRE2_SUBSTITUTE_OVERFLOW_LENGTH|PCRE2_SUBSTITUTE_UNKNOWN_UNSET|PCRE2_SUBSTITUTE_UNSET_EMPTY|PCRE2_SUBSTITUTE_EXTENDED;
+    if(global)
+        options |= PCRE2_SUBSTITUTE_GLOBAL;
+    pcre2_match_data *match_data = getMatchData(reg.get());
+    std::string result;
+    result.resize(src.size() + rep.size() + 1);
+    for(int retry = 0; retry < 2; retry++)
+    {
+        PCRE2_SIZE length = result.size();
+        int rc = pcre2_substitute(reg.get(), reinterpret_cast<PCRE2_SPTR>(src.data()), src.size(), 0, options, match_data, nullptr,
+                                  reinterpret_cast<PCRE2_SPTR>(rep.data()), rep.size(), reinterpret_cast<PCRE2_UCHAR*>(result.data()), &length);
+        if(rc >= 0)
+        {
+            result.resize(length);
+            return result;
+        }
+        if(rc != PCRE2_ERROR_NOMEMORY)
+            break;
+        result.resize(length); /// length now holds the required size, including the terminating zero
+    }
+    return src;
 }
 
 bool regValid(const std::string &reg)
 {
-    jp::Regex r;
-    r.setPattern(reg).addPcre2Option(PCRE2_UTF|PCRE2_ALT_BSUX).compile();
-    return !!r;
+    return getPattern(reg, PCRE2_UTF|PCRE2_ALT_BSUX) != nullptr;
 }
 
 int regGetMatch(const std::string &src, const std::string &match, size_t group_count, ...)
@@ -189,30 +322,56 @@ int regGetMatch(const std::string &src, const std::string &match, size_t group_c
 
 std::vector<std::string> regGetAllMatch(const std::string &src, const std::string &match, bool group_only)
 {
-    jp::Regex reg;
-    reg.setPattern(match).addModifier("m").addPcre2Option(PCRE2_UTF|PCRE2_ALT_BSUX).compile();
-    jp::VecNum vec_num;
-    jp::RegexMatch rm;
-    size_t count = rm.setRegexObject(&reg).setSubject(src).setNumberedSubstringVector(&vec_num).setModifier("gm").match();
     std::vector<std::string> result;
-    if(!count)
+    pcre2_code_ptr reg = regCompile(match);
+    if(!reg)
         return result;
-    size_t begin = 0;
-    if(group_only)
-        begin = 1;
-    size_t index = begin, match_index = 0;
+    pcre2_match_data *match_data = getMatchData(reg.get());
+    PCRE2_SIZE *ovector = pcre2_get_ovector_pointer(match_data);
+    uint32_t capture_count = 0, newline = 0;
+    pcre2_pattern_info(reg.get(), PCRE2_INFO_CAPTURECOUNT, &capture_count);
+    pcre2_pattern_info(reg.get(), PCRE2_INFO_NEWLINE, &newline);
+    bool crlf_is_newline = newline == PCRE2_NEWLINE_ANY || newline == PCRE2_NEWLINE_CRLF || newline == PCRE2_NEWLINE_ANYCRLF;
+    size_t begin = group_only ? 1 : 0;
+    PCRE2_SIZE offset = 0, length = src.size();
+    uint32_t options = 0;
+    /// find all matches, the same way as pcre2demo does
     while(true)
     {
-        if(vec_num.size() <= match_index)
-            break;
-        if(vec_num[match_index].size() <= index)
+        int rc = matchPattern(reg.get(), src, offset, options, match_data);
+        if(rc == PCRE2_ERROR_NOMATCH)
         {
-            match_index++;
-            index = begin;
+            if(options == 0)
+                break;
+            /// no non-empty match at the position of an empty match, advance one character
+            offset++;
+            if(crlf_is_newline && offset < length && src[offset - 1] == '\r' && src[offset] == '\n')
+                offset++;
+            else
+                while(offset < length && (src[offset] & 0xc0) == 0x80)
+                    offset++;
+            options = 0;
+            if(offset > length)
+                break;
             continue;
         }
-        result.push_back(std::move(vec_num[match_index][index]));
-        index++;
+        if(rc < 0)
+            break;
+        for(size_t i = begin; i <= capture_count; i++)
+        {
+            if(ovector[2 * i] == PCRE2_UNSET)
+                result.emplace_back();
+            else
+                result.emplace_back(src, ovector[2 * i], ovector[2 * i + 1] - ovector[2 * i]);
+        }
+        offset = ovector[1];
+        options = 0;
+        if(ovector[0] == ovector[1])
+        {
+            if(ovector[0] == length)
+                break;
+            options = PCRE2_NOTEMPTY_ATSTART | PCRE2_ANCHORED;
+        }
     }
     return result;
 }
@@ -2,6 +2,22 @@
 #define REGEXP_H_INCLUDED
 
 #include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+struct pcre2_real_code_8;
+
+/// a compiled pattern from regCompile(), nullptr if the pattern is invalid
+using RegexPattern = std::shared_ptr<pcre2_real_code_8>;
+
+struct RegexCacheStats
+{
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t size = 0;
+    size_t capacity = 0;
+};
 
 bool regValid(const std::string &reg);
 bool regFind(const std::string &src, const std::string &match);
@@ -10,5 +26,10 @@ bool regMatch(const std::string &src, const std::string &match);
 int regGetMatch(const std::string &src, const std::string &match, size_t group_count, ...);
 std::vector<std::string> regGetAllMatch(const std::string &src, const std::string &match, bool group_only = false);
 std::string regTrim(const std::string &src);
+RegexPattern regCompile(const std::string &match);
+bool regFind(const std::string &src, const RegexPattern &reg);
+std::string regReplace(const std::string &src, const RegexPattern &reg, const std::string &rep, bool global = true);
+void regSetCacheCapacity(size_t capacity);
+RegexCacheStats regGetCacheStats();
 
 #endif // REGEXP_H_INCLUDED
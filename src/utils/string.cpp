@@ -240,6 +240,26 @@ std::string trimWhitespace(const std::string &str, bool before, bool after)
     return str.substr(bpos, epos - bpos + 1);
 }
 
+std::string_view trimWhitespaceView(std::string_view str, bool before, bool after)
+{
+    constexpr std::string_view whitespaces = " \t\f\v\n\r";
+    if(after)
+    {
+        string_size epos = str.find_last_not_of(whitespaces);
+        if(epos == std::string_view::npos)
+            return {};
+        str = str.substr(0, epos + 1);
+    }
+    if(before)
+    {
+        string_size bpos = str.find_first_not_of(whitespaces);
+        if(bpos == std::string_view::npos)
+            return {};
+        str = str.substr(bpos);
+    }
+    return str;
+}
+
 std::string getUrlArg(const std::string &url, const std::string &request)
 {
     //std::smatch result;
@@ -1,8 +1,10 @@
 #ifndef STRING_H_INCLUDED
 #define STRING_H_INCLUDED
 
+#include <cstring>
 #include <numeric>
 #include <string>
+#include <string_view>
 #include <sstream>
 #include <vector>
 #include <map>
@@ -38,6 +40,7 @@ std::string trim(const std::string& str, bool before = true, bool after = true);
 std::string trimQuote(const std::string &str, bool before = true, bool after = true);
 void trimSelfOf(std::string &str, char target, bool before = true, bool after = true);
 std::string trimWhitespace(const std::string &str, bool before = false, bool after = true);
+std::string_view trimWhitespaceView(std::string_view str, bool before = false, bool after = true);
 std::string randomStr(int len);
 bool isStrUTF8(const std::string &data);
 
@@ -99,6 +102,35 @@ inline char getLineBreak(const std::string &str)
     return count_least(str, '\n', 1) ? '\n' : '\r';
 }
 
+/// hands out the lines of a text as views into it, split the way getLineBreak() decides,
+/// a '\r' ending a line is dropped when splitting on '\n'
+class LineReader
+{
+public:
+    explicit LineReader(std::string_view text) : LineReader(text, text.find('\n') != std::string_view::npos ? '\n' : '\r') {}
+    LineReader(std::string_view text, char delimiter) : text(text), delimiter(delimiter) {}
+
+    /// same as getline(), the text after the last delimiter is only a line when it is not empty
+    bool next(std::string_view &line)
+    {
+        if(pos >= text.size())
+            return false;
+        /// memchr is vectorized by the C library, far faster than stepping through a stream
+        const char *begin = text.data() + pos, *end = static_cast<const char*>(std::memchr(begin, delimiter, text.size() - pos));
+        size_t length = end ? end - begin : text.size() - pos;
+        line = text.substr(pos, length);
+        pos += length + 1;
+        if(delimiter == '\n' && !line.empty() && line.back() == '\r')
+            line.remove_suffix(1);
+        return true;
+    }
+
+private:
+    std::string_view text;
+    char delimiter;
+    size_t pos = 0;
+};
+
 template <typename T>
 concept Arithmetic = std::is_arithmetic_v<T>;
 